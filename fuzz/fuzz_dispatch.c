@@ -0,0 +1,104 @@
+/**
+ * \file
+ *
+ * \brief Fuzz harness of the dispatcher.
+ *
+ * The input is parsed as a session, with the built-in commands and a few
+ * commands of fixed cost, so the time taken is that of the parser. The
+ * first byte selects the output mode. The macro commands are left out, as
+ * 'repeat' costs as much as its count.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "scp_internal.h"
+
+
+/**
+ * \brief Addition Function
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  The sum of the arguments.
+ */
+static int add_cmd_func(int argc, char *argv[])
+{
+    int result = 0;
+    int idx;
+
+    for (idx=0; idx < argc; idx++)
+    {
+        result += atoi(argv[idx]);
+    }
+    return result;
+}
+
+
+/**
+ * \brief Echo Function
+ *
+ * Outputs the arguments as strings, which are escaped in the JSON and CSV
+ * modes.
+ *
+ * \param   out     Output for the arguments.
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  argc
+ */
+static int echo_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    int idx;
+
+    for (idx=0; idx < argc; idx++)
+    {
+        scp_out_str(out, argv[idx]);
+    }
+    return argc;
+}
+
+
+/*
+ * Initialises the parser, with the commands.
+ */
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    scp_init(0);
+
+    scp_add_command(
+            "add",
+            "a",
+            "Add <P1> to <P2> [... to <P5>]",
+            2,
+            5,
+            add_cmd_func
+            );
+
+    scp_add_command_ex(
+            "echo",
+            "e",
+            "Output <P1> [... <Pn>]",
+            0,
+            MAX_ARGC,
+            echo_cmd_func
+            );
+    return 0;
+}
+
+
+/*
+ * Parses an input as a session.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    scp_set_output_mode(data[0] % (SCP_MODE_CSV + 1));
+    scp_memory_io((const char *)data + 1, (int)size - 1);
+    scp_parse();
+    return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * \file
+ *
+ * \brief Fuzz harness of the line reader.
+ *
+ * The input is read by the parse loop as from the console, in the text mode
+ * so with the echo and backspace handling, and only the built-in commands
+ * and a command 't' to look the lines up in. The loop ends at the end of the
+ * input. The calls of 't' are checked against the lines of the input, edited
+ * as the reader does: a line too long for the input buffer must be refused
+ * as a whole, not cut and its tail run as the next line.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "scp_internal.h"
+
+/**
+ * \var calls
+ *
+ * Number of calls of the command.
+ */
+static int calls;
+
+
+/**
+ * \brief Command counting its calls.
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  argc
+ */
+static int t_cmd_func(int argc, char *argv[])
+{
+    calls++;
+    return argc;
+}
+
+
+/**
+ * \brief Tells if a line, as edited, calls the command.
+ *
+ * \param   line    The line, which ends at its first 0.
+ *
+ * \return  1 if it does, else 0.
+ */
+static int calls_t(const char *line)
+{
+    int ntokens = 0;
+    int first = 0;
+    int pos = 0;
+    int len;
+
+    for (;;)
+    {
+        pos += (int)strspn(&line[pos], TOKEN_DELIMITERS);
+        if (line[pos] == '\0')
+            break;
+        len = (int)strcspn(&line[pos], TOKEN_DELIMITERS);
+        if (ntokens++ == 0)
+            first = len == 1 && line[pos] == 't';
+        pos += len;
+    }
+    return first && ntokens - 1 <= MAX_ARGC;
+}
+
+
+/*
+ * Initialises the parser, without the 'end' command.
+ */
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    scp_init(1);
+    scp_add_command(
+            "t",
+            "",
+            "Count the calls",
+            0,
+            MAX_ARGC,
+            t_cmd_func
+            );
+    return 0;
+}
+
+
+/*
+ * Parses an input, then checks which of its lines were run.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char line[MAX_INPUT_BUFFER];
+    int expected = 0;
+    int too_long = 0;
+    int excess = 0;
+    int len = 0;
+    size_t idx;
+#if SCP_METRICS
+    unsigned long refused =
+        atomic_load(&scp_counters.responses[STATUS_TOO_LONG]);
+#endif
+
+    calls = 0;
+    scp_set_output_mode(SCP_MODE_TEXT);
+    scp_memory_io((const char *)data, (int)size);
+    scp_parse();
+
+    /* The lines, edited as by the reader. */
+    for (idx=0; idx <= size; idx++)
+    {
+        if (idx == size || data[idx] == '\n')
+        {
+            line[len] = '\0';
+            if (excess)
+                too_long++;
+            else
+                expected += calls_t(line);
+            excess = 0;
+            len    = 0;
+        }
+        else if (data[idx] == '\b' || data[idx] == 127)
+        {
+            if (excess)
+                excess--;
+            else if (len)
+                len--;
+        }
+        else if (len < MAX_INPUT_BUFFER - 1)
+        {
+            line[len++] = (char)data[idx];
+        }
+        else
+        {
+            excess++;
+        }
+    }
+    assert(calls == expected);
+#if SCP_METRICS
+    assert(atomic_load(&scp_counters.responses[STATUS_TOO_LONG]) - refused ==
+            (unsigned long)too_long);
+#else
+    (void)too_long;
+#endif
+    return 0;
+}
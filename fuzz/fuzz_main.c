@@ -0,0 +1,479 @@
+/**
+ * \file
+ *
+ * \brief Standalone driver of the fuzz harnesses, for compilers without
+ * libFuzzer.
+ *
+ * Runs the harness on each input given, files or directories of files, then
+ * on random mutations of them. The slowest inputs found are kept and mutated
+ * further, so the search climbs towards the worst case cost of the parser.
+ * At the end each input kept is timed again, as the best of #FUZZ_REPEAT
+ * runs, reported and written to the output directory. Replaying them with
+ * -n 0 times the worst cases found, as a benchmark.
+ *
+ * Usage: fuzz_\<harness\> [-n runs] [-k kept] [-s seed] [-o dir] [input...]
+ *
+ * The harnesses also build with clang -fsanitize=fuzzer instead of this
+ * driver, where -report_slow_units and -artifact_prefix keep slow inputs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**
+ * Maximum size of an input, as the default -max_len of libFuzzer.
+ */
+#define MAX_UNIT            4096
+
+/**
+ * Maximum number of slowest inputs kept.
+ */
+#define MAX_KEPT            64
+
+/**
+ * Number of runs each input kept is timed with at the end.
+ */
+#define FUZZ_REPEAT         5
+
+/**
+ * \typedef unit_t
+ *
+ * \brief An input, and how long the harness took on it.
+ */
+typedef struct {
+    /** The input. */
+    unsigned char       *data;
+    /** Size of the input. */
+    int                 size;
+    /** Time the harness took, in nanoseconds. */
+    uint64_t            ns;
+} unit_t;
+
+/*
+ * The harness.
+ */
+int LLVMFuzzerInitialize(int *argc, char ***argv);
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/**
+ * \var seeds
+ *
+ * The inputs given.
+ */
+static unit_t *seeds;
+
+/**
+ * \var nseeds
+ *
+ * Number of inputs given.
+ */
+static int nseeds;
+
+/**
+ * \var slowest
+ *
+ * The slowest inputs, in no order.
+ */
+static unit_t slowest[MAX_KEPT];
+
+/**
+ * \var nslowest
+ *
+ * Number of slowest inputs.
+ */
+static int nslowest;
+
+/**
+ * \var nkept
+ *
+ * Number of slowest inputs to keep.
+ */
+static int nkept = 8;
+
+/**
+ * \var rng
+ *
+ * State of the random number generator.
+ */
+static uint64_t rng;
+
+/**
+ * \var interesting
+ *
+ * Characters the parser treats specially.
+ */
+static const char interesting[] = " .,\n\r\b\177\0$-{}9a";
+
+
+/**
+ * \brief Returns a random number, with xorshift64.
+ *
+ * \param   limit   The number is less than limit, which must be positive.
+ *
+ * \return  The number.
+ */
+static int random_below(int limit)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (int)(rng % (uint64_t)limit);
+}
+
+
+/**
+ * \brief Reads the monotonic clock.
+ *
+ * \return  The time, in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+
+/**
+ * \brief Runs the harness on an input.
+ *
+ * \param   data    The input.
+ * \param   size    Size of the input.
+ *
+ * \return  The time taken, in nanoseconds.
+ */
+static uint64_t run(const unsigned char *data, int size)
+{
+    uint64_t start = now_ns();
+
+    LLVMFuzzerTestOneInput(data, (size_t)size);
+    return now_ns() - start;
+}
+
+
+/**
+ * \brief Keeps an input if it is one of the slowest.
+ *
+ * \param   data    The input.
+ * \param   size    Size of the input.
+ * \param   ns      Time the harness took on it.
+ */
+static void keep(const unsigned char *data, int size, uint64_t ns)
+{
+    int fastest = 0;
+    int idx;
+
+    if (nslowest < nkept)
+    {
+        fastest = nslowest++;
+    }
+    else
+    {
+        for (idx=1; idx < nslowest; idx++)
+        {
+            if (slowest[idx].ns < slowest[fastest].ns)
+                fastest = idx;
+        }
+        if (ns <= slowest[fastest].ns)
+            return;
+    }
+
+    free(slowest[fastest].data);
+    slowest[fastest].data = (unsigned char *)malloc(size ? size : 1);
+    if (slowest[fastest].data == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(slowest[fastest].data, data, size);
+    slowest[fastest].size = size;
+    slowest[fastest].ns   = ns;
+}
+
+
+/**
+ * \brief Adds a file to the inputs given.
+ *
+ * \param   path    The file.
+ */
+static void add_seed(const char *path)
+{
+    unsigned char data[MAX_UNIT];
+    unit_t *grown;
+    FILE *file;
+    int size;
+
+    if ((file = fopen(path, "rb")) == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    size = (int)fread(data, 1, MAX_UNIT, file);
+    fclose(file);
+
+    grown = (unit_t *)realloc(seeds, (nseeds + 1) * sizeof(unit_t));
+    if (grown == NULL || (grown[nseeds].data =
+                (unsigned char *)malloc(size ? size : 1)) == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    seeds = grown;
+    memcpy(seeds[nseeds].data, data, size);
+    seeds[nseeds].size = size;
+    seeds[nseeds].ns   = 0;
+    nseeds++;
+}
+
+
+/**
+ * \brief Adds a file, or the files of a directory, to the inputs given.
+ *
+ * \param   path    The file or directory.
+ */
+static void add_seeds(const char *path)
+{
+    char name[1024];
+    struct dirent *entry;
+    struct stat st;
+    DIR *dir;
+
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        add_seed(path);
+        return;
+    }
+
+    if ((dir = opendir(path)) == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+        if (entry->d_name[0] != '.' && stat(name, &st) == 0 &&
+                S_ISREG(st.st_mode))
+            add_seed(name);
+    }
+    closedir(dir);
+}
+
+
+/**
+ * \brief Mutates an input, as a seed or slow input changed at random.
+ *
+ * \param   data    Where to make the input, of #MAX_UNIT bytes.
+ *
+ * \return  Size of the input.
+ */
+static int mutate(unsigned char *data)
+{
+    const unit_t *base = NULL;
+    const unit_t *other;
+    int size = 0;
+    int count;
+    int pos;
+    int len;
+
+    if (nslowest && (nseeds == 0 || random_below(2)))
+        base = &slowest[random_below(nslowest)];
+    else if (nseeds)
+        base = &seeds[random_below(nseeds)];
+    if (base)
+    {
+        memcpy(data, base->data, base->size);
+        size = base->size;
+    }
+
+    for (count=random_below(4) + 1; count; count--)
+    {
+        pos = random_below(size + 1);
+        len = random_below(size - pos + 1);
+
+        switch (random_below(6))
+        {
+        case 0:     /* Flip a bit. */
+            if (size)
+                data[random_below(size)] ^= 1 << random_below(8);
+            break;
+
+        case 1:     /* Overwrite with an interesting character. */
+            if (size)
+                data[random_below(size)] =
+                    interesting[random_below(sizeof(interesting) - 1)];
+            break;
+
+        case 2:     /* Insert an interesting character. */
+            if (size < MAX_UNIT)
+            {
+                memmove(&data[pos + 1], &data[pos], size - pos);
+                data[pos] = interesting[random_below(sizeof(interesting) - 1)];
+                size++;
+            }
+            break;
+
+        case 3:     /* Delete a range. */
+            memmove(&data[pos], &data[pos + len], size - pos - len);
+            size -= len;
+            break;
+
+        case 4:     /* Repeat a range, e.g. a line or a token. */
+            if (len > MAX_UNIT - size)
+                len = MAX_UNIT - size;
+            memmove(&data[pos + len], &data[pos], size - pos);
+            size += len;
+            break;
+
+        default:    /* Insert part of a seed. */
+            if (nseeds == 0)
+                break;
+            other = &seeds[random_below(nseeds)];
+            len = random_below(other->size + 1);
+            if (len > MAX_UNIT - size)
+                len = MAX_UNIT - size;
+            memmove(&data[pos + len], &data[pos], size - pos);
+            memcpy(&data[pos],
+                    &other->data[random_below(other->size - len + 1)], len);
+            size += len;
+            break;
+        }
+    }
+    return size;
+}
+
+
+/**
+ * \brief Orders inputs slowest first, for qsort().
+ *
+ * \param   a       An input.
+ * \param   b       An input.
+ *
+ * \return  <0, 0 or >0 as a is slower than, as slow as or faster than b.
+ */
+static int compare_ns(const void *a, const void *b)
+{
+    uint64_t ns_a = ((const unit_t *)a)->ns;
+    uint64_t ns_b = ((const unit_t *)b)->ns;
+
+    return (ns_a < ns_b) - (ns_a > ns_b);
+}
+
+
+/**
+ * \brief Times the slowest inputs again, then reports them and writes them
+ * to a directory.
+ *
+ * \param   out_dir The directory, or NULL.
+ */
+static void report(const char *out_dir)
+{
+    char name[1024];
+    unit_t *unit;
+    uint64_t ns;
+    FILE *file;
+    int repeat;
+    int idx;
+
+    for (idx=0; idx < nslowest; idx++)
+    {
+        unit = &slowest[idx];
+        for (repeat=0; repeat < FUZZ_REPEAT; repeat++)
+        {
+            ns = run(unit->data, unit->size);
+            if (repeat == 0 || ns < unit->ns)
+                unit->ns = ns;
+        }
+    }
+    qsort(slowest, nslowest, sizeof(unit_t), compare_ns);
+
+    if (out_dir)
+        mkdir(out_dir, 0755);
+    printf("%-4s  %10s  %6s  %s\n", "RANK", "US", "BYTES", "INPUT");
+    for (idx=0; idx < nslowest; idx++)
+    {
+        unit = &slowest[idx];
+        name[0] = '\0';
+        if (out_dir)
+        {
+            snprintf(name, sizeof(name), "%s/slow-%02d", out_dir, idx + 1);
+            if ((file = fopen(name, "wb")) == NULL)
+            {
+                perror(name);
+                exit(1);
+            }
+            fwrite(unit->data, 1, unit->size, file);
+            fclose(file);
+        }
+        printf("%-4d  %10.1f  %6d  %s\n", idx + 1, unit->ns / 1000.0,
+                unit->size, name);
+    }
+}
+
+
+/**
+ * Main function
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Command line arguments.
+ *
+ * \return 0, or 1 for a bad option.
+ */
+int main(int argc, char *argv[])
+{
+    unsigned char data[MAX_UNIT];
+    const char *out_dir = NULL;
+    long runs = 100000;
+    long count;
+    int size;
+    int opt;
+    int idx;
+
+    rng = (uint64_t)time(NULL);
+    while ((opt = getopt(argc, argv, "k:n:o:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k': nkept   = atoi(optarg); break;
+        case 'n': runs    = atol(optarg); break;
+        case 'o': out_dir = optarg; break;
+        case 's': rng     = strtoull(optarg, NULL, 0); break;
+        default:
+            printf("Usage: %s [-n runs] [-k kept] [-s seed] [-o dir] "
+                    "[input...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nkept < 1 || nkept > MAX_KEPT)
+        nkept = MAX_KEPT;
+    if (rng == 0)
+        rng = 1;
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for (idx=optind; idx < argc; idx++)
+    {
+        add_seeds(argv[idx]);
+    }
+    for (idx=0; idx < nseeds; idx++)
+    {
+        keep(seeds[idx].data, seeds[idx].size,
+                run(seeds[idx].data, seeds[idx].size));
+    }
+
+    for (count=0; count < runs; count++)
+    {
+        size = mutate(data);
+        keep(data, size, run(data, size));
+    }
+
+    report(out_dir);
+    return 0;
+}
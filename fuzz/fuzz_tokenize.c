@@ -0,0 +1,124 @@
+/**
+ * \file
+ *
+ * \brief Fuzz harness of the tokenizer.
+ *
+ * The input is executed as the arguments of a command taking up to MAX_ARGC
+ * of them, and the arguments it is called with checked against the tokens
+ * of the input. A line with more than MAX_ARGC arguments must be refused,
+ * not run with some of them.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#include "scp_internal.h"
+
+/**
+ * \var called
+ *
+ * Set when the command is called.
+ */
+static int called;
+
+/**
+ * \var called_argc
+ *
+ * Number of arguments the command was called with.
+ */
+static int called_argc;
+
+/**
+ * \var called_argv
+ *
+ * Arguments the command was called with.
+ */
+static char *called_argv[MAX_ARGC];
+
+
+/**
+ * \brief Command recording its arguments.
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  argc
+ */
+static int tokens_cmd_func(int argc, char *argv[])
+{
+    called      = 1;
+    called_argc = argc;
+    memcpy(called_argv, argv, argc * sizeof(char *));
+    return argc;
+}
+
+
+/*
+ * Initialises the parser, with the command.
+ */
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    scp_init(1);
+    scp_add_command(
+            "t",
+            "",
+            "Tokens <P1> [... <Pn>]",
+            0,
+            MAX_ARGC,
+            tokens_cmd_func
+            );
+    scp_set_output_mode(SCP_MODE_JSON);
+    return 0;
+}
+
+
+/*
+ * Executes an input as the arguments of the command.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char line[MAX_INPUT_BUFFER];
+    int starts[MAX_INPUT_BUFFER];
+    int lengths[MAX_INPUT_BUFFER];
+    int ntokens = 0;
+    int pos = 0;
+    int idx;
+
+    if (size > sizeof(line) - 3)
+        size = sizeof(line) - 3;
+    memcpy(line, "t ", 2);
+    memcpy(&line[2], data, size);
+    line[size + 2] = '\0';
+
+    /* The tokens, found before the line is tokenized in place. */
+    for (;;)
+    {
+        pos += (int)strspn(&line[pos], TOKEN_DELIMITERS);
+        if (line[pos] == '\0')
+            break;
+        starts[ntokens]  = pos;
+        lengths[ntokens] = (int)strcspn(&line[pos], TOKEN_DELIMITERS);
+        pos += lengths[ntokens++];
+    }
+
+    called = 0;
+    scp_memory_io(NULL, 0);
+    scp_parse_line(scp_get_context(), line);
+
+    /* The first token is the command. */
+    if (ntokens - 1 > MAX_ARGC)
+    {
+        assert(!called);
+        return 0;
+    }
+    assert(called);
+    assert(called_argc == ntokens - 1);
+    for (idx=0; idx < called_argc; idx++)
+    {
+        assert(called_argv[idx] == &line[starts[idx + 1]]);
+        assert(strlen(called_argv[idx]) == (size_t)lengths[idx + 1]);
+    }
+    return 0;
+}
@@ -5,7 +5,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef __linux__
+    #include <unistd.h>
+#endif
 #include "simple_command_parser.h"
+#include "scp_gpio.h"
+#include "scp_plugin.h"
+#include "scp_journal.h"
+#include "scp_metrics.h"
+#include "scp_batch.h"
+#include "scp_rt.h"
 
 /**
  * \brief Addition Function
@@ -57,16 +67,236 @@ static int sub_cmd_func(int argc, char *argv[])
     return result;
 }
 
+/**
+ * \brief Sequence Function
+ *
+ * Outputs the integers from the first argument up to the second argument,
+ * counting by the optional third argument.
+ *
+ * \param   out     Output for the values.
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  The number of values output.
+ */
+static int seq_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    int value = atoi(argv[0]);
+    int last = atoi(argv[1]);
+    int step = argc > 2 ? atoi(argv[2]) : 1;
+    int count = 0;
+
+    if (step <= 0)
+        return 0;
+
+    for (; value <= last; value += step, count++)
+    {
+        scp_out_int(out, value);
+    }
+    return count;
+}
+
+#ifdef SCP_HAVE_COMMAND_SECTION
+/**
+ * \brief Multiply Function
+ *
+ * Treats all arguments as integers. Multiplies all arguments together.
+ * Registered by SCP_COMMAND(), without a call in main().
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Char* array of argument strings.
+ *
+ * \return  The product of the arguments.
+ */
+SCP_COMMAND(mul, "m", "Multiply <P1> by <P2> [..<P5>]", 2, 5)
+{
+    int idx;
+    int result = 1;
+
+    for (idx=0; idx < argc; idx++)
+    {
+        result *= atoi(argv[idx]);
+    }
+    return result;
+}
+#endif
+
+#ifdef __linux__
+/**
+ * \brief Reads a script.
+ *
+ * \param   path    The file.
+ *
+ * \return  The script, to be freed, or NULL if it cannot be read.
+ */
+static char *read_script(const char *path)
+{
+    char *script = NULL;
+    char *grown;
+    size_t len = 0;
+    size_t got;
+    FILE *file;
+
+    if ((file = fopen(path, "r")) == NULL)
+        return NULL;
+
+    do
+    {
+        if ((grown = (char *)realloc(script, len + 4097)) == NULL)
+        {
+            free(script);
+            fclose(file);
+            return NULL;
+        }
+        script = grown;
+        got = fread(&script[len], 1, 4096, file);
+        len += got;
+    } while (got == 4096);
+
+    script[len] = '\0';
+    fclose(file);
+    return script;
+}
+
+
+/**
+ * \brief Runs scripts in parallel, see scp_batch.h, and writes their outputs
+ * in order.
+ *
+ * Each script runs against a board of its own, with a simulated chip as the
+ * one attached for the parse loop.
+ *
+ * \param   paths       The files of the scripts.
+ * \param   nscripts    Number of scripts.
+ * \param   nthreads    Number of threads, or 0 for one per processor.
+ *
+ * \return  0, or 1 if a script cannot be read or run.
+ */
+static int run_batch(char *paths[], int nscripts, int nthreads)
+{
+    scp_job_t *jobs = (scp_job_t *)calloc(nscripts ? nscripts : 1,
+            sizeof(scp_job_t));
+    scp_gpio_chip_t **chips = (scp_gpio_chip_t **)calloc(
+            nscripts ? nscripts : 1, sizeof(scp_gpio_chip_t *));
+    uint64_t start = scp_rt_now_ns();
+    int status = 0;
+    int lines = 0;
+    int idx;
+
+    if (jobs == NULL || chips == NULL)
+    {
+        free(jobs);
+        free(chips);
+        return 1;
+    }
+
+    for (idx=0; idx < nscripts && status == 0; idx++)
+    {
+        jobs[idx].script = read_script(paths[idx]);
+        if (jobs[idx].script == NULL)
+        {
+            printf("Cannot read %s\n", paths[idx]);
+            status = 1;
+        }
+        else if ((jobs[idx].target = scp_gpio_board_new()) == NULL)
+        {
+            status = 1;
+        }
+        else
+        {
+            chips[idx] = scp_gpio_sim_new("sim0", SCP_GPIO_MAX_LINES);
+            scp_gpio_board_attach(jobs[idx].target, chips[idx]);
+        }
+    }
+
+    if (status == 0)
+    {
+        if (!scp_batch_run(jobs, nscripts, nthreads))
+            status = 1;
+        scp_batch_merge(stdout, jobs, nscripts);
+        fflush(stdout);
+
+        for (idx=0; idx < nscripts; idx++)
+        {
+            lines += jobs[idx].lines;
+        }
+        fprintf(stderr, "%d scripts, %d lines in %.3f s\n", nscripts, lines,
+                (scp_rt_now_ns() - start) / 1e9);
+    }
+
+    scp_batch_free(jobs, nscripts);
+    for (idx=0; idx < nscripts; idx++)
+    {
+        free((char *)jobs[idx].script);
+        if (jobs[idx].target)
+            scp_gpio_board_free(jobs[idx].target);
+        if (chips[idx])
+            scp_gpio_sim_free(chips[idx]);
+    }
+    free(chips);
+    free(jobs);
+    return status;
+}
+#endif
+
+
 /**
  * Main function
  *
- * Add two commands to the simple command parser (SCP). Then run the parse
+ * Add two commands to the simple command parser (SCP), the macro commands,
+ * the GPIO commands and, on Linux, the plugin commands. Then run the parse
  * loop.
  *
- * \return 0
+ * A simulated GPIO chip is always attached. On Linux, a GPIO character device
+ * given on the command line, e.g. /dev/gpiochip0, is also attached, and
+ * the options are
+ *
+ * -# -j \<journal\> - record the session to a journal, see scp_journal.h.
+ * -# -r \<journal\> - replay a journal instead of reading the input.
+ * -# -s \<session\> - replay only the session with this ID.
+ * -# -x \<speed\> - replay at this multiple of the original speed, or 0,
+ *    the default, for as fast as possible.
+ * -# -m \<port\> - serve the metrics on this loopback port, see
+ *    scp_metrics.h.
+ * -# -b \<threads\> - run the files given on the command line as scripts,
+ *    in parallel on this many threads, or 0 for one per processor, instead
+ *    of reading the input. See scp_batch.h.
+ *
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Command line arguments.
+ *
+ * \return 0, or 1 if a device, journal, port or script cannot be opened.
  */
-int main(void)
+int main(int argc, char *argv[])
 {
+#ifdef __linux__
+    const char *record = NULL;
+    const char *replay = NULL;
+    uint32_t session = 0;
+    double speed = 0;
+    int metrics = -1;
+    int batch = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:j:m:r:s:x:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b': batch   = atoi(optarg); break;
+        case 'j': record  = optarg; break;
+        case 'm': metrics = atoi(optarg); break;
+        case 'r': replay  = optarg; break;
+        case 's': session = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'x': speed   = atof(optarg); break;
+        default:
+            printf("Usage: %s [-j journal] [-m port] [-r journal "
+                    "[-s session] [-x speed]] [gpiochip]\n"
+                    "       %s -b threads script...\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+#endif
+
     scp_init(0);
 
     scp_add_command(
@@ -87,8 +317,75 @@ int main(void)
             sub_cmd_func
             );
 
-    printf ("Simple Command Parser\n");
+    scp_add_command_ex(
+            "seq",
+            "",
+            "Output <P1> to <P2> [step <P3>]",
+            2,
+            3,
+            seq_cmd_func
+            );
+
+    scp_add_macro_commands();
+
+    scp_gpio_attach(scp_gpio_sim_new("sim0", SCP_GPIO_MAX_LINES));
+#ifdef __linux__
+    if (optind < argc && batch < 0)
+    {
+        scp_gpio_chip_t *chip = scp_gpio_linux_open(argv[optind], 0);
+
+        if (chip == NULL)
+        {
+            printf("Cannot open %s\n", argv[optind]);
+            return 1;
+        }
+        scp_gpio_attach(chip);
+    }
+#endif
+    scp_add_gpio_commands();
+    scp_add_gpio_sim_commands();
+#ifdef __linux__
+    scp_add_gpio_capture_commands();
+    scp_add_gpio_play_commands();
+    scp_add_gpio_watch_commands();
+    scp_add_plugin_commands();
+#endif
+
+#ifdef __linux__
+    if (batch >= 0)
+        return run_batch(&argv[optind], argc - optind, batch);
+
+    if (replay)
+    {
+        if (scp_journal_replay(replay, session, speed) < 0)
+        {
+            printf("Cannot replay %s\n", replay);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (record && !scp_journal_open(record, (uint32_t)getpid()))
+    {
+        printf("Cannot record %s\n", record);
+        return 1;
+    }
+
+    if (metrics >= 0 && scp_metrics_start(metrics) == 0)
+    {
+        printf("Cannot serve metrics on port %d\n", metrics);
+        return 1;
+    }
+#endif
+
+    /* There is no banner for input that is not typed. */
+    if (!scp_get_pipe_mode())
+        printf ("Simple Command Parser\n");
     scp_parse();
+#ifdef __linux__
+    scp_journal_close();
+    scp_metrics_stop();
+#endif
 
     return 0;
 }
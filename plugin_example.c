@@ -0,0 +1,79 @@
+/**
+ * \file
+ *
+ * \brief Example plugin for the Simple Command Parser.
+ *
+ * Build with 'make plugin_example.so', then in parser_example:
+ *
+ *      load plugin_example
+ *      sq 7
+ *      unload plugin_example
+ */
+
+#include <stdlib.h>
+#include "scp_plugin.h"
+
+/**
+ * \brief Square Function
+ *
+ * \param   argc    1
+ * \param   argv    The integer to square.
+ *
+ * \return  The square of the argument.
+ */
+static int square_cmd_func(int argc, char *argv[])
+{
+    int value = atoi(argv[0]);
+
+    return value * value;
+}
+
+/**
+ * \brief Powers Function
+ *
+ * Outputs the powers of the first argument up to the second argument.
+ *
+ * \param   out     Output for the values.
+ * \param   argc    2
+ * \param   argv    The base and the highest power.
+ *
+ * \return  The number of values output.
+ */
+static int powers_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    int base = atoi(argv[0]);
+    int last = atoi(argv[1]);
+    int value = 1;
+    int power;
+
+    for (power=0; power <= last; power++)
+    {
+        scp_out_int(out, value);
+        value *= base;
+    }
+    return power;
+}
+
+/**
+ * The commands of the plugin.
+ */
+static const scp_command_t commands[] = {
+    SCP_COMMAND_DEF(
+            "square",
+            "sq",
+            "Square <P1>",
+            1,
+            1,
+            square_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "powers",
+            "",
+            "Output powers of <P1> up to <P2>",
+            2,
+            2,
+            powers_cmd_func
+            )
+};
+
+SCP_PLUGIN(commands);
@@ -0,0 +1,341 @@
+/**
+ * \file
+ *
+ * \brief Batch runner, executing scripts on a work stealing pool of threads.
+ *
+ * Linux only. The jobs are whole scripts, so each queue is a range of jobs
+ * under a lock of its own: it is taken once per job, which costs nothing next
+ * to running one.
+ */
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "scp_internal.h"
+#include "scp_batch.h"
+
+/**
+ * Alignment of the queues, so each thread locks its own cache line.
+ */
+#define QUEUE_ALIGN         64
+
+/**
+ * \typedef queue_t
+ *
+ * \brief The jobs left to a thread, a range of the jobs of the batch.
+ */
+typedef struct {
+    /** Lock of the range, taken by the owner and the threads stealing. */
+    _Alignas(QUEUE_ALIGN) pthread_mutex_t lock;
+    /** Next job to run. */
+    int                 head;
+    /** One past the last job. */
+    int                 tail;
+} queue_t;
+
+/**
+ * \typedef batch_t
+ *
+ * \brief A batch being run.
+ */
+typedef struct {
+    /** The jobs. */
+    scp_job_t           *jobs;
+    /** One queue per thread. */
+    queue_t             *queues;
+    /** Number of threads. */
+    int                 nthreads;
+    /** Set if the output of a job cannot be created. */
+    atomic_int          failed;
+} batch_t;
+
+/**
+ * \typedef worker_t
+ *
+ * \brief A thread of the pool.
+ */
+typedef struct {
+    /** The batch. */
+    batch_t             *batch;
+    /** Index of the thread, and of its queue. */
+    int                 index;
+    /** The thread. */
+    pthread_t           thread;
+} worker_t;
+
+/**
+ * \var current_job
+ *
+ * The job being run by this thread, or NULL.
+ */
+static _Thread_local scp_job_t *current_job;
+
+
+/**
+ * \brief Takes the next job of a thread, from its queue or else by stealing
+ * half the jobs left in the queue of another.
+ *
+ * Jobs do not add jobs, so once every queue is empty the thread is done.
+ *
+ * \param   batch   The batch.
+ * \param   self    Index of the thread.
+ *
+ * \return  Index of the job, or -1 if there are none left.
+ */
+static int take_job(batch_t *batch, int self)
+{
+    queue_t *own = &batch->queues[self];
+    queue_t *victim;
+    int job = -1;
+    int count;
+    int idx;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail)
+        job = own->head++;
+    pthread_mutex_unlock(&own->lock);
+    if (job >= 0)
+        return job;
+
+    for (idx=1; idx < batch->nthreads; idx++)
+    {
+        victim = &batch->queues[(self + idx) % batch->nthreads];
+
+        /* Steal from the end, away from the jobs the owner runs next. */
+        pthread_mutex_lock(&victim->lock);
+        count = (victim->tail - victim->head + 1) / 2;
+        victim->tail -= count;
+        pthread_mutex_unlock(&victim->lock);
+        if (count == 0)
+            continue;
+
+        job = victim->tail;
+        pthread_mutex_lock(&own->lock);
+        own->head = job + 1;
+        own->tail = job + count;
+        pthread_mutex_unlock(&own->lock);
+        return job;
+    }
+    return -1;
+}
+
+
+/**
+ * \brief Runs a job in a context of its own.
+ *
+ * \param   job     The job.
+ *
+ * \return  1, or 0 if its output cannot be created.
+ */
+static int run_job(scp_job_t *job)
+{
+    unsigned long start;
+    scp_ctx_t ctx;
+    scp_out_t *out;
+
+    out = (scp_out_t *)calloc(1, sizeof(scp_out_t));
+    if (out == NULL)
+        return 0;
+    out->mode = job->mode;
+    out->file = open_memstream(&job->output, &job->output_len);
+    if (out->file == NULL)
+    {
+        free(out);
+        return 0;
+    }
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.out   = out;
+    ctx.batch = 1;
+
+#if SCP_METRICS
+    atomic_fetch_add(&scp_counters.sessions, 1);
+#endif
+    current_job = job;
+    start       = scp_time_us();
+
+    job->lines = scp_parse_script(&ctx, job->script);
+
+    job->us     = scp_time_us() - start;
+    current_job = NULL;
+    scp_release_context(&ctx);
+#if SCP_METRICS
+    atomic_fetch_sub(&scp_counters.sessions, 1);
+#endif
+
+    fclose(out->file);
+    free(out);
+    return 1;
+}
+
+
+/**
+ * \brief A thread of the pool, running jobs until there are none left.
+ *
+ * \param   arg     The worker_t of the thread.
+ *
+ * \return  NULL
+ */
+static void *worker_thread(void *arg)
+{
+    worker_t *worker = (worker_t *)arg;
+    batch_t *batch = worker->batch;
+    int job;
+
+    while ((job = take_job(batch, worker->index)) >= 0)
+    {
+        if (!run_job(&batch->jobs[job]))
+            atomic_store(&batch->failed, 1);
+    }
+    return NULL;
+}
+
+
+/*
+ * Runs jobs on a pool of threads.
+ */
+int scp_batch_run(scp_job_t *jobs, int njobs, int nthreads)
+{
+    batch_t batch;
+    worker_t *workers;
+    int started;
+    int idx;
+
+    assert(jobs || njobs == 0);
+
+    for (idx=0; idx < njobs; idx++)
+    {
+        assert(jobs[idx].script);
+        jobs[idx].output     = NULL;
+        jobs[idx].output_len = 0;
+        jobs[idx].lines      = 0;
+        jobs[idx].us         = 0;
+    }
+
+    if (nthreads <= 0)
+        nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > SCP_BATCH_MAX_THREADS)
+        nthreads = SCP_BATCH_MAX_THREADS;
+    if (nthreads > njobs)
+        nthreads = njobs;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    workers = (worker_t *)malloc(nthreads * sizeof(worker_t));
+    batch.queues = (queue_t *)aligned_alloc(QUEUE_ALIGN,
+            nthreads * sizeof(queue_t));
+    if (workers == NULL || batch.queues == NULL)
+    {
+        free(workers);
+        free(batch.queues);
+        return 0;
+    }
+    batch.jobs     = jobs;
+    batch.nthreads = nthreads;
+    atomic_init(&batch.failed, 0);
+
+    /* Each thread starts with an equal share of the jobs, in order. */
+    for (idx=0; idx < nthreads; idx++)
+    {
+        pthread_mutex_init(&batch.queues[idx].lock, NULL);
+        batch.queues[idx].head = (int)((long)njobs * idx / nthreads);
+        batch.queues[idx].tail = (int)((long)njobs * (idx + 1) / nthreads);
+        workers[idx].batch = &batch;
+        workers[idx].index = idx;
+    }
+
+    /* The last share is run by this thread, which also steals the shares of
+     * any thread that cannot be started.
+     */
+    for (started=0; started < nthreads - 1; started++)
+    {
+        if (pthread_create(&workers[started].thread, NULL, worker_thread,
+                    &workers[started]) != 0)
+            break;
+    }
+    worker_thread(&workers[nthreads - 1]);
+    for (idx=0; idx < started; idx++)
+    {
+        pthread_join(workers[idx].thread, NULL);
+    }
+
+    for (idx=0; idx < nthreads; idx++)
+    {
+        pthread_mutex_destroy(&batch.queues[idx].lock);
+    }
+    free(batch.queues);
+    free(workers);
+    return !atomic_load(&batch.failed);
+}
+
+
+/*
+ * Whether this thread is running a job.
+ */
+int scp_batch_running(void)
+{
+    return current_job != NULL;
+}
+
+
+/*
+ * Returns the target of the job being run.
+ */
+void *scp_batch_target(void)
+{
+    return current_job ? current_job->target : NULL;
+}
+
+
+/*
+ * Refuses a command that is not safe in a job.
+ */
+int scp_batch_refuse(scp_out_t *out)
+{
+    if (current_job == NULL)
+        return 0;
+
+    scp_out_str(out, "ERROR: not allowed in a batch job!");
+    return 1;
+}
+
+
+/*
+ * Writes the outputs of jobs in order.
+ */
+void scp_batch_merge(FILE *file, const scp_job_t *jobs, int njobs)
+{
+    int idx;
+
+    assert(file);
+
+    for (idx=0; idx < njobs; idx++)
+    {
+        if (jobs[idx].output)
+            fwrite(jobs[idx].output, 1, jobs[idx].output_len, file);
+    }
+}
+
+
+/*
+ * Frees the outputs of jobs.
+ */
+void scp_batch_free(scp_job_t *jobs, int njobs)
+{
+    int idx;
+
+    for (idx=0; idx < njobs; idx++)
+    {
+        free(jobs[idx].output);
+        jobs[idx].output     = NULL;
+        jobs[idx].output_len = 0;
+    }
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,126 @@
+/**
+ * \file
+ *
+ * \brief Batch runner, executing scripts in parallel, each in a parser
+ * context of its own.
+ *
+ * Linux only. A job is a script and, optionally, a target for its commands,
+ * e.g. the same script run against each of several boards. The jobs are
+ * shared out between a pool of threads, each taking the jobs of its own
+ * queue in order and, once it is empty, stealing half of the jobs left in
+ * the queue of another thread. The output of each job is gathered in a
+ * buffer of its own, so scp_batch_merge() can write them out in the order of
+ * the jobs, whichever thread ran them.
+ *
+ * Commands must be safe to call from several threads. The GPIO commands act
+ * on the board that is the target of the job, see scp_gpio_board_new(), and
+ * the macro recorder and variables are kept per context. Commands that keep
+ * state for all the threads, i.e. capture, watch, the plugin commands and
+ * the macro definitions, refuse to run in a job, see scp_batch_refuse().
+ * The output of #cmd_func_t command functions that write to stdout
+ * themselves is not gathered.
+ */
+
+#ifndef SCP_BATCH_H_
+#define SCP_BATCH_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "simple_command_parser.h"
+#include "scp_epoch.h"
+
+/**
+ * Maximum number of threads running jobs, leaving a read slot for the
+ * thread of the parse loop, see #SCP_EPOCH_MAX_THREADS.
+ */
+#ifndef SCP_BATCH_MAX_THREADS
+    #define SCP_BATCH_MAX_THREADS   (SCP_EPOCH_MAX_THREADS - 1)
+#endif
+
+/**
+ * \typedef scp_job_t
+ *
+ * \brief A script to run, and its results once run.
+ */
+typedef struct {
+    /** The lines to execute, separated by newlines. */
+    const char          *script;
+    /** Output mode of the job, one of the SCP_MODE_ values. */
+    int                 mode;
+    /** Target of the commands of the job, see scp_batch_target(): for the
+     *  GPIO commands, a #scp_gpio_board_t of its own, or NULL for none. */
+    void                *target;
+    /** Output of the job, set by scp_batch_run(). */
+    char                *output;
+    /** Length of the output. */
+    size_t              output_len;
+    /** Number of lines executed. */
+    int                 lines;
+    /** Time the job took, in microseconds. */
+    unsigned long       us;
+} scp_job_t;
+
+/**
+ * \brief Runs jobs on a pool of threads.
+ *
+ * Each job is run in a new context, so its responses are numbered from 1,
+ * until the end of its script or the 'end' command, then the state the
+ * modules keep for the context is freed. The calling thread runs jobs too,
+ * and all of them if no thread can be started. The outputs of the jobs must
+ * be freed with scp_batch_free(), even if the run fails.
+ *
+ * \param   jobs        The jobs.
+ * \param   njobs       Number of jobs.
+ * \param   nthreads    Number of threads, or 0 for one per processor, up to
+ *                      #SCP_BATCH_MAX_THREADS.
+ *
+ * \return  1, or 0 if out of memory or the output of a job cannot be
+ *          created.
+ */
+int scp_batch_run(scp_job_t *jobs, int njobs, int nthreads);
+
+/**
+ * \brief Whether this thread is running a job.
+ *
+ * \return  1 in a job, otherwise 0.
+ */
+int scp_batch_running(void);
+
+/**
+ * \brief Returns the target of the job being run by this thread.
+ *
+ * \return  The target, or NULL outside a job.
+ */
+void *scp_batch_target(void);
+
+/**
+ * \brief Refuses a command that is not safe to run in a job.
+ *
+ * For command functions that keep state for all the threads, e.g. the one
+ * capture in progress. Outputs an error if this thread is running a job.
+ *
+ * \param   out     Output for the error.
+ *
+ * \return  1 if the command must be refused, otherwise 0.
+ */
+int scp_batch_refuse(scp_out_t *out);
+
+/**
+ * \brief Writes the outputs of jobs in order.
+ *
+ * \param   file    Where to write them.
+ * \param   jobs    The jobs.
+ * \param   njobs   Number of jobs.
+ */
+void scp_batch_merge(FILE *file, const scp_job_t *jobs, int njobs);
+
+/**
+ * \brief Frees the outputs of jobs.
+ *
+ * \param   jobs    The jobs.
+ * \param   njobs   Number of jobs.
+ */
+void scp_batch_free(scp_job_t *jobs, int njobs);
+
+#endif /* SCP_BATCH_H_ */
@@ -0,0 +1,313 @@
+/**
+ * \file
+ *
+ * \brief Epoch based reclamation for data shared with lock-free readers.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <stdatomic.h>
+#ifdef __linux__
+    #include <pthread.h>
+    #define THREAD_LOCAL    _Thread_local
+#else
+    /* Single threaded, the parse loop is the only reader. */
+    #define THREAD_LOCAL
+#endif
+
+#include "scp_epoch.h"
+
+/**
+ * Alignment of the slots, so each thread writes its own cache line.
+ */
+#define SLOT_ALIGN          64
+
+/**
+ * \typedef slot_t
+ *
+ * \brief The epoch announced by a reader thread.
+ */
+typedef struct {
+    /** Epoch the owner entered its read section in, 0 outside it. */
+    _Alignas(SLOT_ALIGN) atomic_uint epoch;
+    /** Non-zero while the slot belongs to a thread. */
+    atomic_int          owned;
+} slot_t;
+
+/**
+ * \typedef retired_t
+ *
+ * \brief Typedef of the _retired_t struct.
+ */
+typedef struct _retired_t retired_t;
+
+/**
+ * \struct _retired_t
+ *
+ * \brief Data waiting to be freed.
+ */
+struct _retired_t {
+    /** Function to free the data. */
+    scp_epoch_free_t    func;
+    /** The data. */
+    void                *ptr;
+    /** Epoch the data was retired in. */
+    unsigned int        epoch;
+    /** Next retired_t node, retired earlier. */
+    retired_t           *next;
+};
+
+/**
+ * \var slots
+ *
+ * The slots of the reader threads.
+ */
+static slot_t slots[SCP_EPOCH_MAX_THREADS];
+
+/**
+ * \var global_epoch
+ *
+ * The current epoch, advanced each time data is retired.
+ */
+static atomic_uint global_epoch = 1;
+
+/**
+ * \var npending
+ *
+ * Number of retired_t nodes in retired, read without the lock.
+ */
+static atomic_uint npending;
+
+/**
+ * \var noverflow
+ *
+ * Number of threads in a read section without a slot, as all the slots were
+ * taken. Nothing is freed while there are any, as their epochs are unknown.
+ */
+static atomic_uint noverflow;
+
+/**
+ * \var retired
+ *
+ * Data waiting to be freed, most recently retired first.
+ */
+static retired_t *retired;
+
+/**
+ * \var my_slot
+ *
+ * The slot of this thread, claimed on its first read section, or NULL while
+ * there is no free slot.
+ */
+static THREAD_LOCAL slot_t *my_slot;
+
+/**
+ * \var depth
+ *
+ * Depth of nested read sections of this thread.
+ */
+static THREAD_LOCAL int depth;
+
+#ifdef __linux__
+/**
+ * \var lock
+ *
+ * Protects retired.
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * \var slot_key
+ *
+ * Releases the slot of a thread when it exits.
+ */
+static pthread_key_t slot_key;
+
+/**
+ * \var slot_key_once
+ *
+ * Creates slot_key.
+ */
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Releases the slot of an exiting thread.
+ *
+ * \param   ptr     The slot.
+ */
+static void release_slot(void *ptr)
+{
+    atomic_store(&((slot_t *)ptr)->owned, 0);
+}
+
+/**
+ * \brief Creates slot_key.
+ */
+static void create_slot_key(void)
+{
+    pthread_key_create(&slot_key, release_slot);
+}
+
+    #define LOCK()      pthread_mutex_lock(&lock)
+    #define TRYLOCK()   (pthread_mutex_trylock(&lock) == 0)
+    #define UNLOCK()    pthread_mutex_unlock(&lock)
+#else
+    #define LOCK()
+    #define TRYLOCK()   1
+    #define UNLOCK()
+#endif
+
+
+/**
+ * \brief Claims a free slot for this thread.
+ *
+ * \return  The slot, or NULL if they are all taken.
+ */
+static slot_t *claim_slot(void)
+{
+    int expected;
+    int idx;
+
+    for (idx=0; idx < SCP_EPOCH_MAX_THREADS; idx++)
+    {
+        expected = 0;
+        if (atomic_compare_exchange_strong(&slots[idx].owned, &expected, 1))
+        {
+#ifdef __linux__
+            pthread_once(&slot_key_once, create_slot_key);
+            pthread_setspecific(slot_key, &slots[idx]);
+#endif
+            return &slots[idx];
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Enters a read section.
+ */
+void scp_epoch_enter(void)
+{
+    if (depth++ == 0)
+    {
+        /* A thread past SCP_EPOCH_MAX_THREADS tries again each time, in
+         * case a thread has exited since.
+         */
+        if (my_slot == NULL)
+            my_slot = claim_slot();
+
+        if (my_slot)
+            atomic_store(&my_slot->epoch, atomic_load(&global_epoch));
+        else
+            atomic_fetch_add(&noverflow, 1);
+
+        /* Announce the epoch before reading any shared data. */
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+
+/*
+ * Exits a read section.
+ */
+void scp_epoch_exit(void)
+{
+    assert(depth > 0);
+
+    if (--depth == 0)
+    {
+        if (my_slot)
+            atomic_store_explicit(&my_slot->epoch, 0, memory_order_release);
+        else
+            atomic_fetch_sub_explicit(&noverflow, 1, memory_order_release);
+    }
+}
+
+
+/*
+ * Queues data to be freed, then frees what it can.
+ */
+void scp_epoch_retire(scp_epoch_free_t func, void *ptr)
+{
+    retired_t *item;
+
+    assert(func);
+
+    item = (retired_t *)malloc(sizeof(retired_t));
+    assert(item);
+    item->func = func;
+    item->ptr  = ptr;
+
+    /* Readers entering from now on cannot see the data. */
+    LOCK();
+    item->epoch = atomic_fetch_add(&global_epoch, 1);
+    item->next  = retired;
+    retired     = item;
+    atomic_fetch_add(&npending, 1);
+    UNLOCK();
+
+    scp_epoch_reclaim();
+}
+
+
+/*
+ * Frees the retired data older than every active read section.
+ */
+void scp_epoch_reclaim(void)
+{
+    retired_t **link;
+    retired_t *item;
+    retired_t *done = NULL;
+    unsigned int oldest;
+    unsigned int epoch;
+    int idx;
+
+    if (atomic_load_explicit(&npending, memory_order_relaxed) == 0 ||
+            !TRYLOCK())
+        return;
+
+    oldest = atomic_load(&global_epoch);
+    for (idx=0; idx < SCP_EPOCH_MAX_THREADS; idx++)
+    {
+        epoch = atomic_load(&slots[idx].epoch);
+        if (epoch && epoch < oldest)
+            oldest = epoch;
+    }
+    if (atomic_load(&noverflow))
+        oldest = 0;
+
+    /* Move the free items to done, which ends up oldest first. */
+    for (link=&retired; (item = *link) != NULL; )
+    {
+        if (item->epoch < oldest)
+        {
+            *link      = item->next;
+            item->next = done;
+            done       = item;
+            atomic_fetch_sub(&npending, 1);
+        }
+        else
+        {
+            link = &item->next;
+        }
+    }
+    UNLOCK();
+
+    /* Free in the order retired, without the lock. */
+    while ((item = done) != NULL)
+    {
+        done = item->next;
+        (*item->func)(item->ptr);
+        free(item);
+    }
+}
+
+
+/*
+ * Number of retired data waiting.
+ */
+unsigned int scp_epoch_pending(void)
+{
+    return atomic_load_explicit(&npending, memory_order_relaxed);
+}
@@ -0,0 +1,84 @@
+/**
+ * \file
+ *
+ * \brief Epoch based reclamation for data shared with lock-free readers.
+ *
+ * Readers access shared data between scp_epoch_enter() and scp_epoch_exit()
+ * without taking any lock. A writer replaces the data by publishing a new
+ * copy through an atomic pointer, then passes the old copy to
+ * scp_epoch_retire(). It is freed once every reader that could still hold a
+ * pointer to it has left its read section.
+ *
+ * Each reader thread announces the global epoch it entered in, in a slot of
+ * its own. Retiring data advances the epoch, so the data can be freed once
+ * no active slot holds an epoch up to the one it was retired in.
+ */
+
+#ifndef SCP_EPOCH_H_
+#define SCP_EPOCH_H_
+
+/**
+ * The number of threads with a slot of their own, each a cache line.
+ * Without threads, only the parse loop reads.
+ *
+ * More threads can be in read sections at once, but those without a slot
+ * are only counted. Nothing is freed while any of them is in a read
+ * section, so retired data waits until they have all left.
+ */
+#ifndef SCP_EPOCH_MAX_THREADS
+    #if !defined(__linux__)
+        #define SCP_EPOCH_MAX_THREADS   1
+    #elif defined(SCP_TINY)
+        #define SCP_EPOCH_MAX_THREADS   4
+    #else
+        #define SCP_EPOCH_MAX_THREADS   16
+    #endif
+#endif
+
+/**
+ * \typedef (*scp_epoch_free_t)(void *ptr)
+ *
+ * \brief Frees retired data, see scp_epoch_retire().
+ */
+typedef void (*scp_epoch_free_t)(void *ptr);
+
+/**
+ * \brief Enters a read section.
+ *
+ * Sections nest, only the outermost enter and exit have any effect.
+ */
+void scp_epoch_enter(void);
+
+/**
+ * \brief Exits a read section.
+ */
+void scp_epoch_exit(void);
+
+/**
+ * \brief Frees data once no reader can hold a pointer to it.
+ *
+ * Call after the data has been unpublished. May be called in a read
+ * section, in which case the data outlives the section.
+ *
+ * \param   func    Function to free the data, called without any lock.
+ * \param   ptr     The data.
+ */
+void scp_epoch_retire(scp_epoch_free_t func, void *ptr);
+
+/**
+ * \brief Frees the retired data that is no longer in use.
+ *
+ * Called by scp_epoch_retire() and whenever a reader is between read
+ * sections. Cheap when nothing is waiting, and does not wait for another
+ * thread reclaiming at the same time.
+ */
+void scp_epoch_reclaim(void);
+
+/**
+ * \brief Returns the number of retired data waiting to be freed.
+ *
+ * \return  The number.
+ */
+unsigned int scp_epoch_pending(void);
+
+#endif /* SCP_EPOCH_H_ */
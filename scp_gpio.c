@@ -0,0 +1,810 @@
+/**
+ * \file
+ *
+ * \brief GPIO commands for the Simple Command Parser.
+ *
+ * Pins are resolved to a chip and line mask, then accessed through the
+ * chip backend. The port commands pass the whole mask to the backend so the
+ * lines are accessed together rather than one at a time.
+ *
+ * Within a transaction, changes are staged in a copy of each chip's output
+ * state and applied with as few backend accesses as possible on commit.
+ *
+ * The chips and the transaction belong to a board: the board of the parse
+ * loop, or in a batch job the board that is the target of the job, so jobs
+ * running at once each act on chips of their own.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "simple_command_parser.h"
+#include "scp_gpio.h"
+#ifdef __linux__
+    #include "scp_batch.h"
+#endif
+
+/**
+ * \typedef staged_chip_t
+ *
+ * \brief Changes to a chip staged by a transaction.
+ */
+typedef struct {
+    /** Lines whose mode was set. */
+    uint32_t            mode_mask;
+    /** Lines written. */
+    uint32_t            write_mask;
+    /** Lines that will be outputs after the commit. */
+    uint32_t            output_mask;
+    /** Output values after the commit. */
+    uint32_t            output_values;
+} staged_chip_t;
+
+/**
+ * \typedef transaction_t
+ *
+ * \brief The transaction of a board.
+ */
+typedef struct {
+    /** Set between begin and commit or abort. */
+    int                 active;
+    /** Number of commands staged. */
+    int                 nstaged;
+    /** Changes staged for each chip. */
+    staged_chip_t       chips[SCP_GPIO_MAX_CHIPS];
+} transaction_t;
+
+/**
+ * \struct _scp_gpio_board_t
+ *
+ * \brief A set of chips, and the transaction in progress on them.
+ */
+struct _scp_gpio_board_t {
+    /** The attached chips. */
+    scp_gpio_chip_t     *chips[SCP_GPIO_MAX_CHIPS];
+    /** Number of attached chips. */
+    int                 nchips;
+    /** The transaction, if active. */
+    transaction_t       transaction;
+};
+
+/**
+ * \var parse_board
+ *
+ * The board of the parse loop.
+ */
+static scp_gpio_board_t parse_board;
+
+
+/**
+ * \brief Returns the board the commands of this thread act on.
+ *
+ * \return  The board, or NULL in a batch job without one.
+ */
+static scp_gpio_board_t *current_board(void)
+{
+#ifdef __linux__
+    if (scp_batch_running())
+        return (scp_gpio_board_t *)scp_batch_target();
+#endif
+    return &parse_board;
+}
+
+
+/**
+ * \brief Returns the board of a command.
+ *
+ * Outputs an error value if there is none.
+ *
+ * \param   out     Output for errors.
+ *
+ * \return  The board, or NULL in a batch job without one.
+ */
+static scp_gpio_board_t *find_board(scp_out_t *out)
+{
+    scp_gpio_board_t *board = current_board();
+
+    if (board == NULL)
+        scp_out_str(out, "ERROR: no GPIO board!");
+    return board;
+}
+
+
+/*
+ * Creates a board.
+ */
+scp_gpio_board_t *scp_gpio_board_new(void)
+{
+    return (scp_gpio_board_t *)calloc(1, sizeof(scp_gpio_board_t));
+}
+
+
+/*
+ * Frees a board.
+ */
+void scp_gpio_board_free(scp_gpio_board_t *board)
+{
+    assert(board != &parse_board);
+
+    free(board);
+}
+
+
+/*
+ * Attach a GPIO chip to a board.
+ */
+int scp_gpio_board_attach(scp_gpio_board_t *board, scp_gpio_chip_t *chip)
+{
+    assert(board);
+    assert(chip);
+    assert(chip->nlines > 0 && chip->nlines <= SCP_GPIO_MAX_LINES);
+    assert(board->nchips < SCP_GPIO_MAX_CHIPS);
+
+    board->chips[board->nchips] = chip;
+    return board->nchips++;
+}
+
+
+/*
+ * Attach a GPIO chip to the board of the parse loop.
+ */
+int scp_gpio_attach(scp_gpio_chip_t *chip)
+{
+    return scp_gpio_board_attach(&parse_board, chip);
+}
+
+
+/*
+ * Get a chip of the current board.
+ */
+scp_gpio_chip_t *scp_gpio_get_chip(int number)
+{
+    scp_gpio_board_t *board = current_board();
+
+    return board && number >= 0 && number < board->nchips ?
+        board->chips[number] : NULL;
+}
+
+
+/*
+ * Converts an unsigned number argument.
+ */
+int scp_gpio_parse_uint(const char *arg, uint32_t *value)
+{
+    char *end;
+
+    *value = (uint32_t)strtoul(arg, &end, 0);
+    return end != arg && *end == '\0';
+}
+
+
+/**
+ * \brief Returns the mask of all the lines of a chip.
+ *
+ * \param   chip    The chip.
+ *
+ * \return  The mask.
+ */
+static uint32_t all_lines(scp_gpio_chip_t *chip)
+{
+    return chip->nlines == 32 ? 0xffffffffu : (1u << chip->nlines) - 1;
+}
+
+
+/**
+ * \brief Resolves a pin number argument to a chip and line mask.
+ *
+ * Outputs an error value if the pin does not exist.
+ *
+ * \param   out     Output for errors.
+ * \param   board   The board.
+ * \param   arg     The pin number argument.
+ * \param   mask    Where to store the mask of the line.
+ *
+ * \return  The chip, or NULL if the pin does not exist.
+ */
+static scp_gpio_chip_t *find_pin(scp_out_t *out, scp_gpio_board_t *board,
+        const char *arg, uint32_t *mask)
+{
+    uint32_t pin;
+    int idx;
+
+    if (scp_gpio_parse_uint(arg, &pin))
+    {
+        for (idx=0; idx < board->nchips; idx++)
+        {
+            if (pin < (uint32_t)board->chips[idx]->nlines)
+            {
+                *mask = 1u << pin;
+                return board->chips[idx];
+            }
+            pin -= board->chips[idx]->nlines;
+        }
+    }
+    scp_out_str(out, "ERROR: no such pin!");
+    return NULL;
+}
+
+
+/**
+ * \brief Resolves a chip number argument.
+ *
+ * Outputs an error value if the chip does not exist.
+ *
+ * \param   out     Output for errors.
+ * \param   board   The board.
+ * \param   arg     The chip number argument.
+ *
+ * \return  The chip, or NULL if the chip does not exist.
+ */
+static scp_gpio_chip_t *find_chip(scp_out_t *out, scp_gpio_board_t *board,
+        const char *arg)
+{
+    uint32_t idx;
+
+    if (scp_gpio_parse_uint(arg, &idx) && idx < (uint32_t)board->nchips)
+        return board->chips[idx];
+
+    scp_out_str(out, "ERROR: no such chip!");
+    return NULL;
+}
+
+
+/**
+ * \brief Returns the staged changes to a chip.
+ *
+ * \param   board   The board of the chip.
+ * \param   chip    The chip.
+ *
+ * \return  The staged changes, or NULL if no transaction is in progress.
+ */
+static staged_chip_t *staging(scp_gpio_board_t *board, scp_gpio_chip_t *chip)
+{
+    int idx;
+
+    if (board->transaction.active)
+    {
+        for (idx=0; idx < board->nchips; idx++)
+        {
+            if (board->chips[idx] == chip)
+                return &board->transaction.chips[idx];
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * \brief Drives output lines, keeping the copy of the output values.
+ *
+ * In a transaction the write is staged.
+ *
+ * \param   out     Output for errors.
+ * \param   board   The board of the chip.
+ * \param   chip    The chip.
+ * \param   mask    The lines to drive.
+ * \param   values  The values.
+ *
+ * \return  1 on success, 0 on failure.
+ */
+static int write_lines(scp_out_t *out, scp_gpio_board_t *board,
+        scp_gpio_chip_t *chip, uint32_t mask, uint32_t values)
+{
+    staged_chip_t *staged = staging(board, chip);
+
+    if (mask & ~(staged ? staged->output_mask : chip->output_mask))
+    {
+        scp_out_str(out, "ERROR: not an output!");
+        return 0;
+    }
+    if (staged)
+    {
+        staged->write_mask |= mask;
+        staged->output_values = (staged->output_values & ~mask) |
+            (values & mask);
+        board->transaction.nstaged++;
+        return 1;
+    }
+    if (!(*chip->write)(chip, mask, values))
+    {
+        scp_out_str(out, "ERROR: write failed!");
+        return 0;
+    }
+    chip->output_values = (chip->output_values & ~mask) | (values & mask);
+    return 1;
+}
+
+
+/**
+ * \brief Pinmode command - sets a pin to input or output.
+ *
+ * \param out       Output for errors.
+ * \param argc      2
+ * \param argv      The pin number and in or out.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int pinmode_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    staged_chip_t *staged;
+    uint32_t mask;
+    int mode;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_pin(out, board, argv[0], &mask)) == NULL)
+        return 0;
+
+    if (strcmp(argv[1], "in") == 0)
+    {
+        mode = SCP_GPIO_INPUT;
+    }
+    else if (strcmp(argv[1], "out") == 0)
+    {
+        mode = SCP_GPIO_OUTPUT;
+    }
+    else
+    {
+        scp_out_str(out, "ERROR: mode is in or out!");
+        return 0;
+    }
+
+    if ((staged = staging(board, chip)) != NULL)
+    {
+        staged->mode_mask |= mask;
+        if (mode == SCP_GPIO_OUTPUT)
+            staged->output_mask |= mask;
+        else
+            staged->output_mask &= ~mask;
+        board->transaction.nstaged++;
+        return 1;
+    }
+
+    if (!(*chip->set_mode)(chip, mask, mode))
+    {
+        scp_out_str(out, "ERROR: set mode failed!");
+        return 0;
+    }
+
+    if (mode == SCP_GPIO_OUTPUT)
+        chip->output_mask |= mask;
+    else
+        chip->output_mask &= ~mask;
+    return 1;
+}
+
+
+/**
+ * \brief Read command - outputs the level of a pin.
+ *
+ * \param out       Output for the level.
+ * \param argc      1
+ * \param argv      The pin number.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int read_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+    uint32_t values;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_pin(out, board, argv[0], &mask)) == NULL)
+        return 0;
+
+    if (!(*chip->read)(chip, mask, &values))
+    {
+        scp_out_str(out, "ERROR: read failed!");
+        return 0;
+    }
+    scp_out_int(out, (values & mask) != 0);
+    return 1;
+}
+
+
+/**
+ * \brief Write command - drives an output pin.
+ *
+ * \param out       Output for errors.
+ * \param argc      2
+ * \param argv      The pin number and 0 or 1.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int write_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_pin(out, board, argv[0], &mask)) == NULL)
+        return 0;
+
+    return write_lines(out, board, chip, mask, atoi(argv[1]) ? mask : 0);
+}
+
+
+/**
+ * \brief Toggle command - inverts an output pin.
+ *
+ * \param out       Output for errors.
+ * \param argc      1
+ * \param argv      The pin number.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int toggle_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    staged_chip_t *staged;
+    uint32_t mask;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_pin(out, board, argv[0], &mask)) == NULL)
+        return 0;
+
+    staged = staging(board, chip);
+    return write_lines(out, board, chip, mask,
+            ~(staged ? staged->output_values : chip->output_values));
+}
+
+
+/**
+ * \brief Rport command - outputs the levels of the lines of a chip.
+ *
+ * \param out       Output for the levels.
+ * \param argc      1 or 2
+ * \param argv      The chip number and optionally the mask of lines to read.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int rport_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+    uint32_t values;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_chip(out, board, argv[0])) == NULL)
+        return 0;
+
+    mask = all_lines(chip);
+    if (argc > 1 && !scp_gpio_parse_uint(argv[1], &mask))
+    {
+        scp_out_str(out, "ERROR: bad mask!");
+        return 0;
+    }
+
+    if (!(*chip->read)(chip, mask & all_lines(chip), &values))
+    {
+        scp_out_str(out, "ERROR: read failed!");
+        return 0;
+    }
+    scp_out_int(out, (int)(values & mask));
+    return 1;
+}
+
+
+/**
+ * \brief Wport command - drives the output lines of a chip.
+ *
+ * \param out       Output for errors.
+ * \param argc      3
+ * \param argv      The chip number, the mask of lines and the values.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int wport_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+    uint32_t values;
+
+    if ((board = find_board(out)) == NULL ||
+            (chip = find_chip(out, board, argv[0])) == NULL)
+        return 0;
+
+    if (!scp_gpio_parse_uint(argv[1], &mask) ||
+            !scp_gpio_parse_uint(argv[2], &values))
+    {
+        scp_out_str(out, "ERROR: bad mask or value!");
+        return 0;
+    }
+    return write_lines(out, board, chip, mask, values);
+}
+
+
+/**
+ * \brief Chips command - outputs the name and number of lines of each chip.
+ *
+ * \param out       Output for the list.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         The number of chips.
+ */
+static int chips_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    int idx;
+
+    if ((board = find_board(out)) == NULL)
+        return 0;
+
+    for (idx=0; idx < board->nchips; idx++)
+    {
+        scp_out_str(out, board->chips[idx]->name);
+        scp_out_int(out, board->chips[idx]->nlines);
+    }
+    return board->nchips;
+}
+
+
+/**
+ * \brief Begin command - starts a transaction.
+ *
+ * \param out       Output for errors.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         1 on success, 0 if a transaction is already in progress.
+ */
+static int begin_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    transaction_t *transaction;
+    int idx;
+
+    if ((board = find_board(out)) == NULL)
+        return 0;
+    transaction = &board->transaction;
+
+    if (transaction->active)
+    {
+        scp_out_str(out, "ERROR: already in a transaction!");
+        return 0;
+    }
+
+    for (idx=0; idx < board->nchips; idx++)
+    {
+        transaction->chips[idx].mode_mask     = 0;
+        transaction->chips[idx].write_mask    = 0;
+        transaction->chips[idx].output_mask   =
+            board->chips[idx]->output_mask;
+        transaction->chips[idx].output_values =
+            board->chips[idx]->output_values;
+    }
+    transaction->nstaged = 0;
+    transaction->active  = 1;
+    return 1;
+}
+
+
+/**
+ * \brief Applies the staged changes to a chip.
+ *
+ * \param   chip    The chip.
+ * \param   staged  The staged changes.
+ * \param   calls   Incremented for each backend access.
+ *
+ * \return  1 on success, 0 on failure.
+ */
+static int commit_chip(scp_gpio_chip_t *chip, staged_chip_t *staged,
+        int *calls)
+{
+    uint32_t to_output = staged->mode_mask & staged->output_mask;
+    uint32_t to_input  = staged->mode_mask & ~staged->output_mask;
+    uint32_t writes    = staged->write_mask & staged->output_mask;
+
+    if (staged->mode_mask && chip->configure)
+    {
+        /* Modes and values in one access. */
+        (*calls)++;
+        if (!(*chip->configure)(chip, staged->output_mask,
+                    staged->output_values))
+            return 0;
+    }
+    else
+    {
+        if (to_input)
+        {
+            (*calls)++;
+            if (!(*chip->set_mode)(chip, to_input, SCP_GPIO_INPUT))
+                return 0;
+        }
+        if (to_output)
+        {
+            (*calls)++;
+            if (!(*chip->set_mode)(chip, to_output, SCP_GPIO_OUTPUT))
+                return 0;
+        }
+        if (writes)
+        {
+            (*calls)++;
+            if (!(*chip->write)(chip, writes, staged->output_values))
+                return 0;
+        }
+    }
+
+    chip->output_mask   = staged->output_mask;
+    chip->output_values = staged->output_values;
+    return 1;
+}
+
+
+/**
+ * \brief Commit command - applies the staged changes.
+ *
+ * The chips are committed in order. If a chip fails, the chips before it
+ * keep their changes, as they cannot be undone.
+ *
+ * \param out       Output for the number of backend accesses.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         The number of commands staged, 0 on failure.
+ */
+static int commit_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+    int calls = 0;
+    int idx;
+
+    if ((board = find_board(out)) == NULL)
+        return 0;
+
+    if (!board->transaction.active)
+    {
+        scp_out_str(out, "ERROR: not in a transaction!");
+        return 0;
+    }
+    board->transaction.active = 0;
+
+    for (idx=0; idx < board->nchips; idx++)
+    {
+        staged_chip_t *staged = &board->transaction.chips[idx];
+
+        if ((staged->mode_mask || staged->write_mask) &&
+                !commit_chip(board->chips[idx], staged, &calls))
+        {
+            scp_out_str(out, "ERROR: commit failed on chip");
+            scp_out_int(out, idx);
+            return 0;
+        }
+    }
+    scp_out_int(out, calls);
+    return board->transaction.nstaged;
+}
+
+
+/**
+ * \brief Abort command - discards the staged changes.
+ *
+ * \param out       Output for errors.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         1 on success, 0 if no transaction is in progress.
+ */
+static int abort_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_board_t *board;
+
+    if ((board = find_board(out)) == NULL)
+        return 0;
+
+    if (!board->transaction.active)
+    {
+        scp_out_str(out, "ERROR: not in a transaction!");
+        return 0;
+    }
+    board->transaction.active = 0;
+    return 1;
+}
+
+
+/**
+ * \var gpio_commands
+ *
+ * The GPIO commands.
+ */
+static const scp_command_t gpio_commands[] = {
+    SCP_COMMAND_DEF_EX(
+            "pinmode",
+            "pm",
+            "Set <pin> mode to <in|out>",
+            2,
+            2,
+            pinmode_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "read",
+            "r",
+            "Read <pin>",
+            1,
+            1,
+            read_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "write",
+            "w",
+            "Write <pin> <0|1>",
+            2,
+            2,
+            write_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "toggle",
+            "t",
+            "Toggle output <pin>",
+            1,
+            1,
+            toggle_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "rport",
+            "rp",
+            "Read port <chip> [<mask>]",
+            1,
+            2,
+            rport_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "wport",
+            "wp",
+            "Write port <chip> <mask> <value>",
+            3,
+            3,
+            wport_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "chips",
+            "",
+            "List GPIO chips.",
+            0,
+            0,
+            chips_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "begin",
+            "",
+            "Start staging GPIO changes.",
+            0,
+            0,
+            begin_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "commit",
+            "",
+            "Apply the staged GPIO changes.",
+            0,
+            0,
+            commit_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "abort",
+            "",
+            "Discard the staged GPIO changes.",
+            0,
+            0,
+            abort_cmd_func
+            )
+};
+
+
+/*
+ * Adds the GPIO commands.
+ */
+void scp_add_gpio_commands(void)
+{
+    scp_add_command_table(gpio_commands,
+            sizeof(gpio_commands) / sizeof(gpio_commands[0]), NULL);
+}
@@ -0,0 +1,337 @@
+/**
+ * \file
+ *
+ * \brief GPIO commands for the Simple Command Parser.
+ *
+ * Provides commands to configure, read and write GPIO pins and whole ports.
+ * The hardware is accessed through the #scp_gpio_chip_t backend interface,
+ * with implementations for:
+ * -# A simulated chip held in memory, for testing without hardware - see
+ *    scp_gpio_sim_new().
+ * -# The Linux GPIO character device, /dev/gpiochipN - see
+ *    scp_gpio_linux_open().
+ */
+
+#ifndef SCP_GPIO_H_
+#define SCP_GPIO_H_
+
+#include <stdint.h>
+
+/**
+ * The maximum number of GPIO chips that can be attached.
+ */
+#define SCP_GPIO_MAX_CHIPS  4
+
+/**
+ * The maximum number of lines per chip, i.e. the width of a port.
+ */
+#define SCP_GPIO_MAX_LINES  32
+
+/*
+ * Pin modes.
+ */
+#define SCP_GPIO_INPUT      0   /**< Pin is an input. */
+#define SCP_GPIO_OUTPUT     1   /**< Pin is an output. */
+
+/**
+ * \typedef scp_gpio_edge_t
+ *
+ * \brief An edge detected on a watched line, see scp_gpio_chip_t::watch.
+ */
+typedef struct {
+    /** Time of the edge in nanoseconds, CLOCK_MONOTONIC on Linux. */
+    uint64_t            timestamp_ns;
+    /** Sequence number of the edge on its chip, counting from 1. Gaps show
+     *  edges lost because they were not read in time. */
+    uint32_t            seqno;
+    /** The line. */
+    uint8_t             line;
+    /** 1 for a rising edge, 0 for a falling edge. */
+    uint8_t             rising;
+} scp_gpio_edge_t;
+
+/**
+ * \typedef scp_gpio_chip_t
+ *
+ * \brief Typedef of the _scp_gpio_chip_t struct.
+ */
+typedef struct _scp_gpio_chip_t scp_gpio_chip_t;
+
+/**
+ * \struct _scp_gpio_chip_t
+ *
+ * \brief A GPIO chip backend.
+ *
+ * Each operation acts on every line set in mask at once, so a whole port is
+ * accessed with a single register access or system call. Operations return
+ * 1 on success and 0 on failure.
+ */
+struct _scp_gpio_chip_t {
+    /** Chip name, displayed by the 'chips' command. */
+    const char          *name;
+    /** Number of lines, at most #SCP_GPIO_MAX_LINES. */
+    int                 nlines;
+
+    /** Set the lines in mask to mode #SCP_GPIO_INPUT or #SCP_GPIO_OUTPUT. */
+    int                 (*set_mode)(scp_gpio_chip_t *chip,
+                                    uint32_t mask,
+                                    int mode);
+    /**
+     * Set the modes of all lines, with the outputs in direction, and drive
+     * the outputs to values. Optional, NULL if the backend cannot do this in
+     * one access.
+     */
+    int                 (*configure)(scp_gpio_chip_t *chip,
+                                     uint32_t direction,
+                                     uint32_t values);
+    /** Read the lines in mask into values. */
+    int                 (*read)(scp_gpio_chip_t *chip,
+                                uint32_t mask,
+                                uint32_t *values);
+    /** Drive the output lines in mask to values. */
+    int                 (*write)(scp_gpio_chip_t *chip,
+                                 uint32_t mask,
+                                 uint32_t values);
+    /**
+     * Detect edges on the input lines in mask, 0 to stop. Returns a file
+     * descriptor that is readable while edges are waiting to be read, or -1
+     * on failure. Optional, NULL if the backend cannot detect edges.
+     */
+    int                 (*watch)(scp_gpio_chip_t *chip, uint32_t mask);
+    /**
+     * Read up to max edges detected since the last call, without waiting.
+     * Returns the number read, or -1 on failure. Required with watch.
+     */
+    int                 (*read_edges)(scp_gpio_chip_t *chip,
+                                      scp_gpio_edge_t *edges,
+                                      int max);
+
+    /** Lines configured as outputs, maintained by the GPIO commands. */
+    uint32_t            output_mask;
+    /** Last value written to the outputs, maintained by the GPIO commands. */
+    uint32_t            output_values;
+    /** Private data of the backend. */
+    void                *priv;
+};
+
+/**
+ * \typedef scp_gpio_board_t
+ *
+ * \brief A set of attached chips, and the transaction in progress on them.
+ *
+ * The GPIO commands act on the board of the parse loop, or in a batch job on
+ * the board that is the target of the job, see scp_batch.h, so jobs running
+ * at once each have chips of their own. A chip must only be attached to one
+ * board, and a board be the target of one job at a time.
+ */
+typedef struct _scp_gpio_board_t scp_gpio_board_t;
+
+/**
+ * \brief Create a board, without chips, for a batch job.
+ *
+ * \return  The new board, or NULL if out of memory.
+ */
+scp_gpio_board_t *scp_gpio_board_new(void);
+
+/**
+ * \brief Free a board created by scp_gpio_board_new(). Its chips are not
+ * freed.
+ *
+ * \param   board   The board.
+ */
+void scp_gpio_board_free(scp_gpio_board_t *board);
+
+/**
+ * \brief Attach a GPIO chip to a board.
+ *
+ * Pins are numbered consecutively across the chips of a board in the order
+ * they are attached, e.g. if chip 0 has 32 lines, line 0 of chip 1 is pin
+ * 32.
+ *
+ * \param   board   The board.
+ * \param   chip    The chip backend.
+ *
+ * \return  The chip number, used by the port commands.
+ */
+int scp_gpio_board_attach(scp_gpio_board_t *board, scp_gpio_chip_t *chip);
+
+/**
+ * \brief Attach a GPIO chip to the board of the parse loop, see
+ * scp_gpio_board_attach().
+ *
+ * \param   chip    The chip backend.
+ *
+ * \return  The chip number, used by the port commands.
+ */
+int scp_gpio_attach(scp_gpio_chip_t *chip);
+
+/**
+ * \brief Get an attached GPIO chip of the board the commands of this thread
+ * act on.
+ *
+ * \param   number  The chip number returned when it was attached.
+ *
+ * \return  The chip, or NULL if there is no such chip.
+ */
+scp_gpio_chip_t *scp_gpio_get_chip(int number);
+
+/**
+ * \brief Converts an unsigned number argument of a GPIO command.
+ *
+ * \param   arg     The argument, decimal or hex with a 0x prefix.
+ * \param   value   Where to store the value.
+ *
+ * \return  1 on success, 0 if arg is not a number.
+ */
+int scp_gpio_parse_uint(const char *arg, uint32_t *value);
+
+/**
+ * \brief Add the GPIO commands to the parser.
+ *
+ * -# pinmode \<pin\> \<in|out\> - set the mode of a pin.
+ * -# read \<pin\> - read a pin.
+ * -# write \<pin\> \<0|1\> - drive an output pin.
+ * -# toggle \<pin\> - invert an output pin.
+ * -# rport \<chip\> [\<mask\>] - read all the lines of a chip.
+ * -# wport \<chip\> \<mask\> \<value\> - drive the output lines in mask.
+ * -# chips - list the attached chips.
+ * -# begin - start a transaction.
+ * -# commit - apply the transaction.
+ * -# abort - discard the transaction.
+ *
+ * Masks and values can be given in hex with a 0x prefix.
+ *
+ * In a transaction, pinmode, write, toggle and wport are staged rather than
+ * applied, and take effect together on commit. The staged changes to each
+ * chip are coalesced into one mask, so commit makes a single backend access
+ * per chip, or where the backend has no configure operation, at most one
+ * per mode and one for the writes. Reads are not staged, and read the lines
+ * as they are before the commit. Commit outputs the number of backend
+ * accesses made and returns the number of commands staged.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_gpio_commands(void);
+
+/**
+ * \brief Create a simulated GPIO chip.
+ *
+ * The chip holds its state in memory. Input lines read the levels set with
+ * scp_gpio_sim_drive(), output lines read back the value written.
+ *
+ * \param   name    Chip name.
+ * \param   nlines  Number of lines, at most #SCP_GPIO_MAX_LINES.
+ *
+ * \return  The new chip.
+ */
+scp_gpio_chip_t *scp_gpio_sim_new(const char *name, int nlines);
+
+/**
+ * \brief Free a simulated GPIO chip, which must no longer be attached to a
+ * board in use.
+ *
+ * \param   chip    A chip created by scp_gpio_sim_new().
+ */
+void scp_gpio_sim_free(scp_gpio_chip_t *chip);
+
+/**
+ * \brief Set the level applied to input lines of a simulated chip.
+ *
+ * \param   chip    A chip created by scp_gpio_sim_new().
+ * \param   mask    The lines to set.
+ * \param   levels  The levels.
+ */
+void scp_gpio_sim_drive(scp_gpio_chip_t *chip, uint32_t mask, uint32_t levels);
+
+/**
+ * \brief Generate a synthetic waveform on input lines of a simulated chip.
+ *
+ * The lines in mask count in binary, with the lowest line in mask changing
+ * level every period_us microseconds, the next every 2 * period_us, and so
+ * on. This gives a deterministic waveform with known edge times for testing
+ * the capture and watch commands.
+ *
+ * \param   chip        A chip created by scp_gpio_sim_new().
+ * \param   mask        The lines to drive, 0 to stop the waveform.
+ * \param   period_us   Time between changes of the lowest line.
+ */
+void scp_gpio_sim_wave(scp_gpio_chip_t *chip, uint32_t mask,
+        uint32_t period_us);
+
+/**
+ * \brief Add commands to control simulated chips.
+ *
+ * -# simin \<chip\> \<mask\> \<levels\> - see scp_gpio_sim_drive().
+ * -# simwave \<chip\> \<mask\> \<period_us\> - see scp_gpio_sim_wave().
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_gpio_sim_commands(void);
+
+/**
+ * \brief Add the GPIO capture command to the parser. Linux only.
+ *
+ * capture \<chip\> \<mask\> \<rate_hz\> \<count\> samples the lines in mask
+ * count times at rate_hz on a dedicated thread. The samples are passed to
+ * the command through a lock-free ring buffer and output run length encoded
+ * as pairs of values: the levels, then the number of consecutive samples
+ * with those levels. If the ring overflowed, the number of samples lost is
+ * output last as 'overrun \<n\>'. There is one capture at a time, so it is
+ * refused in a batch job.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_gpio_capture_commands(void);
+
+/**
+ * \brief Add the GPIO play command to the parser. Linux only.
+ *
+ * play \<chip\> \<mask\> \<pattern\> [\<loops\>] writes a pattern to the
+ * output lines in mask, loops times. The pattern is a list of steps
+ * separated by ';', each a value and the microseconds to hold it separated
+ * by ':', e.g. 0x1:100;0x2:100;0x0:800.
+ *
+ * Playback runs on a dedicated thread, at real-time priority if allowed,
+ * with each write timed against an absolute deadline. Afterwards the
+ * lateness of the writes is output as 'min_ns \<n\> avg_ns \<n\> max_ns
+ * \<n\>', followed by 'failed \<n\>' if any writes failed.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_gpio_play_commands(void);
+
+/**
+ * \brief Add the GPIO watch command to the parser. Linux only.
+ *
+ * watch \<chip\> \<mask\> reports edges on the input lines in mask as they
+ * happen, while the parser waits for input, using the edge detection of the
+ * kernel. Each report is the chip number followed by a line, level and
+ * timestamp in nanoseconds for each edge, e.g. 'watch> 0 3 1 81726354'. A
+ * mask of 0 stops watching the chip.
+ *
+ * watch without arguments outputs the chip number, mask, edges reported and
+ * edges lost for each watched chip. Edges are lost if they arrive faster
+ * than they can be output: each report is limited to a batch of edges, so
+ * the console keeps reading input, and the rest wait in the backend's queue
+ * until it overflows.
+ *
+ * Edges are reported by the parse loop, so watch is refused in a batch job.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_gpio_watch_commands(void);
+
+/**
+ * \brief Open a Linux GPIO character device.
+ *
+ * Requests up to #SCP_GPIO_MAX_LINES lines of the chip, starting at line
+ * first, as inputs.
+ *
+ * \param   path    Path of the device, e.g. /dev/gpiochip0.
+ * \param   first   Offset of the first line to request.
+ *
+ * \return  The new chip, or NULL if the device could not be opened.
+ */
+scp_gpio_chip_t *scp_gpio_linux_open(const char *path, int first);
+
+#endif /* SCP_GPIO_H_ */
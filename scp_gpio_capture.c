@@ -0,0 +1,260 @@
+/**
+ * \file
+ *
+ * \brief GPIO capture command.
+ *
+ * Linux only. A sampling thread reads the lines at fixed absolute deadlines
+ * and pushes each sample into a lock-free ring buffer. The command handler
+ * drains the ring concurrently and outputs the samples run length encoded,
+ * so a long capture of a slowly changing signal produces little output and
+ * the sampling thread never waits for the console.
+ *
+ * On a microcontroller the same ring can be filled from a timer interrupt.
+ */
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <time.h>
+
+#include "simple_command_parser.h"
+#include "scp_gpio.h"
+#include "scp_ring.h"
+#include "scp_rt.h"
+#include "scp_metrics.h"
+#include "scp_batch.h"
+
+/**
+ * Number of samples the ring buffer holds, a power of 2.
+ */
+#define CAPTURE_RING_SIZE   4096
+
+/**
+ * The highest sample rate accepted.
+ */
+#define CAPTURE_MAX_RATE    1000000
+
+/**
+ * Number of samples the command handler lets pile up in the ring before it
+ * drains it, well short of the ring size.
+ */
+#define CAPTURE_DRAIN_BATCH (CAPTURE_RING_SIZE / 4)
+
+/**
+ * The longest the command handler sleeps at once, which bounds how late it
+ * notices the end of a slow capture.
+ */
+#define CAPTURE_MAX_SLEEP_NS    10000000u
+
+/**
+ * \typedef capture_t
+ *
+ * \brief State shared by the sampling thread and the command handler.
+ */
+typedef struct {
+    /** The chip to sample. */
+    scp_gpio_chip_t     *chip;
+    /** The lines to sample. */
+    uint32_t            mask;
+    /** Time between samples. */
+    uint64_t            period_ns;
+    /** Number of samples to take. */
+    uint32_t            count;
+    /** Samples that could not be read. */
+    uint32_t            failed;
+    /** Set by the sampling thread when it has finished. */
+    atomic_int          done;
+    /** The samples. */
+    scp_ring_t          ring;
+} capture_t;
+
+/**
+ * \var capture
+ *
+ * The capture in progress. Only one capture runs at a time, as commands are
+ * run one at a time.
+ */
+static capture_t capture;
+
+/**
+ * \var samples
+ *
+ * Storage for the ring buffer.
+ */
+static uint32_t samples[CAPTURE_RING_SIZE];
+
+
+/**
+ * \brief The sampling thread.
+ *
+ * \param   arg     The capture.
+ *
+ * \return  NULL
+ */
+static void *sample_thread(void *arg)
+{
+    capture_t *cap = (capture_t *)arg;
+    uint64_t deadline = scp_rt_now_ns();
+    uint32_t idx;
+    uint32_t values;
+
+    for (idx=0; idx < cap->count; idx++)
+    {
+        scp_rt_wait_until(deadline);
+        deadline += cap->period_ns;
+
+        if (!(*cap->chip->read)(cap->chip, cap->mask, &values))
+        {
+            cap->failed++;
+            values = 0;
+        }
+        scp_ring_push(&cap->ring, &values, 1);
+    }
+
+    atomic_store_explicit(&cap->done, 1, memory_order_release);
+    return NULL;
+}
+
+
+/**
+ * \brief Outputs a run of samples.
+ *
+ * \param   out     Output for the run.
+ * \param   values  The levels of the run.
+ * \param   run     Number of samples in the run.
+ */
+static void output_run(scp_out_t *out, uint32_t values, uint32_t run)
+{
+    if (run)
+    {
+        /* Line 31 would make an int negative. */
+        scp_out_int64(out, (int64_t)values);
+        scp_out_int64(out, (int64_t)run);
+    }
+}
+
+
+/**
+ * \brief Capture command - samples lines at a fixed rate.
+ *
+ * \param out       Output for the samples.
+ * \param argc      4
+ * \param argv      The chip number, the mask of lines, the sample rate in Hz
+ *                  and the number of samples.
+ *
+ * \returns         The number of samples output, 0 on failure.
+ */
+static int capture_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    capture_t *cap = &capture;
+    pthread_t thread;
+    uint32_t number;
+    uint32_t rate;
+    uint32_t sample;
+    uint32_t values = 0;
+    uint32_t run = 0;
+    uint32_t total = 0;
+    uint32_t dropped;
+    uint64_t sleep_ns;
+    struct timespec nap;
+
+    /* There is one capture, and one ring, for all the threads. */
+    if (scp_batch_refuse(out))
+        return 0;
+
+    if (!scp_gpio_parse_uint(argv[0], &number) ||
+            (cap->chip = scp_gpio_get_chip((int)number)) == NULL)
+    {
+        scp_out_str(out, "ERROR: no such chip!");
+        return 0;
+    }
+
+    if (!scp_gpio_parse_uint(argv[1], &cap->mask) ||
+            !scp_gpio_parse_uint(argv[2], &rate) ||
+            !scp_gpio_parse_uint(argv[3], &cap->count) ||
+            rate == 0 || rate > CAPTURE_MAX_RATE)
+    {
+        scp_out_str(out, "ERROR: bad mask, rate or count!");
+        return 0;
+    }
+
+    cap->period_ns = 1000000000u / rate;
+    sleep_ns = cap->period_ns * CAPTURE_DRAIN_BATCH;
+    if (sleep_ns > CAPTURE_MAX_SLEEP_NS)
+        sleep_ns = CAPTURE_MAX_SLEEP_NS;
+    nap.tv_sec  = 0;
+    nap.tv_nsec = (long)sleep_ns;
+    cap->failed = 0;
+    atomic_init(&cap->done, 0);
+
+    /* The ring is empty between captures, and counts the records dropped
+     * by all of them for the metrics.
+     */
+    dropped = atomic_load_explicit(&cap->ring.dropped, memory_order_relaxed);
+
+    if (pthread_create(&thread, NULL, sample_thread, cap) != 0)
+    {
+        scp_out_str(out, "ERROR: cannot start sampling!");
+        return 0;
+    }
+
+    /* Drain the ring while the thread samples, sleeping while it is empty
+     * rather than taking a CPU from the sampling thread.
+     */
+    for (;;)
+    {
+        if (scp_ring_pop(&cap->ring, &sample, 1))
+        {
+            if (run && sample != values)
+            {
+                output_run(out, values, run);
+                run = 0;
+            }
+            values = sample;
+            run++;
+            total++;
+        }
+        else if (atomic_load_explicit(&cap->done, memory_order_acquire))
+        {
+            /* Samples pushed before done was set are visible now. */
+            if (scp_ring_used(&cap->ring) == 0)
+                break;
+        }
+        else
+        {
+            nanosleep(&nap, NULL);
+        }
+    }
+    pthread_join(thread, NULL);
+    output_run(out, values, run);
+
+    dropped = atomic_load_explicit(&cap->ring.dropped, memory_order_relaxed) -
+        dropped;
+    if (dropped || cap->failed)
+    {
+        scp_out_str(out, "overrun");
+        scp_out_int64(out, (int64_t)dropped + cap->failed);
+    }
+    return (int)total;
+}
+
+
+/*
+ * Adds the capture command.
+ */
+void scp_add_gpio_capture_commands(void)
+{
+    scp_ring_init(&capture.ring, samples, CAPTURE_RING_SIZE);
+    scp_metrics_add_ring("capture", &capture.ring);
+
+    scp_add_command_ex(
+            "capture",
+            "",
+            "Sample <chip> <mask> <rate_hz> <count>",
+            4,
+            4,
+            capture_cmd_func
+            );
+}
+
+#endif /* __linux__ */
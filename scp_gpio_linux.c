@@ -0,0 +1,285 @@
+/**
+ * \file
+ *
+ * \brief Linux GPIO character device chip.
+ *
+ * A GPIO chip backend using the GPIO v2 character device ioctls. All the
+ * lines are held in a single line request, so reading or writing any mask of
+ * lines, or changing their modes and output values together, is a single
+ * ioctl on the request.
+ */
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+#include "scp_gpio.h"
+
+/**
+ * \typedef linux_chip_t
+ *
+ * \brief State of a Linux GPIO chip.
+ */
+typedef struct {
+    /** The backend interface, must be first. */
+    scp_gpio_chip_t     chip;
+    /** The line request file descriptor. */
+    int                 fd;
+    /** Lines configured as outputs. */
+    uint32_t            direction;
+    /** Input lines with edge detection enabled. */
+    uint32_t            watch_mask;
+    /** Offset of line 0 on the kernel chip. */
+    int                 first;
+    /** Chip name from the kernel. */
+    char                name[GPIO_MAX_NAME_SIZE];
+} linux_chip_t;
+
+
+/**
+ * \brief Fills in a line configuration for the current line modes.
+ *
+ * Lines are inputs by default, with an attribute for the outputs and their
+ * initial values, and one for the watched inputs.
+ *
+ * \param   lnx     The chip.
+ * \param   values  Values for the output lines.
+ * \param   config  The configuration to fill in.
+ */
+static void make_config(linux_chip_t *lnx, uint32_t values,
+        struct gpio_v2_line_config *config)
+{
+    struct gpio_v2_line_config_attribute *attr = config->attrs;
+    uint32_t watch = lnx->watch_mask & ~lnx->direction;
+
+    memset(config, 0, sizeof(*config));
+    config->flags = GPIO_V2_LINE_FLAG_INPUT;
+
+    if (lnx->direction)
+    {
+        attr->attr.id    = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+        attr->mask       = lnx->direction;
+        attr++;
+        attr->attr.id     = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+        attr->attr.values = values;
+        attr->mask        = lnx->direction;
+        attr++;
+    }
+    if (watch)
+    {
+        attr->attr.id    = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        attr->attr.flags = GPIO_V2_LINE_FLAG_INPUT |
+            GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+        attr->mask       = watch;
+        attr++;
+    }
+    config->num_attrs = (uint32_t)(attr - config->attrs);
+}
+
+
+/**
+ * \brief Sets the mode of lines, see #scp_gpio_chip_t.
+ */
+static int linux_set_mode(scp_gpio_chip_t *chip, uint32_t mask, int mode)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_config config;
+    uint32_t direction = lnx->direction;
+
+    if (mode == SCP_GPIO_OUTPUT)
+        lnx->direction |= mask;
+    else
+        lnx->direction &= ~mask;
+
+    make_config(lnx, chip->output_values, &config);
+    if (ioctl(lnx->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    {
+        lnx->direction = direction;
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * \brief Sets the modes and output values of all lines, see
+ * #scp_gpio_chip_t.
+ */
+static int linux_configure(scp_gpio_chip_t *chip, uint32_t direction,
+        uint32_t values)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_config config;
+    uint32_t old_direction = lnx->direction;
+
+    lnx->direction = direction;
+    make_config(lnx, values, &config);
+    if (ioctl(lnx->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    {
+        lnx->direction = old_direction;
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * \brief Reads lines, see #scp_gpio_chip_t.
+ */
+static int linux_read(scp_gpio_chip_t *chip, uint32_t mask, uint32_t *values)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_values lv;
+
+    lv.mask = mask;
+    lv.bits = 0;
+    if (ioctl(lnx->fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) < 0)
+        return 0;
+
+    *values = (uint32_t)lv.bits & mask;
+    return 1;
+}
+
+
+/**
+ * \brief Writes lines, see #scp_gpio_chip_t.
+ */
+static int linux_write(scp_gpio_chip_t *chip, uint32_t mask, uint32_t values)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_values lv;
+
+    lv.mask = mask;
+    lv.bits = values;
+    return ioctl(lnx->fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) == 0;
+}
+
+
+/**
+ * \brief Starts or stops detecting edges, see #scp_gpio_chip_t.
+ *
+ * The kernel queues the edges on the line request, so its file descriptor
+ * is returned.
+ */
+static int linux_watch(scp_gpio_chip_t *chip, uint32_t mask)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_config config;
+    uint32_t watch_mask = lnx->watch_mask;
+
+    lnx->watch_mask = mask;
+    make_config(lnx, chip->output_values, &config);
+    if (ioctl(lnx->fd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) < 0)
+    {
+        lnx->watch_mask = watch_mask;
+        return -1;
+    }
+    return lnx->fd;
+}
+
+
+/**
+ * \brief Reads queued edges, see #scp_gpio_chip_t.
+ */
+static int linux_read_edges(scp_gpio_chip_t *chip, scp_gpio_edge_t *edges,
+        int max)
+{
+    linux_chip_t *lnx = (linux_chip_t *)chip;
+    struct gpio_v2_line_event events[16];
+    ssize_t len;
+    int count;
+    int idx;
+
+    if (max > (int)(sizeof(events) / sizeof(events[0])))
+        max = (int)(sizeof(events) / sizeof(events[0]));
+
+    /* Only called when the fd is readable, so this does not block. */
+    if ((len = read(lnx->fd, events, max * sizeof(events[0]))) < 0)
+        return -1;
+
+    count = (int)(len / (ssize_t)sizeof(events[0]));
+    for (idx=0; idx < count; idx++)
+    {
+        edges[idx].timestamp_ns = events[idx].timestamp_ns;
+        edges[idx].seqno        = events[idx].seqno;
+        edges[idx].line         = (uint8_t)(events[idx].offset - lnx->first);
+        edges[idx].rising       =
+            events[idx].id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+    }
+    return count;
+}
+
+
+/*
+ * Opens a Linux GPIO character device.
+ */
+scp_gpio_chip_t *scp_gpio_linux_open(const char *path, int first)
+{
+    struct gpiochip_info info;
+    struct gpio_v2_line_request request;
+    linux_chip_t *lnx;
+    int chip_fd;
+    int nlines;
+    int idx;
+
+    if ((chip_fd = open(path, O_RDWR | O_CLOEXEC)) < 0)
+        return NULL;
+
+    if (ioctl(chip_fd, GPIO_GET_CHIPINFO_IOCTL, &info) < 0 ||
+            first < 0 || (unsigned int)first >= info.lines)
+    {
+        close(chip_fd);
+        return NULL;
+    }
+
+    nlines = (int)info.lines - first;
+    if (nlines > SCP_GPIO_MAX_LINES)
+        nlines = SCP_GPIO_MAX_LINES;
+
+    if ((lnx = (linux_chip_t *)calloc(1, sizeof(linux_chip_t))) == NULL)
+    {
+        close(chip_fd);
+        return NULL;
+    }
+
+    /* Request all the lines as inputs in one request. */
+    memset(&request, 0, sizeof(request));
+    for (idx=0; idx < nlines; idx++)
+    {
+        request.offsets[idx] = (uint32_t)(first + idx);
+    }
+    strncpy(request.consumer, "scp", sizeof(request.consumer) - 1);
+    make_config(lnx, 0, &request.config);
+    request.num_lines = (uint32_t)nlines;
+
+    if (ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &request) < 0)
+    {
+        close(chip_fd);
+        free(lnx);
+        return NULL;
+    }
+    close(chip_fd);
+
+    memcpy(lnx->name, info.name, sizeof(lnx->name));
+    lnx->fd             = request.fd;
+    lnx->first          = first;
+    lnx->chip.name      = lnx->name;
+    lnx->chip.nlines    = nlines;
+    lnx->chip.set_mode  = linux_set_mode;
+    lnx->chip.configure = linux_configure;
+    lnx->chip.read      = linux_read;
+    lnx->chip.write     = linux_write;
+    lnx->chip.watch      = linux_watch;
+    lnx->chip.read_edges = linux_read_edges;
+
+    return &lnx->chip;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,292 @@
+/**
+ * \file
+ *
+ * \brief GPIO pattern playback command.
+ *
+ * Linux only. A pattern of port values, each held for its own delay, is
+ * uploaded in a single command and written to the port by a dedicated
+ * thread. Each write is timed against an absolute deadline, so delays do not
+ * accumulate the time taken by the writes, and the lateness of every write is
+ * measured and reported once playback has finished.
+ */
+
+#ifdef __linux__
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "simple_command_parser.h"
+#include "scp_gpio.h"
+#include "scp_rt.h"
+
+/**
+ * The maximum number of steps in a pattern.
+ */
+#define PLAY_MAX_STEPS      64
+
+/**
+ * Separates the steps of a pattern. The parser's token delimiters cannot be
+ * used, as the pattern is a single argument.
+ */
+#define PLAY_STEP_SEP       ';'
+
+/**
+ * Separates the value and delay of a step.
+ */
+#define PLAY_DELAY_SEP      ':'
+
+/**
+ * \typedef play_step_t
+ *
+ * \brief A step of a pattern.
+ */
+typedef struct {
+    /** Values written to the port. */
+    uint32_t            values;
+    /** Time until the next step. */
+    uint32_t            delay_us;
+} play_step_t;
+
+/**
+ * \typedef play_t
+ *
+ * \brief A pattern and the results of playing it.
+ */
+typedef struct {
+    /** The chip to write. */
+    scp_gpio_chip_t     *chip;
+    /** The lines to write. */
+    uint32_t            mask;
+    /** Number of times to play the pattern. */
+    uint32_t            loops;
+    /** Number of steps. */
+    int                 nsteps;
+    /** The steps. */
+    play_step_t         steps[PLAY_MAX_STEPS];
+
+    /** Number of writes made. */
+    uint32_t            writes;
+    /** Number of writes that failed. */
+    uint32_t            failed;
+    /** Least lateness of a write. */
+    uint64_t            min_ns;
+    /** Greatest lateness of a write. */
+    uint64_t            max_ns;
+    /** Total lateness of the writes. */
+    uint64_t            sum_ns;
+} play_t;
+
+/**
+ * \brief Parses a pattern.
+ *
+ * \param   p       Where to store the steps.
+ * \param   arg     The pattern, e.g. 0x1:100;0x2:100;0x0:200
+ *
+ * \return  1 on success, 0 if the pattern is not valid.
+ */
+static int parse_pattern(play_t *p, const char *arg)
+{
+    char *end;
+
+    p->nsteps = 0;
+    while (*arg)
+    {
+        play_step_t *step = &p->steps[p->nsteps];
+
+        if (p->nsteps == PLAY_MAX_STEPS)
+            return 0;
+
+        step->values = (uint32_t)strtoul(arg, &end, 0);
+        if (end == arg || *end != PLAY_DELAY_SEP)
+            return 0;
+
+        arg = end + 1;
+        step->delay_us = (uint32_t)strtoul(arg, &end, 0);
+        if (end == arg || (*end && *end != PLAY_STEP_SEP))
+            return 0;
+
+        arg = *end ? end + 1 : end;
+        p->nsteps++;
+    }
+    return p->nsteps > 0;
+}
+
+
+/**
+ * \brief The playback thread.
+ *
+ * \param   arg     The pattern.
+ *
+ * \return  NULL
+ */
+static void *play_thread(void *arg)
+{
+    play_t *p = (play_t *)arg;
+    uint64_t deadline = scp_rt_now_ns();
+    uint64_t late;
+    uint32_t loop;
+    int idx;
+
+    for (loop=0; loop < p->loops; loop++)
+    {
+        for (idx=0; idx < p->nsteps; idx++)
+        {
+            scp_rt_wait_until(deadline);
+            late = scp_rt_now_ns() - deadline;
+
+            if (!(*p->chip->write)(p->chip, p->mask, p->steps[idx].values))
+                p->failed++;
+
+            if (p->writes == 0 || late < p->min_ns)
+                p->min_ns = late;
+            if (late > p->max_ns)
+                p->max_ns = late;
+            p->sum_ns += late;
+            p->writes++;
+
+            deadline += (uint64_t)p->steps[idx].delay_us * 1000u;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * \brief Starts the playback thread.
+ *
+ * The thread is given real-time priority if the process is allowed it,
+ * otherwise it runs at normal priority.
+ *
+ * \param   thread  Where to store the thread.
+ * \param   p       The pattern.
+ *
+ * \return  1 on success, 0 on failure.
+ */
+static int start_thread(pthread_t *thread, play_t *p)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    int started;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+
+    started = pthread_create(thread, &attr, play_thread, p) == 0 ||
+        pthread_create(thread, NULL, play_thread, p) == 0;
+
+    pthread_attr_destroy(&attr);
+    return started;
+}
+
+
+/**
+ * \brief Play command - writes a pattern to a port at precise intervals.
+ *
+ * Each call plays a pattern of its own, so calls from several threads do not
+ * share one.
+ *
+ * \param out       Output for the timing statistics.
+ * \param argc      3 or 4
+ * \param argv      The chip number, the mask of lines, the pattern and
+ *                  optionally the number of times to play it.
+ *
+ * \returns         The number of writes, 0 on failure.
+ */
+static int play_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    play_t *p;
+    pthread_t thread;
+    uint32_t number;
+    int writes;
+
+    p = (play_t *)calloc(1, sizeof(play_t));
+    if (p == NULL)
+    {
+        scp_out_str(out, "ERROR: out of memory!");
+        return 0;
+    }
+
+    if (!scp_gpio_parse_uint(argv[0], &number) ||
+            (p->chip = scp_gpio_get_chip((int)number)) == NULL)
+    {
+        scp_out_str(out, "ERROR: no such chip!");
+        free(p);
+        return 0;
+    }
+
+    p->loops = 1;
+    if (!scp_gpio_parse_uint(argv[1], &p->mask) ||
+            !parse_pattern(p, argv[2]) ||
+            (argc > 3 && !scp_gpio_parse_uint(argv[3], &p->loops)))
+    {
+        scp_out_str(out, "ERROR: bad mask, pattern or loops!");
+        free(p);
+        return 0;
+    }
+
+    if (p->mask & ~p->chip->output_mask)
+    {
+        scp_out_str(out, "ERROR: not an output!");
+        free(p);
+        return 0;
+    }
+
+    if (!start_thread(&thread, p))
+    {
+        scp_out_str(out, "ERROR: cannot start playback!");
+        free(p);
+        return 0;
+    }
+    pthread_join(thread, NULL);
+
+    if (p->writes)
+    {
+        int last = p->nsteps - 1;
+
+        p->chip->output_values = (p->chip->output_values & ~p->mask) |
+            (p->steps[last].values & p->mask);
+    }
+
+    /* Lateness can exceed the range of an int, e.g. when preempted. */
+    scp_out_str(out, "min_ns");
+    scp_out_int64(out, (int64_t)p->min_ns);
+    scp_out_str(out, "avg_ns");
+    scp_out_int64(out, p->writes ? (int64_t)(p->sum_ns / p->writes) : 0);
+    scp_out_str(out, "max_ns");
+    scp_out_int64(out, (int64_t)p->max_ns);
+    if (p->failed)
+    {
+        scp_out_str(out, "failed");
+        scp_out_int(out, (int)p->failed);
+    }
+
+    writes = (int)p->writes;
+    free(p);
+    return writes;
+}
+
+
+/*
+ * Adds the play command.
+ */
+void scp_add_gpio_play_commands(void)
+{
+    scp_add_command_ex(
+            "play",
+            "",
+            "Play <chip> <mask> <pattern> [<loops>]",
+            3,
+            4,
+            play_cmd_func
+            );
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,488 @@
+/**
+ * \file
+ *
+ * \brief Simulated GPIO chip.
+ *
+ * A GPIO chip backend held in memory, for testing the GPIO commands without
+ * hardware. Like a port register, every operation applies to all the lines
+ * in its mask at once.
+ *
+ * Input levels can be set directly, or generated as a synthetic waveform
+ * computed from the time of each read.
+ *
+ * On Linux, edges on watched lines are queued as they are detected and
+ * signalled through a timerfd, which is also used to check the waveform
+ * periodically, so the chip can be polled like a kernel line request.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/timerfd.h>
+#endif
+
+#include "simple_command_parser.h"
+#include "scp_gpio.h"
+#ifdef __linux__
+    #include "scp_rt.h"
+#endif
+
+/**
+ * Number of edges queued by a simulated chip, like the event queue of a
+ * kernel line request. Edges detected while the queue is full are lost.
+ */
+#define SIM_MAX_EDGES       16
+
+/**
+ * \typedef sim_chip_t
+ *
+ * \brief State of a simulated chip.
+ */
+typedef struct {
+    /** The backend interface, must be first. */
+    scp_gpio_chip_t     chip;
+    /** Lines configured as outputs. */
+    uint32_t            direction;
+    /** Output latch. */
+    uint32_t            latch;
+    /** Levels applied to the input lines. */
+    uint32_t            levels;
+    /** Input lines driven by the waveform generator. */
+    uint32_t            wave_mask;
+    /** Time between changes of the lowest waveform line. */
+    uint32_t            wave_period_us;
+    /** Time the waveform started. */
+    uint64_t            wave_start_us;
+#ifdef __linux__
+    /** Input lines watched for edges. */
+    uint32_t            watch_mask;
+    /** Levels of the watched lines when last checked. */
+    uint32_t            watch_levels;
+    /** timerfd signalling queued edges, or -1. */
+    int                 watch_fd;
+    /** Sequence number of the last edge detected. */
+    uint32_t            seqno;
+    /** Number of queued edges. */
+    int                 nedges;
+    /** Queued edges. */
+    scp_gpio_edge_t     edges[SIM_MAX_EDGES];
+#endif
+} sim_chip_t;
+
+
+/**
+ * \brief Returns the time for the waveform generator.
+ *
+ * Without a clock, time advances by one microsecond per call, so the
+ * waveform still advances with each read.
+ *
+ * \return  The time in microseconds.
+ */
+static uint64_t sim_time_us(void)
+{
+#ifdef __linux__
+    return scp_rt_now_ns() / 1000u;
+#else
+    static uint64_t ticks;
+
+    return ticks++;
+#endif
+}
+
+
+/**
+ * \brief Computes the levels of the waveform lines.
+ *
+ * The n-th line in the mask is bit n of the number of periods elapsed.
+ *
+ * \param   sim     The chip.
+ *
+ * \return  The levels, for the lines in wave_mask only.
+ */
+static uint32_t wave_levels(sim_chip_t *sim)
+{
+    uint64_t count = (sim_time_us() - sim->wave_start_us) / sim->wave_period_us;
+    uint32_t levels = 0;
+    uint32_t bit;
+
+    for (bit=1; bit && count; bit <<= 1)
+    {
+        if (sim->wave_mask & bit)
+        {
+            if (count & 1)
+                levels |= bit;
+            count >>= 1;
+        }
+    }
+    return levels;
+}
+
+
+/**
+ * \brief Sets the mode of lines, see #scp_gpio_chip_t.
+ */
+static int sim_set_mode(scp_gpio_chip_t *chip, uint32_t mask, int mode)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    if (mode == SCP_GPIO_OUTPUT)
+        sim->direction |= mask;
+    else
+        sim->direction &= ~mask;
+    return 1;
+}
+
+
+/**
+ * \brief Sets the modes and output values of all lines, see
+ * #scp_gpio_chip_t.
+ */
+static int sim_configure(scp_gpio_chip_t *chip, uint32_t direction,
+        uint32_t values)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    sim->direction = direction;
+    sim->latch     = (sim->latch & ~direction) | (values & direction);
+    return 1;
+}
+
+
+/**
+ * \brief Reads lines, see #scp_gpio_chip_t.
+ *
+ * Outputs read back the latch, inputs read the applied levels.
+ */
+static int sim_read(scp_gpio_chip_t *chip, uint32_t mask, uint32_t *values)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+    uint32_t levels = sim->levels;
+
+    if (sim->wave_mask & mask)
+        levels = (levels & ~sim->wave_mask) | wave_levels(sim);
+
+    *values = ((sim->latch & sim->direction) |
+               (levels & ~sim->direction)) & mask;
+    return 1;
+}
+
+
+/**
+ * \brief Writes lines, see #scp_gpio_chip_t.
+ */
+static int sim_write(scp_gpio_chip_t *chip, uint32_t mask, uint32_t values)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    sim->latch = (sim->latch & ~mask) | (values & mask);
+    return 1;
+}
+
+
+#ifdef __linux__
+/**
+ * \brief Queues an edge for each watched line that changed level.
+ *
+ * \param   sim     The chip.
+ */
+static void sim_detect(sim_chip_t *sim)
+{
+    uint64_t now = scp_rt_now_ns();
+    uint32_t levels;
+    uint32_t changed;
+    int line;
+
+    if (sim->watch_mask == 0)
+        return;
+
+    sim_read(&sim->chip, sim->watch_mask, &levels);
+    changed = levels ^ sim->watch_levels;
+    sim->watch_levels = levels;
+
+    for (line=0; changed; line++, changed >>= 1)
+    {
+        if (changed & 1)
+        {
+            scp_gpio_edge_t *edge = &sim->edges[sim->nedges];
+
+            /* A full queue loses the edge, leaving a gap in seqno. */
+            sim->seqno++;
+            if (sim->nedges == SIM_MAX_EDGES)
+                continue;
+
+            edge->timestamp_ns = now;
+            edge->seqno        = sim->seqno;
+            edge->line         = (uint8_t)line;
+            edge->rising       = (uint8_t)((levels >> line) & 1);
+            sim->nedges++;
+        }
+    }
+}
+
+
+/**
+ * \brief Arms the timerfd.
+ *
+ * The timer fires immediately if edges are queued, and then every half
+ * period of a watched waveform so that no change of level is missed.
+ *
+ * \param   sim     The chip.
+ */
+static void sim_arm(sim_chip_t *sim)
+{
+    struct itimerspec timer;
+    uint64_t interval_ns = 0;
+
+    if (sim->watch_fd < 0)
+        return;
+
+    if (sim->watch_mask & sim->wave_mask)
+        interval_ns = (uint64_t)sim->wave_period_us * 500u;
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_interval.tv_sec  = (time_t)(interval_ns / 1000000000u);
+    timer.it_interval.tv_nsec = (long)(interval_ns % 1000000000u);
+    timer.it_value = timer.it_interval;
+    if (sim->nedges)
+    {
+        timer.it_value.tv_sec  = 0;
+        timer.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(sim->watch_fd, 0, &timer, NULL);
+}
+
+
+/**
+ * \brief Starts or stops detecting edges, see #scp_gpio_chip_t.
+ */
+static int sim_watch(scp_gpio_chip_t *chip, uint32_t mask)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    if (sim->watch_fd < 0)
+    {
+        sim->watch_fd = timerfd_create(CLOCK_MONOTONIC,
+                TFD_NONBLOCK | TFD_CLOEXEC);
+        if (sim->watch_fd < 0)
+            return -1;
+    }
+
+    sim->watch_mask = mask & ~sim->direction;
+    sim_read(chip, sim->watch_mask, &sim->watch_levels);
+    sim->nedges = 0;
+    sim_arm(sim);
+    return sim->watch_fd;
+}
+
+
+/**
+ * \brief Reads queued edges, see #scp_gpio_chip_t.
+ */
+static int sim_read_edges(scp_gpio_chip_t *chip, scp_gpio_edge_t *edges,
+        int max)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+    uint64_t expirations;
+    int count;
+
+    if (read(sim->watch_fd, &expirations, sizeof(expirations)) < 0)
+        expirations = 0;
+
+    sim_detect(sim);
+
+    count = sim->nedges < max ? sim->nedges : max;
+    memcpy(edges, sim->edges, count * sizeof(scp_gpio_edge_t));
+    sim->nedges -= count;
+    memmove(sim->edges, &sim->edges[count],
+            sim->nedges * sizeof(scp_gpio_edge_t));
+
+    /* Fire again at once for the edges left in the queue. */
+    if (sim->nedges)
+        sim_arm(sim);
+    return count;
+}
+#endif
+
+
+/*
+ * Creates a simulated chip.
+ */
+scp_gpio_chip_t *scp_gpio_sim_new(const char *name, int nlines)
+{
+    sim_chip_t *sim = (sim_chip_t *)calloc(1, sizeof(sim_chip_t));
+
+    assert(sim);
+    assert(nlines > 0 && nlines <= SCP_GPIO_MAX_LINES);
+
+    sim->chip.name      = name;
+    sim->chip.nlines    = nlines;
+    sim->chip.set_mode  = sim_set_mode;
+    sim->chip.configure = sim_configure;
+    sim->chip.read      = sim_read;
+    sim->chip.write     = sim_write;
+#ifdef __linux__
+    sim->chip.watch      = sim_watch;
+    sim->chip.read_edges = sim_read_edges;
+    sim->watch_fd        = -1;
+#endif
+
+    return &sim->chip;
+}
+
+
+/*
+ * Frees a simulated chip.
+ */
+void scp_gpio_sim_free(scp_gpio_chip_t *chip)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+#ifdef __linux__
+    if (sim->watch_fd >= 0)
+        close(sim->watch_fd);
+#endif
+    free(sim);
+}
+
+
+/*
+ * Sets the levels applied to input lines.
+ */
+void scp_gpio_sim_drive(scp_gpio_chip_t *chip, uint32_t mask, uint32_t levels)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    sim->levels = (sim->levels & ~mask) | (levels & mask);
+#ifdef __linux__
+    sim_detect(sim);
+    if (sim->nedges)
+        sim_arm(sim);
+#endif
+}
+
+
+/*
+ * Starts or stops the waveform generator.
+ */
+void scp_gpio_sim_wave(scp_gpio_chip_t *chip, uint32_t mask,
+        uint32_t period_us)
+{
+    sim_chip_t *sim = (sim_chip_t *)chip;
+
+    sim->wave_mask      = period_us ? mask : 0;
+    sim->wave_period_us = period_us;
+    sim->wave_start_us  = sim_time_us();
+#ifdef __linux__
+    sim_detect(sim);
+    sim_arm(sim);
+#endif
+}
+
+
+/**
+ * \brief Resolves the chip argument of a simulator command.
+ *
+ * \param   out     Output for errors.
+ * \param   arg     The chip number argument.
+ *
+ * \return  The chip, or NULL if it is not a simulated chip.
+ */
+static scp_gpio_chip_t *find_sim(scp_out_t *out, const char *arg)
+{
+    scp_gpio_chip_t *chip;
+    uint32_t number;
+
+    if (!scp_gpio_parse_uint(arg, &number) ||
+            (chip = scp_gpio_get_chip((int)number)) == NULL ||
+            chip->read != sim_read)
+    {
+        scp_out_str(out, "ERROR: not a simulated chip!");
+        return NULL;
+    }
+    return chip;
+}
+
+
+/**
+ * \brief Simin command - sets the levels of simulated input lines.
+ *
+ * \param out       Output for errors.
+ * \param argc      3
+ * \param argv      The chip number, the mask of lines and the levels.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int simin_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+    uint32_t levels;
+
+    if ((chip = find_sim(out, argv[0])) == NULL)
+        return 0;
+
+    if (!scp_gpio_parse_uint(argv[1], &mask) ||
+            !scp_gpio_parse_uint(argv[2], &levels))
+    {
+        scp_out_str(out, "ERROR: bad mask or levels!");
+        return 0;
+    }
+    scp_gpio_sim_drive(chip, mask, levels);
+    return 1;
+}
+
+
+/**
+ * \brief Simwave command - starts or stops the waveform generator.
+ *
+ * \param out       Output for errors.
+ * \param argc      3
+ * \param argv      The chip number, the mask of lines and the period.
+ *
+ * \returns         1 on success, 0 on failure.
+ */
+static int simwave_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_chip_t *chip;
+    uint32_t mask;
+    uint32_t period_us;
+
+    if ((chip = find_sim(out, argv[0])) == NULL)
+        return 0;
+
+    if (!scp_gpio_parse_uint(argv[1], &mask) ||
+            !scp_gpio_parse_uint(argv[2], &period_us))
+    {
+        scp_out_str(out, "ERROR: bad mask or period!");
+        return 0;
+    }
+    scp_gpio_sim_wave(chip, mask, period_us);
+    return 1;
+}
+
+
+/*
+ * Adds the simulator commands.
+ */
+void scp_add_gpio_sim_commands(void)
+{
+    scp_add_command_ex(
+            "simin",
+            "",
+            "Sim <chip> inputs <mask> to <levels>",
+            3,
+            3,
+            simin_cmd_func
+            );
+
+    scp_add_command_ex(
+            "simwave",
+            "",
+            "Sim <chip> wave on <mask> <period_us>",
+            3,
+            3,
+            simwave_cmd_func
+            );
+}
@@ -0,0 +1,216 @@
+/**
+ * \file
+ *
+ * \brief GPIO watch command.
+ *
+ * Linux only. Each watched chip provides a file descriptor that is readable
+ * while edges are queued, and is added as an event source of the parser, so
+ * edges are reported from the parser's input loop as they happen without a
+ * thread of their own.
+ */
+
+#ifdef __linux__
+
+#include <stdlib.h>
+
+#include "simple_command_parser.h"
+#include "scp_gpio.h"
+#include "scp_batch.h"
+
+/**
+ * The maximum number of edges in one report. Limiting the batch keeps the
+ * console responsive to input when edges arrive faster than they can be
+ * output; the rest stay queued by the backend.
+ */
+#define WATCH_BATCH         16
+
+/**
+ * \typedef watch_t
+ *
+ * \brief State of a watched chip.
+ */
+typedef struct {
+    /** The chip. */
+    scp_gpio_chip_t     *chip;
+    /** The chip number. */
+    int                 number;
+    /** Lines watched, 0 if the chip is not watched. */
+    uint32_t            mask;
+    /** The event source file descriptor. */
+    int                 fd;
+    /** Sequence number of the last edge, 0 before the first. */
+    uint32_t            seqno;
+    /** Edges reported. */
+    uint32_t            edges;
+    /** Edges lost. */
+    uint32_t            lost;
+} watch_t;
+
+/**
+ * \var watches
+ *
+ * The watch state of each chip.
+ */
+static watch_t watches[SCP_GPIO_MAX_CHIPS];
+
+
+/**
+ * \brief Reports the edges queued on a watched chip.
+ *
+ * Called by the parser's input loop when the chip's file descriptor is
+ * readable, see scp_add_event_source().
+ *
+ * \param   out     Output for the edges.
+ * \param   fd      The chip's file descriptor.
+ * \param   arg     The watch_t of the chip.
+ *
+ * \return  The number of edges reported.
+ */
+static int watch_event(scp_out_t *out, int fd, void *arg)
+{
+    watch_t *w = (watch_t *)arg;
+    scp_gpio_edge_t edges[WATCH_BATCH];
+    int count;
+    int idx;
+
+    count = (*w->chip->read_edges)(w->chip, edges, WATCH_BATCH);
+    if (count <= 0)
+        return 0;
+
+    scp_out_int(out, w->number);
+    for (idx=0; idx < count; idx++)
+    {
+        /* A gap in the sequence numbers counts the edges lost. */
+        if (w->seqno && edges[idx].seqno > w->seqno + 1)
+            w->lost += edges[idx].seqno - w->seqno - 1;
+        w->seqno = edges[idx].seqno;
+
+        scp_out_int(out, edges[idx].line);
+        scp_out_int(out, edges[idx].rising);
+        scp_out_int64(out, (int64_t)edges[idx].timestamp_ns);
+    }
+    w->edges += (uint32_t)count;
+    return count;
+}
+
+
+/**
+ * \brief Stops watching a chip.
+ *
+ * \param   w       The watch state of the chip.
+ */
+static void stop_watch(watch_t *w)
+{
+    if (w->mask)
+    {
+        scp_remove_event_source(w->fd);
+        (*w->chip->watch)(w->chip, 0);
+        w->mask = 0;
+    }
+}
+
+
+/**
+ * \brief Watch command - reports edges on input lines.
+ *
+ * \param out       Output for errors or the watch statistics.
+ * \param argc      0 or 2
+ * \param argv      The chip number and the mask of lines, 0 to stop.
+ *
+ * \returns         1 on success, 0 on failure. Without arguments, the number
+ *                  of chips watched.
+ */
+static int watch_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_gpio_chip_t *chip;
+    watch_t *w;
+    uint32_t number;
+    uint32_t mask;
+    int nwatched = 0;
+    int fd;
+
+    /* Edges are reported by the parse loop, for all the threads. */
+    if (scp_batch_refuse(out))
+        return 0;
+
+    if (argc == 0)
+    {
+        for (w=watches; w < &watches[SCP_GPIO_MAX_CHIPS]; w++)
+        {
+            if (w->mask)
+            {
+                scp_out_int(out, w->number);
+                scp_out_int(out, (int)w->mask);
+                scp_out_int(out, (int)w->edges);
+                scp_out_int(out, (int)w->lost);
+                nwatched++;
+            }
+        }
+        return nwatched;
+    }
+
+    if (argc != 2 || !scp_gpio_parse_uint(argv[0], &number) ||
+            (chip = scp_gpio_get_chip((int)number)) == NULL ||
+            !scp_gpio_parse_uint(argv[1], &mask))
+    {
+        scp_out_str(out, "ERROR: watch <chip> <mask>!");
+        return 0;
+    }
+
+    if (chip->watch == NULL)
+    {
+        scp_out_str(out, "ERROR: chip cannot watch!");
+        return 0;
+    }
+
+    if (mask & chip->output_mask)
+    {
+        scp_out_str(out, "ERROR: not an input!");
+        return 0;
+    }
+
+    w = &watches[number];
+    stop_watch(w);
+    if (mask == 0)
+        return 1;
+
+    if ((fd = (*chip->watch)(chip, mask)) < 0)
+    {
+        scp_out_str(out, "ERROR: watch failed!");
+        return 0;
+    }
+
+    if (!scp_add_event_source("watch", fd, watch_event, w))
+    {
+        (*chip->watch)(chip, 0);
+        scp_out_str(out, "ERROR: too many event sources!");
+        return 0;
+    }
+
+    w->chip   = chip;
+    w->number = (int)number;
+    w->mask   = mask;
+    w->fd     = fd;
+    w->seqno  = 0;
+    w->edges  = 0;
+    w->lost   = 0;
+    return 1;
+}
+
+
+/*
+ * Adds the watch command.
+ */
+void scp_add_gpio_watch_commands(void)
+{
+    scp_add_command_ex(
+            "watch",
+            "",
+            "Watch edges on <chip> <mask>",
+            0,
+            2,
+            watch_cmd_func
+            );
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,621 @@
+/**
+ * \file
+ *
+ * \brief Simple command parser - internal definitions.
+ *
+ * Types and functions shared between the modules that make up the parser.
+ * This header is NOT part of the public API and should not be included by
+ * applications - use simple_command_parser.h instead.
+ */
+
+#ifndef SCP_INTERNAL_H_
+#define SCP_INTERNAL_H_
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "simple_command_parser.h"
+
+/*
+ * In a serial terminal, both \r and \n are required, e.g. on the SAML21.
+ *
+ * The C preprocessor concatenates two string literals next to each other,
+ * for example:
+ *      "Hello, World!"NL
+ *
+ * Expands to...
+ *      "Hello, World!""\n"
+ *
+ * Which is concatenated to...
+ *      "Hello, World!\n"
+ */
+#ifdef __SAML21J18A__
+    #define NL "\r\n"
+#else
+    #define NL "\n"
+#endif
+
+/*
+ * The limits below can be overridden at build time, e.g. with
+ * -DMAX_ARGC=4, and default to smaller values in the #SCP_TINY profile.
+ */
+
+/**
+ * Maximum size of the input command string
+ */
+#ifndef MAX_INPUT_BUFFER
+    #ifdef SCP_TINY
+        #define MAX_INPUT_BUFFER    64
+    #else
+        #define MAX_INPUT_BUFFER    128
+    #endif
+#endif
+
+/**
+ * Maximum number of arguments a command can have
+ */
+#ifndef MAX_ARGC
+    #ifdef SCP_TINY
+        #define MAX_ARGC            4
+    #else
+        #define MAX_ARGC            6
+    #endif
+#endif
+
+/**
+ * Size of the output buffer.
+ */
+#ifndef MAX_OUTPUT_BUFFER
+    #ifdef SCP_TINY
+        #define MAX_OUTPUT_BUFFER   64
+    #else
+        #define MAX_OUTPUT_BUFFER   512
+    #endif
+#endif
+
+/**
+ * Number of entries in a dispatch cache, a power of 2.
+ */
+#ifndef DISPATCH_CACHE_SIZE
+    #ifdef SCP_TINY
+        #define DISPATCH_CACHE_SIZE 4
+    #else
+        #define DISPATCH_CACHE_SIZE 16
+    #endif
+#endif
+
+/**
+ * Non-zero to look commands up in a hash table of their names, whose RAM
+ * grows with the number of commands, rather than by searching the command
+ * tables in order.
+ */
+#ifndef SCP_NAME_INDEX
+    #ifdef SCP_TINY
+        #define SCP_NAME_INDEX      0
+    #else
+        #define SCP_NAME_INDEX      1
+    #endif
+#endif
+
+/**
+ * Non-zero to count the responses for scp_metrics.h, with atomic adds.
+ */
+#ifndef SCP_METRICS
+    #ifdef SCP_TINY
+        #define SCP_METRICS         0
+    #else
+        #define SCP_METRICS         1
+    #endif
+#endif
+
+/**
+ * Size of the buffer needed to format an int, including sign and
+ * terminating 0.
+ */
+#define MAX_INT_STR         12
+
+/**
+ * Size of the buffer needed to format a 64 bit integer, including sign and
+ * terminating 0.
+ */
+#define MAX_INT64_STR       21
+
+/**
+ * Characters that separate the command and its arguments on an input line.
+ */
+#define TOKEN_DELIMITERS    " .,"
+
+/**
+ * Storage class of the state of the line being executed, one per thread on
+ * Linux, where lines can be executed by several threads, see scp_batch.h.
+ */
+#ifdef __linux__
+    #define SCP_THREAD_LOCAL    _Thread_local
+#else
+    #define SCP_THREAD_LOCAL
+#endif
+
+/*
+ * strtok_r() is strtok_s() on Windows.
+ */
+#ifdef __MINGW32__
+    #define strtok_r            strtok_s
+#endif
+
+/**
+ * \typedef command_t
+ *
+ * \brief A command, see #scp_command_t.
+ */
+typedef scp_command_t command_t;
+
+/*
+ * Accessors for the fields of command_t, which differ in the #SCP_TINY
+ * profile.
+ */
+#ifdef SCP_TINY
+    #define CMD_HELP(cmd)       ""
+    #define CMD_FUNC(cmd)       ((cmd)->is_ex ? NULL : (cmd)->fn.func)
+    #define CMD_EX_FUNC(cmd)    ((cmd)->is_ex ? (cmd)->fn.ex_func : NULL)
+#else
+    #define CMD_HELP(cmd)       ((cmd)->help_str)       /**< Help. */
+    #define CMD_FUNC(cmd)       ((cmd)->func)           /**< cmd_func_t. */
+    #define CMD_EX_FUNC(cmd)    ((cmd)->ex_func)        /**< cmd_ex_func_t. */
+#endif
+#define CMD_NAME(cmd)           ((cmd)->cmd_str)        /**< Name. */
+#define CMD_ABBR(cmd)           ((cmd)->abbr_str)       /**< Abbreviation. */
+
+/**
+ * \typedef cache_entry_t
+ *
+ * \brief An entry of a dispatch cache.
+ */
+typedef struct {
+    /** Hash of the name, see scp_find_command_cached(). */
+    uint32_t            hash;
+    /** The name or abbreviation of command that was looked up. */
+    const char          *key;
+    /** ID of the command, see scp_lookup_id(). */
+    int                 id;
+    /** The command, NULL if the entry is empty. */
+    const command_t     *command;
+} cache_entry_t;
+
+/**
+ * \typedef dispatch_cache_t
+ *
+ * \brief A direct mapped cache of the commands looked up by a parser.
+ *
+ * The entries belong to one snapshot of the registry, so the cache empties
+ * itself when commands are added or removed.
+ */
+typedef struct {
+    /** Generation of the registry the entries belong to. */
+    unsigned int        generation;
+    /** Lookups found in the cache. */
+    uint32_t            hits;
+    /** Lookups not found in the cache. */
+    uint32_t            misses;
+    /** The entries, indexed by the low bits of the hash. */
+    cache_entry_t       entries[DISPATCH_CACHE_SIZE];
+} dispatch_cache_t;
+
+/**
+ * \struct _scp_ctx_t
+ *
+ * \brief A parser context, see scp_invoke().
+ */
+struct _scp_ctx_t {
+    /** Output of the commands. */
+    scp_out_t           *out;
+    /** Sequence number of the last command invoked. */
+    int                 seq;
+    /** Cache of the commands looked up by name. */
+    dispatch_cache_t    cache;
+    /** Set in the context of a batch job, whose commands run alongside
+     *  those of other jobs, see scp_batch.h. */
+    int                 batch;
+    /** State of the macro commands in the context, see scp_macro.c, or
+     *  NULL. */
+    void                *macro;
+};
+
+/*
+ * Status of a command response, see scp_out_end().
+ */
+#define STATUS_OK           0   /**< Command executed. */
+#define STATUS_TOO_FEW      1   /**< Too few arguments. */
+#define STATUS_TOO_MANY     2   /**< Too many arguments. */
+#define STATUS_UNKNOWN      3   /**< Unknown command. */
+#define STATUS_TOO_LONG     4   /**< Line too long, not executed. */
+#define STATUS_ERROR        5   /**< Line in error, not executed. */
+
+/**
+ * \brief Names of the statuses, indexed by STATUS_ value.
+ */
+extern const char *const scp_status_str[];
+
+/**
+ * Number of buckets of the latency histogram, see #scp_counters_t.
+ */
+#define LATENCY_BUCKETS     14
+
+/**
+ * \typedef scp_counters_t
+ *
+ * \brief Counters of the responses of all the contexts, see scp_metrics.h.
+ *
+ * Updated with relaxed atomic adds as each response ends, and read without
+ * a lock by the metrics exporter.
+ */
+typedef struct {
+    /** Responses, by status. */
+    atomic_ulong        responses[STATUS_ERROR + 1];
+    /** Commands executed, by the bucket of their latency, see
+     *  scp_latency_bounds. */
+    atomic_ulong        latency[LATENCY_BUCKETS];
+    /** Total latency of the commands executed, in microseconds. */
+    atomic_ulong        latency_us;
+    /** Event reports, which are not responses to commands, see
+     *  scp_add_event_source(). */
+    atomic_ulong        events;
+    /** Parse loops running. */
+    atomic_int          sessions;
+} scp_counters_t;
+
+/**
+ * \brief The counters.
+ */
+extern scp_counters_t scp_counters;
+
+/**
+ * \brief Upper bounds of the buckets of the latency histogram, in
+ * microseconds. The last bucket has no bound.
+ */
+extern const unsigned long scp_latency_bounds[LATENCY_BUCKETS - 1];
+
+/**
+ * \struct _scp_out_t
+ *
+ * \brief Output buffer, see scp_output.c
+ */
+struct _scp_out_t {
+    /** Number of characters in buffer. */
+    int                 len;
+    /** Number of values streamed for the current command. */
+    int                 nvalues;
+    /** Output mode, one of the SCP_MODE_ values. */
+    int                 mode;
+    /** Sequence number of the current command. */
+    int                 seq;
+    /** Name of the current command. */
+    const char          *name;
+    /** Time the current command started, in microseconds. */
+    unsigned long       start_us;
+    /** Stream the buffer is written to, or NULL for stdout. */
+    FILE                *file;
+    /** Buffered characters, plus space for a terminating 0. */
+    char                buffer[MAX_OUTPUT_BUFFER + 1];
+};
+
+/**
+ * \brief The output of the parser.
+ */
+extern scp_out_t scp_output;
+
+/*
+ * Values returned by a line hook.
+ */
+#define HOOK_PASS           0   /**< Line not claimed, executed. */
+#define HOOK_CONSUMED       1   /**< Line consumed, without a response. */
+#define HOOK_REFUSED        2   /**< Line refused, with an error response. */
+
+/**
+ * \typedef (*line_hook_t)(scp_out_t *out, command_t *command, int id,
+ *          int argc, char *argv[])
+ *
+ * \brief Hook that can claim a parsed input line before it is executed.
+ *
+ * Called by the parse loop with the response to the line begun on out, the
+ * resolved command, its ID and its arguments. Returns #HOOK_PASS for the
+ * line to be executed, #HOOK_CONSUMED if it has been consumed and
+ * #HOOK_REFUSED if it is in error. The messages the hook output to out are
+ * then ended as a response with the error status.
+ */
+typedef int (*line_hook_t)(scp_out_t *out, command_t *command, int id,
+        int argc, char *argv[]);
+
+/**
+ * \brief Hook installed by an optional module to intercept input lines, or
+ * NULL if no module needs to.
+ */
+extern line_hook_t scp_line_hook;
+
+/**
+ * \typedef (*input_hook_t)(const char *line, int length)
+ *
+ * \brief Hook called by the parse loop with each line of input received,
+ * before it is parsed.
+ */
+typedef void (*input_hook_t)(const char *line, int length);
+
+/**
+ * \brief Hook installed by an optional module that records the input, or
+ * NULL.
+ */
+extern input_hook_t scp_input_hook;
+
+/**
+ * \typedef (*remove_hook_t)(const command_t *command)
+ *
+ * \brief Hook called when a command is removed, see scp_remove_command().
+ *
+ * Lets a module drop its references to the command. The command is not
+ * freed until after the hook returns.
+ */
+typedef void (*remove_hook_t)(const command_t *command);
+
+/**
+ * \brief Hook installed by an optional module that keeps references to
+ * commands, or NULL.
+ */
+extern remove_hook_t scp_remove_hook;
+
+/**
+ * \typedef (*release_hook_t)(scp_ctx_t *ctx)
+ *
+ * \brief Hook called when a context is done with, see
+ * scp_release_context().
+ *
+ * Lets a module free the state it keeps for the context.
+ */
+typedef void (*release_hook_t)(scp_ctx_t *ctx);
+
+/**
+ * \brief Hook installed by an optional module that keeps state per context,
+ * or NULL.
+ */
+extern release_hook_t scp_release_hook;
+
+/**
+ * \brief Prompt to display instead of the normal 'In [n]>' prompt, or NULL.
+ */
+extern const char *scp_prompt_override;
+
+/**
+ * \brief The command currently being executed by this thread, or NULL when
+ * idle.
+ *
+ * Lets a command function that serves several commands (e.g. macros) find
+ * out which command it was invoked as.
+ */
+extern SCP_THREAD_LOCAL command_t *scp_current_command;
+
+/**
+ * \brief Result of the last command executed by this thread, available to
+ * scripts as $_.
+ */
+extern SCP_THREAD_LOCAL int scp_last_result;
+
+/**
+ * \brief The context of the line being executed by this thread, or NULL when
+ * idle.
+ *
+ * Lets a module keep state per context, e.g. the macro being recorded, for
+ * its command functions and line hook.
+ */
+extern SCP_THREAD_LOCAL scp_ctx_t *scp_current_context;
+
+/**
+ * \brief Search for the command matching name.
+ *
+ * Must be called in a read section, see scp_epoch_enter(), and the command
+ * used only until the section is exited. The parse loop runs each line in a
+ * read section, so command functions can use this freely.
+ *
+ * \param   name    Command or abbreviated command name to search for.
+ *
+ * \return  The matching command_t or NULL if the command wasn't found.
+ */
+command_t *scp_find_command(const char *name);
+
+/**
+ * \brief Search for the command matching name, through a dispatch cache.
+ *
+ * As scp_find_command(), but first looks in the cache, which is keyed by a
+ * hash of name. A command found in the registry is cached in place of the
+ * entry with the same low bits of hash.
+ *
+ * \param   cache   The cache, which must only be used by one thread.
+ * \param   name    Command or abbreviated command name to search for.
+ * \param   id      Set to the ID of the command, or -1 if not found.
+ *
+ * \return  The matching command_t or NULL if the command wasn't found.
+ */
+command_t *scp_find_command_cached(dispatch_cache_t *cache, const char *name,
+        int *id);
+
+/**
+ * \brief Returns the command with an ID, see scp_lookup_id().
+ *
+ * Must be called in a read section, as scp_find_command().
+ *
+ * \param   id      The ID.
+ *
+ * \return  The command, or NULL if there is none with the ID.
+ */
+const command_t *scp_command_by_id(int id);
+
+/**
+ * \brief Replaces a command with a new descriptor, with its name, function,
+ * ID and state but new help and argument counts.
+ *
+ * Published commands are never modified, so a command changed at run time,
+ * e.g. a macro recorded again, is replaced with a new snapshot of the
+ * registry. The old descriptor stays valid until no thread can be using it,
+ * see scp_epoch.h, but the caller must drop its references to it.
+ *
+ * \param   command     The command.
+ * \param   help_str    Help string of the new descriptor, which is copied.
+ * \param   min_arg     Minimum number of arguments.
+ * \param   max_arg     Maximum number of arguments.
+ *
+ * \return  The new descriptor, or NULL if command is not in the registry.
+ */
+command_t *scp_replace_command(
+        const command_t *command,
+        const char      *help_str,
+        int             min_arg,
+        int             max_arg
+        );
+
+/**
+ * \brief Executes a line of input, as the parse loop does.
+ *
+ * The line is looked up through the dispatch cache of the context and the
+ * response framed with the next sequence number of the context.
+ *
+ * \param   ctx     The context.
+ * \param   line    The line, which is tokenized in place.
+ *
+ * \return  1 if the line was executed or refused, 0 if it was blank or
+ *          consumed by the line hook, see #line_hook_t.
+ */
+int scp_parse_line(scp_ctx_t *ctx, char *line);
+
+/**
+ * \brief Executes the lines of a script, as the parse loop does, until its
+ * end or the 'end' command.
+ *
+ * Lines are split at newlines. As for typed lines, a line of more than
+ * MAX_INPUT_BUFFER - 1 characters is refused with a line too long response
+ * and none of it executed. The output is flushed at the end.
+ *
+ * \param   ctx     The context.
+ * \param   script  The script.
+ *
+ * \return  The number of lines executed.
+ */
+int scp_parse_script(scp_ctx_t *ctx, const char *script);
+
+/**
+ * \brief Releases the state the modules keep for a context that is done
+ * with, see #release_hook_t.
+ *
+ * \param   ctx     The context.
+ */
+void scp_release_context(scp_ctx_t *ctx);
+
+#ifdef SCP_MEMORY_IO
+/*
+ * In-memory I/O, built instead of the console with -DSCP_MEMORY_IO, e.g. for
+ * the harnesses in fuzz/.
+ */
+
+/**
+ * Size of the output kept by the in-memory I/O, see scp_memory_output().
+ */
+#ifndef SCP_MEMORY_OUTPUT
+    #define SCP_MEMORY_OUTPUT   65536
+#endif
+
+/**
+ * \brief Sets the input of the parse loop and discards the output.
+ *
+ * The parse loop reads the input until its end, then returns.
+ *
+ * \param   input   The input, which must be kept until it is read.
+ * \param   len     Length of the input.
+ */
+void scp_memory_io(const char *input, int len);
+
+/**
+ * \brief Appends to the output, truncated to #SCP_MEMORY_OUTPUT characters.
+ *
+ * \param   data    The characters.
+ * \param   len     Number of characters.
+ */
+void scp_memory_write(const char *data, int len);
+
+/**
+ * \brief Returns the output since scp_memory_io() was called.
+ *
+ * \param   len     Set to the length of the output, if not NULL.
+ *
+ * \return  The output, terminated by a 0.
+ */
+const char *scp_memory_output(int *len);
+#endif /* SCP_MEMORY_IO */
+
+/**
+ * \brief Calls the function of a command.
+ *
+ * The output buffer is flushed first for command functions that do not use
+ * it, so anything they print appears in the right order.
+ *
+ * \param   out     Output for the command.
+ * \param   command The command.
+ * \param   id      ID of the command, which indexes the state it is counted
+ *                  in, see scp_lookup_id().
+ * \param   argc    Count of argv parameters.
+ * \param   argv    The arguments.
+ *
+ * \return  The result of the command function.
+ */
+int scp_call(scp_out_t *out, command_t *command, int id, int argc,
+        char *argv[]);
+
+/**
+ * \brief Returns a free running time in microseconds.
+ *
+ * \return  The time, or 0 if the platform has no clock.
+ */
+unsigned long scp_time_us(void);
+
+/**
+ * \brief Starts the response to a command.
+ *
+ * Nothing is output until the command outputs a value or the response is
+ * ended, so a command function may output text of its own first.
+ *
+ * \param   out     The output.
+ * \param   seq     Sequence number of the command.
+ * \param   name    Name of the command, as entered.
+ */
+void scp_out_begin(scp_out_t *out, int seq, const char *name);
+
+/**
+ * \brief Ends the response to a command, framed for the output mode.
+ *
+ * \param   out     The output.
+ * \param   status  One of the STATUS_ values.
+ * \param   result  The result of the command, or the argument count limit
+ *                  for STATUS_TOO_FEW and STATUS_TOO_MANY.
+ */
+void scp_out_end(scp_out_t *out, int status, int result);
+
+/**
+ * \brief Writes the contents of the output buffer.
+ *
+ * \param   out     The output.
+ */
+void scp_out_flush(scp_out_t *out);
+
+/**
+ * \brief Copies characters to the output buffer.
+ *
+ * \param   out     The output.
+ * \param   data    The characters.
+ * \param   len     Number of characters.
+ */
+void scp_out_write(scp_out_t *out, const char *data, int len);
+
+/**
+ * \brief printf() to the output buffer.
+ *
+ * \param   out     The output.
+ * \param   format  printf() format string.
+ */
+void scp_out_printf(scp_out_t *out, const char *format, ...);
+
+#endif /* SCP_INTERNAL_H_ */
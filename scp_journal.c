@@ -0,0 +1,444 @@
+/**
+ * \file
+ *
+ * \brief Session journal, recorded through the input hook of the parse loop
+ * and replayed with scp_parse_line().
+ *
+ * Linux only. Recording costs a copy of each line into a buffer, written to
+ * the journal when full, so the console is not slowed by a write per line.
+ */
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "scp_internal.h"
+#include "scp_journal.h"
+#include "scp_rt.h"
+
+/**
+ * Magic at the start of a journal.
+ */
+#define JOURNAL_MAGIC       "SCPJ"
+
+/**
+ * Size of the journal header, the magic and version.
+ */
+#define HEADER_SIZE         8
+
+/**
+ * Size of the header of a record, the time, session and length.
+ */
+#define RECORD_SIZE         14
+
+/**
+ * \typedef latencies_t
+ *
+ * \brief The latencies of the lines starting with a name, see
+ * scp_journal_replay().
+ */
+typedef struct {
+    /** The name, as entered. */
+    char                name[MAX_INPUT_BUFFER + 1];
+    /** Latency of each line, in nanoseconds. */
+    uint64_t            *ns;
+    /** Number of latencies. */
+    int                 count;
+    /** Number of latencies ns has space for. */
+    int                 allocated;
+} latencies_t;
+
+/**
+ * \var journal_fd
+ *
+ * The journal being recorded, or -1.
+ */
+static int journal_fd = -1;
+
+/**
+ * \var journal_session
+ *
+ * ID of the session being recorded.
+ */
+static uint32_t journal_session;
+
+/**
+ * \var journal_buffer
+ *
+ * The records not yet written.
+ */
+static unsigned char journal_buffer[SCP_JOURNAL_BUFFER];
+
+/**
+ * \var journal_len
+ *
+ * Number of bytes in journal_buffer.
+ */
+static int journal_len;
+
+
+/**
+ * \brief Stores an unsigned integer, little endian.
+ *
+ * \param   ptr     Where to store it.
+ * \param   value   The integer.
+ * \param   size    Number of bytes to store.
+ */
+static void put_le(unsigned char *ptr, uint64_t value, int size)
+{
+    int idx;
+
+    for (idx=0; idx < size; idx++)
+    {
+        ptr[idx] = (unsigned char)(value >> (8 * idx));
+    }
+}
+
+
+/**
+ * \brief Loads an unsigned integer, little endian.
+ *
+ * \param   ptr     Where it is stored.
+ * \param   size    Number of bytes stored.
+ *
+ * \return  The integer.
+ */
+static uint64_t get_le(const unsigned char *ptr, int size)
+{
+    uint64_t value = 0;
+
+    while (size--)
+    {
+        value = (value << 8) | ptr[size];
+    }
+    return value;
+}
+
+
+/**
+ * \brief Writes all of a buffer to the journal.
+ *
+ * Records that cannot be written are lost rather than stop the console.
+ *
+ * \param   data    The buffer.
+ * \param   len     Number of bytes.
+ */
+static void write_journal(const unsigned char *data, int len)
+{
+    ssize_t written;
+
+    while (len > 0)
+    {
+        if ((written = write(journal_fd, data, len)) <= 0)
+            return;
+        data += written;
+        len  -= (int)written;
+    }
+}
+
+
+/**
+ * \brief Writes the buffered records.
+ */
+static void flush_journal(void)
+{
+    write_journal(journal_buffer, journal_len);
+    journal_len = 0;
+}
+
+
+/**
+ * \brief Input hook - buffers a record of a line.
+ *
+ * \param   line    The line.
+ * \param   length  Length of the line.
+ */
+static void record_line(const char *line, int length)
+{
+    struct timespec now;
+    unsigned char *record;
+
+    if (length > UINT16_MAX)
+        length = UINT16_MAX;
+
+    if (journal_len + RECORD_SIZE + length > SCP_JOURNAL_BUFFER)
+        flush_journal();
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    record = &journal_buffer[journal_len];
+    put_le(record, (uint64_t)now.tv_sec * 1000000u + now.tv_nsec / 1000, 8);
+    put_le(record + 8, journal_session, 4);
+    put_le(record + 12, (uint64_t)length, 2);
+
+    /* A line longer than the buffer is written past it. */
+    if (RECORD_SIZE + length > SCP_JOURNAL_BUFFER)
+    {
+        write_journal(record, RECORD_SIZE);
+        write_journal((const unsigned char *)line, length);
+        return;
+    }
+    memcpy(record + RECORD_SIZE, line, length);
+    journal_len += RECORD_SIZE + length;
+}
+
+
+/*
+ * Starts recording.
+ */
+int scp_journal_open(const char *path, uint32_t session)
+{
+    unsigned char header[HEADER_SIZE];
+    struct stat st;
+
+    assert(path);
+
+    if (journal_fd >= 0)
+        return 0;
+
+    journal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (journal_fd < 0)
+        return 0;
+
+    if (fstat(journal_fd, &st) == 0 && st.st_size == 0)
+    {
+        memcpy(header, JOURNAL_MAGIC, 4);
+        put_le(header + 4, SCP_JOURNAL_VERSION, 4);
+        write_journal(header, HEADER_SIZE);
+    }
+
+    journal_session = session;
+    journal_len     = 0;
+    scp_input_hook  = record_line;
+    return 1;
+}
+
+
+/*
+ * Stops recording.
+ */
+void scp_journal_close(void)
+{
+    if (journal_fd < 0)
+        return;
+
+    scp_input_hook = NULL;
+    flush_journal();
+    close(journal_fd);
+    journal_fd = -1;
+}
+
+
+/**
+ * \brief Finds the latencies of the lines starting with a name, adding them
+ * if there are none yet.
+ *
+ * \param   stats   The latencies of each name.
+ * \param   nstats  Number of names.
+ * \param   name    The name.
+ *
+ * \return  The latencies, or NULL if out of memory.
+ */
+static latencies_t *find_latencies(latencies_t **stats, int *nstats,
+        const char *name)
+{
+    latencies_t *stat;
+    int idx;
+
+    for (idx=0; idx < *nstats; idx++)
+    {
+        if (strcmp((*stats)[idx].name, name) == 0)
+            return &(*stats)[idx];
+    }
+
+    stat = (latencies_t *)realloc(*stats, (*nstats + 1) * sizeof(latencies_t));
+    if (stat == NULL)
+        return NULL;
+    *stats = stat;
+
+    stat = &(*stats)[(*nstats)++];
+    strcpy(stat->name, name);
+    stat->ns        = NULL;
+    stat->count     = 0;
+    stat->allocated = 0;
+    return stat;
+}
+
+
+/**
+ * \brief Orders latencies, for qsort().
+ *
+ * \param   a       A latency.
+ * \param   b       A latency.
+ *
+ * \return  <0, 0 or >0 as a is less than, equal to or more than b.
+ */
+static int compare_ns(const void *a, const void *b)
+{
+    uint64_t ns_a = *(const uint64_t *)a;
+    uint64_t ns_b = *(const uint64_t *)b;
+
+    return (ns_a > ns_b) - (ns_a < ns_b);
+}
+
+
+/**
+ * \brief Returns a percentile of sorted latencies, by nearest rank.
+ *
+ * \param   stat    The latencies, sorted.
+ * \param   pc      The percentile.
+ *
+ * \return  The latency, in microseconds.
+ */
+static double percentile_us(const latencies_t *stat, int pc)
+{
+    int rank = (int)(((int64_t)pc * stat->count + 99) / 100);
+
+    return stat->ns[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+
+/**
+ * \brief Reports the throughput and latencies of a replay on stderr, then
+ * frees the latencies.
+ *
+ * \param   stats   The latencies of each name.
+ * \param   nstats  Number of names.
+ * \param   lines   Number of lines replayed.
+ * \param   ns      Time the replay took.
+ */
+static void report(latencies_t *stats, int nstats, int lines, uint64_t ns)
+{
+    latencies_t *stat;
+    int idx;
+
+    fprintf(stderr, "%d lines in %.3f s, %.0f lines/s\n", lines, ns / 1e9,
+            ns ? lines * 1e9 / ns : 0.0);
+    fprintf(stderr, "%-11s  %8s  %9s  %9s  %9s  %9s\n",
+            "COMMAND", "COUNT", "P50 us", "P90 us", "P99 us", "MAX us");
+
+    for (idx=0; idx < nstats; idx++)
+    {
+        stat = &stats[idx];
+        if (stat->count)
+        {
+            qsort(stat->ns, stat->count, sizeof(uint64_t), compare_ns);
+            fprintf(stderr, "%-11s  %8d  %9.1f  %9.1f  %9.1f  %9.1f\n",
+                    stat->name, stat->count,
+                    percentile_us(stat, 50), percentile_us(stat, 90),
+                    percentile_us(stat, 99),
+                    stat->ns[stat->count - 1] / 1000.0);
+        }
+        free(stat->ns);
+    }
+    free(stats);
+}
+
+
+/*
+ * Replays a journal.
+ */
+int scp_journal_replay(const char *path, uint32_t session, double speed)
+{
+    unsigned char record[RECORD_SIZE];
+    char line[MAX_INPUT_BUFFER + 1];
+    char name[MAX_INPUT_BUFFER + 1];
+    scp_ctx_t *ctx = scp_get_context();
+    latencies_t *stats = NULL;
+    latencies_t *stat;
+    uint64_t first_us = 0;
+    uint64_t start;
+    uint64_t time_us;
+    uint64_t begin;
+    uint64_t ns;
+    int nstats = 0;
+    int lines = 0;
+    int length;
+    int skip;
+    char *ptr;
+    FILE *file;
+
+    assert(path);
+    assert(speed >= 0);
+
+    if ((file = fopen(path, "rb")) == NULL)
+        return -1;
+
+    if (fread(record, 1, HEADER_SIZE, file) != HEADER_SIZE ||
+            memcmp(record, JOURNAL_MAGIC, 4) != 0 ||
+            get_le(record + 4, 4) != SCP_JOURNAL_VERSION)
+    {
+        fclose(file);
+        return -1;
+    }
+
+    start = scp_rt_now_ns();
+
+    /* A record cut short, e.g. by a crash while recording, ends the replay. */
+    while (fread(record, 1, RECORD_SIZE, file) == RECORD_SIZE)
+    {
+        time_us = get_le(record, 8);
+        length  = (int)get_le(record + 12, 2);
+
+        /* The parser refuses a line too long for its buffer, e.g. one
+         * recorded by a build with a larger one, so none of it is replayed.
+         */
+        if (length > MAX_INPUT_BUFFER - 1)
+        {
+            if (fseek(file, length, SEEK_CUR) != 0)
+                break;
+            continue;
+        }
+        if (fread(line, 1, length, file) != (size_t)length)
+            break;
+        line[length] = '\0';
+
+        if (length == 0 ||
+                (session && get_le(record + 8, 4) != session))
+            continue;
+
+        if (lines == 0)
+            first_us = time_us;
+        if (speed > 0 && time_us > first_us)
+            scp_rt_wait_until(start +
+                    (uint64_t)((time_us - first_us) * 1000 / speed));
+
+        /* Parsing tokenizes the line, so find its name first. */
+        ptr = line + strspn(line, TOKEN_DELIMITERS);
+        skip = (int)strcspn(ptr, TOKEN_DELIMITERS);
+        memcpy(name, ptr, skip);
+        name[skip] = '\0';
+        if ((stat = find_latencies(&stats, &nstats, name)) == NULL)
+            break;
+
+        begin = scp_rt_now_ns();
+        scp_parse_line(ctx, line);
+        scp_out_flush(ctx->out);
+        ns = scp_rt_now_ns() - begin;
+
+        if (stat->count == stat->allocated)
+        {
+            uint64_t *grown = (uint64_t *)realloc(stat->ns,
+                    (stat->allocated * 2 + 16) * sizeof(uint64_t));
+
+            if (grown == NULL)
+                break;
+            stat->ns        = grown;
+            stat->allocated = stat->allocated * 2 + 16;
+        }
+        stat->ns[stat->count++] = ns;
+        lines++;
+    }
+    fclose(file);
+
+    report(stats, nstats, lines, scp_rt_now_ns() - start);
+    return lines;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,78 @@
+/**
+ * \file
+ *
+ * \brief Session journal for the Simple Command Parser, to record the input
+ * of a console and replay it later, e.g. as a performance regression test.
+ *
+ * Linux only. The journal is a binary file: a header of the magic "SCPJ"
+ * and a 32 bit version, then a record per line of input,
+ *
+ * | Field    | Size | Description                                       |
+ * |----------|------|---------------------------------------------------|
+ * | time     | 8    | CLOCK_REALTIME the line was received, in us.      |
+ * | session  | 4    | ID of the session, see scp_journal_open().        |
+ * | length   | 2    | Length of the line.                               |
+ * | line     | n    | The line, without a terminating 0.                |
+ *
+ * all little endian. Journals are appended to, so one file can hold many
+ * sessions.
+ */
+
+#ifndef SCP_JOURNAL_H_
+#define SCP_JOURNAL_H_
+
+#include <stdint.h>
+
+/**
+ * Size of the buffer the records are written through.
+ */
+#ifndef SCP_JOURNAL_BUFFER
+    #define SCP_JOURNAL_BUFFER  4096
+#endif
+
+/**
+ * Version of the journal format.
+ */
+#define SCP_JOURNAL_VERSION 1
+
+/**
+ * \brief Starts recording the lines input to scp_parse().
+ *
+ * Records are buffered, so the last are only written by
+ * scp_journal_close().
+ *
+ * \param   path    The journal, created or appended to.
+ * \param   session ID of the session recorded, e.g. the process ID.
+ *
+ * \return  1 on success, 0 if the journal cannot be opened or another is
+ *          already open.
+ */
+int scp_journal_open(const char *path, uint32_t session);
+
+/**
+ * \brief Writes the buffered records and stops recording.
+ */
+void scp_journal_close(void);
+
+/**
+ * \brief Replays a journal through the parser, then reports the throughput
+ * and the latency of each command on stderr.
+ *
+ * The lines are executed as by the parse loop, with the commands that are
+ * registered when it is called, and the output of the commands goes to the
+ * output of the parser. The latency of a line is the time to parse, execute
+ * and output it, and is reported by the name it starts with, as the 50th,
+ * 90th and 99th percentiles and the maximum.
+ *
+ * \param   path    The journal.
+ * \param   session ID of the session to replay, or 0 for all of them.
+ * \param   speed   Multiple of the original speed the lines are replayed
+ *                  at, e.g. 1 for the original speed, or 0 for as fast as
+ *                  possible.
+ *
+ * \return  The number of lines replayed, or -1 if the journal cannot be
+ *          read.
+ */
+int scp_journal_replay(const char *path, uint32_t session, double speed);
+
+#endif /* SCP_JOURNAL_H_ */
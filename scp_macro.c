@@ -0,0 +1,1441 @@
+/**
+ * \file
+ *
+ * \brief Simple command parser - macros, variables and script blocks.
+ *
+ * A macro is a sequence of commands recorded once and replayed by name. Lines
+ * are compiled as they are recorded into a compact program of steps: the
+ * command_t of every call is resolved, its arguments are tokenized and
+ * variable names are resolved to slots in the variable table. Replaying a
+ * macro therefore calls the command functions directly without searching the
+ * command list or tokenizing any input.
+ *
+ * Programs support:
+ * - $1 to $6, replaced by the arguments the macro is invoked with.
+ * - $_, the result of the last command executed.
+ * - $name, a variable assigned with 'set name value'.
+ * - 'repeat n {' ... '}' loops.
+ * - 'if a [op b] {' ... '}' conditionals, where op is one of
+ *   == != < > <= >=.
+ *
+ * A repeat or if block typed at the prompt is compiled in the same way and
+ * run as soon as its closing '}' is entered.
+ *
+ * The macros are shared by all the contexts, but the program being recorded,
+ * the depth of the macro calls and the values of the variables are kept per
+ * context, see scp_current_context, so batch jobs do not share them. Only
+ * the names of the variables are shared, so a macro refers to the same
+ * variables whichever context runs it.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "scp_internal.h"
+
+/**
+ * Maximum number of steps in one macro.
+ */
+#define MAX_MACRO_STEPS     16
+
+/**
+ * Size of the buffer holding the argument strings of all steps of a macro.
+ */
+#define MAX_MACRO_TEXT      256
+
+/**
+ * Maximum depth of macros calling other macros.
+ */
+#define MAX_MACRO_DEPTH     4
+
+/**
+ * Maximum depth of nested repeat and if blocks.
+ */
+#define MAX_BLOCK_DEPTH     4
+
+/**
+ * Maximum number of variables.
+ */
+#define MAX_VARS            16
+
+/**
+ * The maximum variable name length including terminating 0.
+ */
+#define MAX_VAR_NAME        9
+
+/**
+ * Maximum length of an error message, including terminating 0.
+ */
+#define MAX_ERROR_STR       80
+
+/*
+ * Step opcodes.
+ */
+#define OP_CALL     0   /**< Call cmd with the args, result goes in $_. */
+#define OP_SET      1   /**< Set variable var to arg[0]. */
+#define OP_REPEAT   2   /**< Loop arg[0] times, else jump past the loop. */
+#define OP_LOOP     3   /**< End of a loop body, jump back to its start. */
+#define OP_IF       4   /**< Jump past the block unless arg[0] cmp arg[1]. */
+
+/*
+ * Operand kinds.
+ */
+#define ARG_TEXT    0   /**< String at offset text in the macro text. */
+#define ARG_INT     1   /**< Integer value. */
+#define ARG_PARAM   2   /**< Macro parameter $index. */
+#define ARG_VAR     3   /**< Variable slot index. */
+#define ARG_LAST    4   /**< Result of the last command, $_. */
+
+/*
+ * Comparisons for OP_IF.
+ */
+#define CMP_TRUE    0   /**< arg[0] is non zero. */
+#define CMP_EQ      1   /**< == */
+#define CMP_NE      2   /**< != */
+#define CMP_LT      3   /**< < */
+#define CMP_GT      4   /**< > */
+#define CMP_LE      5   /**< <= */
+#define CMP_GE      6   /**< >= */
+
+/**
+ * \typedef operand_t
+ *
+ * \brief A pre-resolved step argument.
+ */
+typedef struct {
+    /** One of the ARG_ kinds. */
+    unsigned char       kind;
+    /** Parameter number or variable slot. */
+    unsigned char       index;
+    /** Offset of the string in the macro text for ARG_TEXT. */
+    unsigned short      text;
+    /** Value for ARG_INT. */
+    int                 value;
+} operand_t;
+
+/**
+ * \typedef macro_step_t
+ *
+ * \brief A single compiled step of a macro.
+ */
+typedef struct {
+    /** One of the OP_ codes. */
+    unsigned char       op;
+    /** Number of arguments. */
+    unsigned char       argc;
+    /** Comparison for OP_IF. */
+    unsigned char       cmp;
+    /** Variable slot for OP_SET. */
+    unsigned char       var;
+    /** Step to jump to for OP_REPEAT, OP_LOOP and OP_IF. */
+    unsigned char       jump;
+    /** The command to call for OP_CALL. */
+    command_t           *cmd;
+    /** ID of cmd, see scp_lookup_id(). */
+    int                 id;
+    /** The arguments. */
+    operand_t           arg[MAX_ARGC];
+} macro_step_t;
+
+/**
+ * \typedef macro_t
+ *
+ * \brief Typedef of the _macro_t struct.
+ */
+typedef struct _macro_t macro_t;
+
+/**
+ * \struct _macro_t
+ *
+ * \brief A recorded macro.
+ */
+struct _macro_t {
+    /** Macro name, which is also its command name. */
+    char                name[MAX_CMD_STR];
+    /** Help string of the macro command as first registered. Later help
+     *  strings are copied by scp_replace_command(). */
+    char                help[MAX_HELP_STR];
+    /** The command registered for this macro, NULL until first recorded. */
+    command_t           *command;
+    /** Number of parameters, i.e. the highest $n used by the steps. */
+    int                 nparams;
+    /** Number of steps. */
+    int                 nsteps;
+    /** The steps. */
+    macro_step_t        step[MAX_MACRO_STEPS];
+    /** Number of characters used in text. */
+    int                 text_len;
+    /** Argument strings of all steps. */
+    char                text[MAX_MACRO_TEXT];
+    /** Next macro_t node */
+    macro_t             *next;
+};
+
+/**
+ * \typedef session_t
+ *
+ * \brief State of the macro commands in a context.
+ */
+typedef struct {
+    /** Unnamed program for a block typed at the prompt. */
+    macro_t             immediate;
+    /** Macro being recorded by 'def', &immediate, or NULL. */
+    macro_t             *recording;
+    /** Steps of the OP_REPEAT and OP_IF blocks still open while recording. */
+    int                 open_block[MAX_BLOCK_DEPTH];
+    /** Number of entries in open_block. */
+    int                 nopen;
+    /** Current depth of nested macro calls. */
+    int                 depth;
+    /** Prompt displayed while a macro is being recorded. */
+    char                prompt[MAX_CMD_STR + 8];
+    /** Variables of the context, a bit per slot of var_name. */
+    uint32_t            defined;
+    /** Values of the variables. */
+    int                 var_value[MAX_VARS];
+    /** Buffers for variable values substituted into a line typed at the
+     *  prompt. */
+    char                subst[MAX_ARGC][MAX_INT_STR];
+} session_t;
+
+/**
+ * \var macro_list
+ *
+ * List of all defined macros.
+ */
+static macro_t *macro_list;
+
+/**
+ * \var var_name
+ *
+ * Names of the variables of all the contexts, which are only ever added.
+ */
+static char var_name[MAX_VARS][MAX_VAR_NAME];
+
+/**
+ * \var nvars
+ *
+ * Number of names in var_name, incremented once the name is written.
+ */
+static atomic_int nvars;
+
+/**
+ * \var var_lock
+ *
+ * Held to add a name to var_name, as contexts on other threads may add
+ * names at the same time.
+ */
+static atomic_flag var_lock = ATOMIC_FLAG_INIT;
+
+static int end_macro_cmd_func(scp_out_t *out, int argc, char *argv[]);
+static int close_cmd_func(scp_out_t *out, int argc, char *argv[]);
+static int repeat_cmd_func(int argc, char *argv[]);
+static int if_cmd_func(int argc, char *argv[]);
+static int set_cmd_func(scp_out_t *out, int argc, char *argv[]);
+static int def_cmd_func(scp_out_t *out, int argc, char *argv[]);
+
+
+/**
+ * \brief Outputs an error message as a value of the response.
+ *
+ * \param   out     The output.
+ * \param   format  printf() format of the message, which is truncated to
+ *                  #MAX_ERROR_STR - 1 characters.
+ */
+static void out_error(scp_out_t *out, const char *format, ...)
+{
+    char message[MAX_ERROR_STR];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    scp_out_str(out, message);
+}
+
+
+/**
+ * \brief Refuses to define a macro in a batch job, as the macros are shared
+ * by all the contexts.
+ *
+ * \param   out     Output for the error.
+ *
+ * \return  1 if the definition must be refused, otherwise 0.
+ */
+static int refuse_in_batch(scp_out_t *out)
+{
+    if (!scp_current_context->batch)
+        return 0;
+
+    scp_out_str(out, "ERROR: not allowed in a batch job!");
+    return 1;
+}
+
+
+/**
+ * \brief Search for the macro with the given name.
+ *
+ * \param   name    Macro name.
+ *
+ * \return  The macro or NULL if there is no macro with that name.
+ */
+static macro_t *find_macro(const char *name)
+{
+    macro_t *macro;
+
+    for (macro=macro_list; macro; macro=macro->next)
+    {
+        if (strcmp(name, macro->name) == 0)
+            return macro;
+    }
+    return NULL;
+}
+
+
+/**
+ * \brief Returns the state of the macro commands in the current context,
+ * creating it on first use.
+ *
+ * \return  The state.
+ */
+static session_t *get_session(void)
+{
+    scp_ctx_t *ctx = scp_current_context;
+
+    assert(ctx);
+
+    if (ctx->macro == NULL)
+    {
+        ctx->macro = calloc(1, sizeof(session_t));
+        assert(ctx->macro);
+    }
+    return (session_t *)ctx->macro;
+}
+
+
+/**
+ * \brief Adds a variable name.
+ *
+ * \param   name    Variable name, which is valid.
+ * \param   seen    Number of names already searched.
+ *
+ * \return  The slot of the name, which may have been added meanwhile by
+ *          another context, or -1 if there is no free slot.
+ */
+static int add_var(const char *name, int seen)
+{
+    int count;
+    int slot;
+
+    while (atomic_flag_test_and_set_explicit(&var_lock, memory_order_acquire))
+        ;
+
+    count = atomic_load_explicit(&nvars, memory_order_relaxed);
+    for (slot=seen; slot < count; slot++)
+    {
+        if (strcmp(name, var_name[slot]) == 0)
+            break;
+    }
+    if (slot == count)
+    {
+        if (count < MAX_VARS)
+        {
+            strcpy(var_name[slot], name);
+            atomic_store_explicit(&nvars, count + 1, memory_order_release);
+        }
+        else
+        {
+            slot = -1;
+        }
+    }
+
+    atomic_flag_clear_explicit(&var_lock, memory_order_release);
+    return slot;
+}
+
+
+/**
+ * \brief Search for a variable slot.
+ *
+ * A name is a variable of a context once it has been assigned or compiled
+ * in the context.
+ *
+ * \param   session The state of the context.
+ * \param   name    Variable name, without the leading $.
+ * \param   create  If non-zero, the name is made a variable of the context,
+ *                  with the value 0, when it is not one.
+ *
+ * \return  The slot index or -1 if not found or there is no free slot.
+ */
+static int find_var(session_t *session, const char *name, int create)
+{
+    int count = atomic_load_explicit(&nvars, memory_order_acquire);
+    int slot;
+
+    for (slot=0; slot < count; slot++)
+    {
+        if (strcmp(name, var_name[slot]) == 0)
+            break;
+    }
+
+    if (slot == count)
+    {
+        if (!create || !isalpha((unsigned char)name[0]) ||
+                strlen(name) >= MAX_VAR_NAME)
+            return -1;
+        if ((slot = add_var(name, count)) < 0)
+            return -1;
+    }
+
+    if (!(session->defined & (1u << slot)))
+    {
+        if (!create)
+            return -1;
+        session->defined |= 1u << slot;
+        session->var_value[slot] = 0;
+    }
+    return slot;
+}
+
+
+/**
+ * \brief Evaluates an operand as an integer.
+ *
+ * \param   session The state of the context running the program.
+ * \param   macro   The program the operand belongs to.
+ * \param   opd     The operand.
+ * \param   params  Macro parameters.
+ *
+ * \return  The value.
+ */
+static int arg_value(session_t *session, macro_t *macro, operand_t *opd,
+        char *params[])
+{
+    switch (opd->kind)
+    {
+    case ARG_INT:   return opd->value;
+    case ARG_PARAM: return atoi(params[opd->index - 1]);
+    case ARG_VAR:   return session->var_value[opd->index];
+    case ARG_LAST:  return scp_last_result;
+    default:        return atoi(&macro->text[opd->text]);
+    }
+}
+
+
+/**
+ * \brief Evaluates an operand as a string for a command argument.
+ *
+ * \param   session The state of the context running the program.
+ * \param   macro   The program the operand belongs to.
+ * \param   opd     The operand.
+ * \param   params  Macro parameters.
+ * \param   buffer  Buffer for formatting integer values.
+ *
+ * \return  The argument string.
+ */
+static char *arg_string(
+        session_t   *session,
+        macro_t     *macro,
+        operand_t   *opd,
+        char        *params[],
+        char        *buffer
+        )
+{
+    switch (opd->kind)
+    {
+    case ARG_TEXT:  return &macro->text[opd->text];
+    case ARG_PARAM: return params[opd->index - 1];
+    default:
+        sprintf(buffer, "%d", arg_value(session, macro, opd, params));
+        return buffer;
+    }
+}
+
+
+/**
+ * \brief Runs a compiled program.
+ *
+ * \param   out     Output for the commands called.
+ * \param   session The state of the context running the program.
+ * \param   macro   The program.
+ * \param   params  Values for the parameters $1 to $n.
+ *
+ * \return  The value of $_ when the program finishes.
+ */
+static int run_program(scp_out_t *out, session_t *session, macro_t *macro,
+        char *params[])
+{
+    char *args[MAX_ARGC];
+    char numbuf[MAX_ARGC][MAX_INT_STR];
+    int count[MAX_BLOCK_DEPTH];
+    int nloop = 0;
+    int pc = 0;
+    int arg;
+
+    while (pc < macro->nsteps)
+    {
+        macro_step_t *step = &macro->step[pc++];
+
+        switch (step->op)
+        {
+        case OP_CALL:
+            if (step->cmd == NULL)
+            {
+                scp_out_str(out, "ERROR: command was removed!");
+                scp_last_result = 0;
+                break;
+            }
+            /* The command may have been replaced with other argument
+             * counts since the step was compiled, see end_macro().
+             */
+            if (step->argc < step->cmd->min_arg ||
+                    step->argc > step->cmd->max_arg)
+            {
+                out_error(out, "ERROR: [%s] expects %d to %d args!",
+                        CMD_NAME(step->cmd),
+                        step->cmd->min_arg,
+                        step->cmd->max_arg
+                      );
+                scp_last_result = 0;
+                break;
+            }
+            for (arg=0; arg < step->argc; arg++)
+            {
+                args[arg] = arg_string(session, macro, &step->arg[arg],
+                        params, numbuf[arg]);
+            }
+            scp_current_command = step->cmd;
+            scp_last_result = scp_call(out, step->cmd, step->id, step->argc,
+                    args);
+            break;
+
+        case OP_SET:
+            session->var_value[step->var] = arg_value(session, macro,
+                    &step->arg[0], params);
+            session->defined |= 1u << step->var;
+            scp_last_result = session->var_value[step->var];
+            break;
+
+        case OP_REPEAT:
+            count[nloop] = arg_value(session, macro, &step->arg[0], params);
+            if (count[nloop] > 0)
+                nloop++;
+            else
+                pc = step->jump;
+            break;
+
+        case OP_LOOP:
+            if (--count[nloop - 1] > 0)
+                pc = step->jump;
+            else
+                nloop--;
+            break;
+
+        case OP_IF:
+        {
+            int a = arg_value(session, macro, &step->arg[0], params);
+            int b = step->cmp != CMP_TRUE ?
+                arg_value(session, macro, &step->arg[1], params) : 0;
+            int taken;
+
+            switch (step->cmp)
+            {
+            case CMP_EQ:    taken = a == b; break;
+            case CMP_NE:    taken = a != b; break;
+            case CMP_LT:    taken = a <  b; break;
+            case CMP_GT:    taken = a >  b; break;
+            case CMP_LE:    taken = a <= b; break;
+            case CMP_GE:    taken = a >= b; break;
+            default:        taken = a != 0; break;
+            }
+            if (!taken)
+                pc = step->jump;
+            break;
+        }
+        }
+    }
+
+    return scp_last_result;
+}
+
+
+/**
+ * \brief Executes a macro.
+ *
+ * Called for every macro command. The macro to replay is the one registered
+ * for the command currently being executed.
+ *
+ * \param   out     Output for the commands called.
+ * \param   argc    Count of argv parameters.
+ * \param   argv    Values for the macro parameters $1 to $argc.
+ *
+ * \returns         The result of the last step, or 0 on error.
+ */
+static int macro_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    command_t *self = scp_current_command;
+    session_t *session = get_session();
+    macro_t *macro;
+    int result;
+
+    /* self may be a descriptor since replaced, see end_macro(). */
+    macro = find_macro(CMD_NAME(self));
+    assert(macro);
+
+    if (session->depth >= MAX_MACRO_DEPTH)
+    {
+        scp_out_str(out, "ERROR: macros nested too deep!");
+        return 0;
+    }
+    /* A step of another macro may call this one with the arguments it was
+     * compiled with, before the macro was recorded with more parameters.
+     */
+    if (argc < macro->nparams)
+    {
+        out_error(out, "ERROR: [%s] too few args (less than %d)!",
+                macro->name, macro->nparams);
+        return 0;
+    }
+
+    ++session->depth;
+    result = run_program(out, session, macro, argv);
+    scp_current_command = self;
+    --session->depth;
+
+    return result;
+}
+
+
+/**
+ * \brief Starts recording a program.
+ *
+ * Only the parse loop displays the prompt.
+ *
+ * \param   session The state of the context.
+ * \param   macro   The program to record into. Its steps are discarded.
+ * \param   name    Name to display in the prompt.
+ */
+static void begin_program(session_t *session, macro_t *macro,
+        const char *name)
+{
+    macro->nparams  = 0;
+    macro->nsteps   = 0;
+    macro->text_len = 0;
+    session->nopen  = 0;
+
+    session->recording = macro;
+
+    sprintf(session->prompt, "Def[%s]", name);
+    if (scp_current_context == scp_get_context())
+        scp_prompt_override = session->prompt;
+}
+
+
+/**
+ * \brief Stops recording.
+ *
+ * \param   session The state of the context.
+ */
+static void end_program(session_t *session)
+{
+    session->recording = NULL;
+    if (scp_current_context == scp_get_context())
+        scp_prompt_override = NULL;
+}
+
+
+/**
+ * \brief Starts recording a new macro.
+ *
+ * Creates the macro if it does not exist yet, otherwise discards its steps so
+ * it can be redefined.
+ *
+ * \param   out     Output for the errors.
+ * \param   session The state of the context.
+ * \param   name    Macro name.
+ *
+ * \return  The macro to record into, or NULL if name cannot be used.
+ */
+static macro_t *begin_macro(scp_out_t *out, session_t *session,
+        const char *name)
+{
+    macro_t *macro;
+
+    if (session->recording)
+    {
+        out_error(out,
+                "ERROR: already recording [%s]!",
+                session->recording->name);
+        return NULL;
+    }
+    if (strlen(name) >= MAX_CMD_STR)
+    {
+        out_error(out, "ERROR: [%s] name too long!", name);
+        return NULL;
+    }
+
+    if ((macro = find_macro(name)) == NULL)
+    {
+        if (scp_find_command(name))
+        {
+            out_error(out, "ERROR: [%s] is not a macro!", name);
+            return NULL;
+        }
+
+        macro = (macro_t *)calloc(1, sizeof(macro_t));
+        assert(macro);
+
+        strcpy(macro->name, name);
+        macro->next = macro_list;
+        macro_list = macro;
+    }
+
+    begin_program(session, macro, name);
+    return macro;
+}
+
+
+/**
+ * \brief Compiles a token into an operand.
+ *
+ * \param   out     Output for the errors.
+ * \param   session The state of the context.
+ * \param   token   The token.
+ * \param   opd     The operand to fill in.
+ * \param   numeric Non-zero if the operand is used as an integer, otherwise
+ *                  it is a command argument string.
+ *
+ * \return  1 on success or 0 on error.
+ */
+static int compile_operand(scp_out_t *out, session_t *session,
+        const char *token, operand_t *opd, int numeric)
+{
+    macro_t *macro = session->recording;
+    int len;
+
+    if (token[0] == '$')
+    {
+        int slot;
+
+        /* $1 to $6 refer to the macro parameters. */
+        if (token[1] >= '1' && token[1] < '1' + MAX_ARGC && token[2] == '\0')
+        {
+            if (macro == &session->immediate)
+            {
+                out_error(out,
+                        "ERROR: [%s] is only valid in a macro!",
+                        token);
+                return 0;
+            }
+            opd->kind  = ARG_PARAM;
+            opd->index = (unsigned char)(token[1] - '0');
+            if (opd->index > macro->nparams)
+                macro->nparams = opd->index;
+            return 1;
+        }
+        if (strcmp(token, "$_") == 0)
+        {
+            opd->kind = ARG_LAST;
+            return 1;
+        }
+        if ((slot = find_var(session, &token[1], 1)) < 0)
+        {
+            out_error(out, "ERROR: [%s] bad variable!", token);
+            return 0;
+        }
+        opd->kind  = ARG_VAR;
+        opd->index = (unsigned char)slot;
+        return 1;
+    }
+
+    if (numeric)
+    {
+        opd->kind  = ARG_INT;
+        opd->value = (int)strtol(token, NULL, 0);
+        return 1;
+    }
+
+    len = (int)strlen(token) + 1;
+    if (macro->text_len + len > MAX_MACRO_TEXT)
+    {
+        out_error(out, "ERROR: out of space for arguments!");
+        return 0;
+    }
+    opd->kind = ARG_TEXT;
+    opd->text = (unsigned short)macro->text_len;
+    memcpy(&macro->text[macro->text_len], token, len);
+    macro->text_len += len;
+    return 1;
+}
+
+
+/**
+ * \brief Checks a block opening line ends with '{'.
+ *
+ * \param   out         Output for the errors.
+ * \param   session     The state of the context.
+ * \param   command     The command for the line.
+ * \param   argc        Count of argv parameters.
+ * \param   argv        The arguments.
+ *
+ * \return  1 if it does, otherwise 0.
+ */
+static int check_open(scp_out_t *out, session_t *session, command_t *command,
+        int argc, char *argv[])
+{
+    if (argc == 0 || strcmp(argv[argc - 1], "{") != 0)
+    {
+        out_error(out,
+                "ERROR: [%s] expects { at end of line!",
+                CMD_NAME(command));
+        return 0;
+    }
+    if (session->nopen >= MAX_BLOCK_DEPTH)
+    {
+        out_error(out,
+                "ERROR: [%s] blocks nested too deep!",
+                CMD_NAME(command));
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * \brief Compiles a line into a step of the program being recorded.
+ *
+ * \param   out         Output for the errors.
+ * \param   session     The state of the context.
+ * \param   command     The command for the line.
+ * \param   id          ID of the command.
+ * \param   argc        Count of argv parameters.
+ * \param   argv        The arguments.
+ *
+ * \return  1 if the line was compiled or 0 on error.
+ */
+static int compile_line(scp_out_t *out, session_t *session,
+        command_t *command, int id, int argc, char *argv[])
+{
+    macro_t *macro = session->recording;
+    int *open_block = session->open_block;
+    macro_step_t *step;
+    int idx;
+
+    if (macro->nsteps >= MAX_MACRO_STEPS)
+    {
+        out_error(out,
+                "ERROR: [%s] too many steps (more than %d)!",
+                macro->name,
+                MAX_MACRO_STEPS
+              );
+        return 0;
+    }
+    if (argc < command->min_arg || argc > command->max_arg)
+    {
+        out_error(out, "ERROR: [%s] expects %d to %d args!",
+                CMD_NAME(command),
+                command->min_arg,
+                command->max_arg
+              );
+        return 0;
+    }
+
+    step = &macro->step[macro->nsteps];
+    memset(step, 0, sizeof(*step));
+
+    if (CMD_EX_FUNC(command) == close_cmd_func)
+    {
+        macro_step_t *open;
+
+        if (session->nopen == 0)
+        {
+            out_error(out, "ERROR: } without a block!");
+            return 0;
+        }
+        open = &macro->step[open_block[--session->nopen]];
+
+        if (open->op == OP_REPEAT)
+        {
+            step->op   = OP_LOOP;
+            step->jump = (unsigned char)(open_block[session->nopen] + 1);
+            macro->nsteps++;
+        }
+        open->jump = (unsigned char)macro->nsteps;
+        return 1;
+    }
+    else if (CMD_FUNC(command) == repeat_cmd_func)
+    {
+        if (!check_open(out, session, command, argc, argv) ||
+                !compile_operand(out, session, argv[0], &step->arg[0], 1))
+            return 0;
+        step->op = OP_REPEAT;
+        open_block[session->nopen++] = macro->nsteps;
+    }
+    else if (CMD_FUNC(command) == if_cmd_func)
+    {
+        static const char *cmp_str[] = {"", "==", "!=", "<", ">", "<=", ">="};
+
+        if (!check_open(out, session, command, argc, argv) ||
+                !compile_operand(out, session, argv[0], &step->arg[0], 1))
+            return 0;
+
+        if (argc == 4)
+        {
+            for (idx=CMP_EQ; idx <= CMP_GE; idx++)
+            {
+                if (strcmp(argv[1], cmp_str[idx]) == 0)
+                    step->cmp = (unsigned char)idx;
+            }
+            if (step->cmp == CMP_TRUE)
+            {
+                out_error(out,
+                        "ERROR: [%s] bad comparison!",
+                        argv[1]);
+                return 0;
+            }
+            if (!compile_operand(out, session, argv[2], &step->arg[1], 1))
+                return 0;
+        }
+        else if (argc != 2)
+        {
+            out_error(out,
+                    "ERROR: [if] expects <a> [<op> <b>] {");
+            return 0;
+        }
+        step->op = OP_IF;
+        open_block[session->nopen++] = macro->nsteps;
+    }
+    else if (CMD_EX_FUNC(command) == set_cmd_func)
+    {
+        int slot = find_var(session, argv[0], 1);
+
+        if (slot < 0)
+        {
+            out_error(out,
+                    "ERROR: [%s] bad variable!",
+                    argv[0]);
+            return 0;
+        }
+        if (!compile_operand(out, session, argv[1], &step->arg[0], 1))
+            return 0;
+        step->op  = OP_SET;
+        step->var = (unsigned char)slot;
+    }
+    else if (CMD_EX_FUNC(command) == def_cmd_func)
+    {
+        out_error(out,
+                "ERROR: [def] cannot be used inside a block!");
+        return 0;
+    }
+    else
+    {
+        step->op   = OP_CALL;
+        step->cmd  = command;
+        step->id   = id;
+        step->argc = (unsigned char)argc;
+
+        for (idx=0; idx < argc; idx++)
+        {
+            if (!compile_operand(out, session, argv[idx], &step->arg[idx],
+                        0))
+                return 0;
+        }
+    }
+
+    macro->nsteps++;
+    return 1;
+}
+
+
+/**
+ * \brief Points the steps of a program calling a command replaced with a
+ * new descriptor to the new one.
+ *
+ * \param   macro       The program.
+ * \param   command     The old descriptor.
+ * \param   replacement The new descriptor.
+ */
+static void replace_in(macro_t *macro, const command_t *command,
+        command_t *replacement)
+{
+    int idx;
+
+    for (idx=0; idx < macro->nsteps; idx++)
+    {
+        if (macro->step[idx].op == OP_CALL && macro->step[idx].cmd == command)
+            macro->step[idx].cmd = replacement;
+    }
+}
+
+
+/**
+ * \brief Points the steps of all macros calling a command replaced with a
+ * new descriptor to the new one, see scp_replace_command().
+ *
+ * The programs typed at the prompt are resolved again when run instead, see
+ * resolve_program().
+ *
+ * \param   command     The old descriptor.
+ * \param   replacement The new descriptor.
+ */
+static void replace_in_all(const command_t *command, command_t *replacement)
+{
+    macro_t *macro;
+
+    for (macro=macro_list; macro; macro=macro->next)
+    {
+        replace_in(macro, command, replacement);
+    }
+}
+
+
+/**
+ * \brief Finishes recording and registers the macro as a command.
+ *
+ * \param   out     Output for the errors.
+ * \param   session The state of the context.
+ *
+ * \return  The number of steps in the macro, or 0 if a block is still open.
+ */
+static int end_macro(scp_out_t *out, session_t *session)
+{
+    char help[MAX_HELP_STR];
+    macro_t *macro = session->recording;
+    command_t *old;
+
+    if (session->nopen)
+    {
+        out_error(out,
+                "ERROR: [%s] has %d unclosed blocks!",
+                macro->name, session->nopen);
+        return 0;
+    }
+    end_program(session);
+
+    sprintf(help, "Macro, %d steps, %d params.",
+            macro->nsteps,
+            macro->nparams
+           );
+
+    if (macro->command == NULL)
+    {
+        strcpy(macro->help, help);
+        scp_add_command_ex(
+                macro->name,
+                "",
+                macro->help,
+                macro->nparams,
+                macro->nparams,
+                macro_cmd_func
+                );
+        macro->command = scp_find_command(macro->name);
+    }
+    else
+    {
+        /* The published command is not modified, but replaced. */
+        old = macro->command;
+        macro->command = scp_replace_command(old, help, macro->nparams,
+                macro->nparams);
+        assert(macro->command);
+        replace_in_all(old, macro->command);
+    }
+
+    return macro->nsteps;
+}
+
+
+/**
+ * \brief Replaces $_ and $name arguments with their current values.
+ *
+ * Used for lines typed at the prompt, so the result of one command can be
+ * passed to the next. Unknown variables are left unchanged.
+ *
+ * \param   session The state of the context.
+ * \param   argc    Count of argv parameters.
+ * \param   argv    The arguments.
+ */
+static void substitute(session_t *session, int argc, char *argv[])
+{
+    char (*subst)[MAX_INT_STR] = session->subst;
+    int idx;
+    int slot;
+
+    for (idx=0; idx < argc; idx++)
+    {
+        if (argv[idx][0] != '$')
+            continue;
+
+        if (strcmp(argv[idx], "$_") == 0)
+        {
+            sprintf(subst[idx], "%d", scp_last_result);
+        }
+        else if ((slot = find_var(session, &argv[idx][1], 0)) >= 0)
+        {
+            sprintf(subst[idx], "%d", session->var_value[slot]);
+        }
+        else
+        {
+            continue;
+        }
+        argv[idx] = subst[idx];
+    }
+}
+
+
+/**
+ * \brief Line hook that compiles input lines while a program is recorded.
+ *
+ * A repeat or if line typed at the prompt starts recording an unnamed
+ * program, which is run by the '}' command that closes its outermost block.
+ * Other lines typed at the prompt have their variables substituted. A line
+ * that cannot be compiled is refused, with the errors as its response.
+ *
+ * See #line_hook_t.
+ */
+static int record_line(scp_out_t *out, command_t *command, int id, int argc,
+        char *argv[])
+{
+    session_t *session = get_session();
+
+    if (session->recording == NULL)
+    {
+        if (CMD_FUNC(command) != repeat_cmd_func &&
+                CMD_FUNC(command) != if_cmd_func)
+        {
+            /* The variable name to assign must not be substituted. */
+            if (CMD_EX_FUNC(command) == set_cmd_func)
+                substitute(session, argc - 1, &argv[1]);
+            else
+                substitute(session, argc, argv);
+            return HOOK_PASS;
+        }
+        begin_program(session, &session->immediate, "...");
+    }
+    else if (CMD_EX_FUNC(command) == end_macro_cmd_func)
+    {
+        return HOOK_PASS;
+    }
+
+    if (!compile_line(out, session, command, id, argc, argv))
+    {
+        /* Nothing can be corrected in an unnamed program, so discard it. */
+        if (session->recording == &session->immediate)
+            end_program(session);
+        return HOOK_REFUSED;
+    }
+
+    /* Let the '}' closing an unnamed program execute it. */
+    return session->recording == &session->immediate && session->nopen == 0 ?
+        HOOK_PASS : HOOK_CONSUMED;
+}
+
+
+/**
+ * \brief Def command - starts recording a macro.
+ *
+ * Every following line is compiled as a step of the macro rather than
+ * executed, until the 'enddef' command. The macros are shared by all the
+ * contexts, so they cannot be defined in a batch job.
+ *
+ * \param out       Output for the errors.
+ * \param argc      1
+ * \param argv      The macro name.
+ *
+ * \returns         1 on success, 0 on error.
+ */
+static int def_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    if (refuse_in_batch(out))
+        return 0;
+    return begin_macro(out, get_session(), argv[0]) != NULL;
+}
+
+
+/**
+ * \brief Enddef command - finishes recording a macro.
+ *
+ * \param out       Output for the errors.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         The number of steps recorded, 0 if not recording.
+ */
+static int end_macro_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    session_t *session = get_session();
+
+    if (session->recording == NULL ||
+            session->recording == &session->immediate)
+    {
+        out_error(out, "ERROR: not recording a macro!");
+        return 0;
+    }
+    return end_macro(out, session);
+}
+
+
+/**
+ * \brief Alias command - defines a single step macro.
+ *
+ * As def, it cannot be used in a batch job.
+ *
+ * \param out       Output for the errors.
+ * \param argc      2 or more.
+ * \param argv      The alias name, the command and its arguments.
+ *
+ * \returns         1 on success, 0 on error.
+ */
+static int alias_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    session_t *session = get_session();
+    command_t *command;
+    int id;
+
+    if (refuse_in_batch(out))
+        return 0;
+
+    id = scp_lookup_id(argv[1]);
+    command = (command_t *)scp_command_by_id(id);
+    if (command == NULL)
+    {
+        out_error(out, "ERROR: Unknown Command: %s", argv[1]);
+        return 0;
+    }
+    if (begin_macro(out, session, argv[0]) == NULL)
+        return 0;
+
+    if (!compile_line(out, session, command, id, argc - 2, &argv[2]) ||
+            !end_macro(out, session))
+    {
+        end_program(session);
+        return 0;
+    }
+    return 1;
+}
+
+
+/**
+ * \brief Set command - assigns a value to a variable.
+ *
+ * \param out       Output for the errors.
+ * \param argc      2
+ * \param argv      The variable name and the value.
+ *
+ * \returns         The value assigned.
+ */
+static int set_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    session_t *session = get_session();
+    int slot = find_var(session, argv[0], 1);
+
+    if (slot < 0)
+    {
+        out_error(out, "ERROR: [%s] bad variable!", argv[0]);
+        return 0;
+    }
+    session->var_value[slot] = (int)strtol(argv[1], NULL, 0);
+    return session->var_value[slot];
+}
+
+
+/**
+ * \brief Repeat command - only valid in a block, see record_line().
+ *
+ * \returns         0
+ */
+static int repeat_cmd_func(int argc, char *argv[])
+{
+    return 0;
+}
+
+
+/**
+ * \brief If command - only valid in a block, see record_line().
+ *
+ * \returns         0
+ */
+static int if_cmd_func(int argc, char *argv[])
+{
+    return 0;
+}
+
+
+/**
+ * \brief Resolves the commands of a program typed at the prompt again.
+ *
+ * Its lines were looked up as they were typed, so their commands may have
+ * been removed or replaced since. The program belongs to one context, out of
+ * reach of the remove hook, so its steps are looked up again by ID, which
+ * is kept by a replacement.
+ *
+ * \param   macro   The program.
+ */
+static void resolve_program(macro_t *macro)
+{
+    int idx;
+
+    for (idx=0; idx < macro->nsteps; idx++)
+    {
+        if (macro->step[idx].op == OP_CALL)
+            macro->step[idx].cmd =
+                (command_t *)scp_command_by_id(macro->step[idx].id);
+    }
+}
+
+
+/**
+ * \brief Close block command.
+ *
+ * Closing the outermost block of a program typed at the prompt runs it.
+ *
+ * \param out       Output for the commands called.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         The value of $_ after running the program, or 0 on error.
+ */
+static int close_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    session_t *session = get_session();
+
+    if (session->recording != &session->immediate)
+    {
+        scp_out_str(out, "ERROR: } without a block!");
+        return 0;
+    }
+    end_program(session);
+    resolve_program(&session->immediate);
+    return run_program(out, session, &session->immediate, NULL);
+}
+
+
+/**
+ * \brief Drops the references of a program to a removed command.
+ *
+ * \param   macro   The program.
+ * \param   command The command.
+ */
+static void forget_in(macro_t *macro, const command_t *command)
+{
+    int idx;
+
+    if (macro->command == command)
+        macro->command = NULL;
+
+    for (idx=0; idx < macro->nsteps; idx++)
+    {
+        if (macro->step[idx].op == OP_CALL && macro->step[idx].cmd == command)
+            macro->step[idx].cmd = NULL;
+    }
+}
+
+
+/**
+ * \brief Remove hook that drops the references of the macros to a command.
+ *
+ * Steps calling the command report an error when run. A macro whose own
+ * command was removed is registered again when it is next recorded.
+ *
+ * See #remove_hook_t.
+ */
+static void forget_command(const command_t *command)
+{
+    macro_t *macro;
+
+    for (macro=macro_list; macro; macro=macro->next)
+    {
+        forget_in(macro, command);
+    }
+}
+
+
+/**
+ * \brief Release hook that frees the state of the macro commands in a
+ * context.
+ *
+ * See #release_hook_t.
+ */
+static void free_session(scp_ctx_t *ctx)
+{
+    free(ctx->macro);
+    ctx->macro = NULL;
+}
+
+
+/*
+ * Adds the macro and script commands and installs the recording, remove and
+ * release hooks.
+ */
+void scp_add_macro_commands(void)
+{
+    scp_add_command_ex(
+            "def",
+            "",
+            "Record macro <name> until enddef",
+            1,
+            1,
+            def_cmd_func
+            );
+
+    scp_add_command_ex(
+            "enddef",
+            "",
+            "Finish recording a macro.",
+            0,
+            0,
+            end_macro_cmd_func
+            );
+
+    scp_add_command_ex(
+            "alias",
+            "",
+            "Alias <name> to <cmd> [<args>...]",
+            2,
+            MAX_ARGC,
+            alias_cmd_func
+            );
+
+    scp_add_command_ex(
+            "set",
+            "",
+            "Set variable <name> to <value>",
+            2,
+            2,
+            set_cmd_func
+            );
+
+    scp_add_command(
+            "repeat",
+            "",
+            "repeat <n> { ... } runs block n times",
+            2,
+            2,
+            repeat_cmd_func
+            );
+
+    scp_add_command(
+            "if",
+            "",
+            "if <a> [<op> <b>] { ... } conditional",
+            2,
+            4,
+            if_cmd_func
+            );
+
+    scp_add_command_ex(
+            "}",
+            "",
+            "Ends a repeat or if block.",
+            0,
+            0,
+            close_cmd_func
+            );
+
+    scp_line_hook = record_line;
+    scp_remove_hook = forget_command;
+    scp_release_hook = free_session;
+}
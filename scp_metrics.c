@@ -0,0 +1,341 @@
+/**
+ * \file
+ *
+ * \brief Metrics exporter, serving the counters of the parser over HTTP.
+ *
+ * Linux only. The page is formatted by the serving thread in a buffer of its
+ * own, reused for every scrape.
+ */
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "scp_internal.h"
+#include "scp_epoch.h"
+#include "scp_metrics.h"
+
+/**
+ * Time a client has to send its request, in seconds.
+ */
+#define REQUEST_TIMEOUT     1
+
+/**
+ * \var listen_fd
+ *
+ * The socket listened on, or -1.
+ */
+static int listen_fd = -1;
+
+/**
+ * \var server
+ *
+ * The serving thread.
+ */
+static pthread_t server;
+
+/**
+ * \typedef ring_metric_t
+ *
+ * \brief A ring whose metrics are exported.
+ */
+typedef struct {
+    /** Name of the ring. */
+    const char          *name;
+    /** The ring, NULL until the slot is filled in. */
+    _Atomic(scp_ring_t *) ring;
+} ring_metric_t;
+
+/**
+ * \var rings
+ *
+ * The rings exported.
+ */
+static ring_metric_t rings[SCP_METRICS_MAX_RINGS];
+
+/**
+ * \var nrings
+ *
+ * Number of slots of rings taken, which may exceed SCP_METRICS_MAX_RINGS.
+ */
+static atomic_int nrings;
+
+/**
+ * \var page
+ *
+ * The page of metrics.
+ */
+static char page[SCP_METRICS_PAGE];
+
+/**
+ * \var page_len
+ *
+ * Length of the page.
+ */
+static int page_len;
+
+
+/**
+ * \brief printf() to the page, truncated if it is full.
+ *
+ * \param   format  printf() format string.
+ */
+static void put(const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    if (page_len >= SCP_METRICS_PAGE - 1)
+        return;
+
+    va_start(args, format);
+    len = vsnprintf(&page[page_len], SCP_METRICS_PAGE - page_len, format,
+            args);
+    va_end(args);
+
+    if (len > 0)
+        page_len += len;
+    if (page_len > SCP_METRICS_PAGE - 1)
+        page_len = SCP_METRICS_PAGE - 1;
+}
+
+
+/**
+ * \brief Formats the metrics in the page.
+ */
+static void format_page(void)
+{
+    unsigned long count = 0;
+    scp_ring_t *ring;
+    int idx;
+    int count_rings;
+
+    page_len = 0;
+
+    put("# HELP scp_responses_total Responses to commands, by status.\n"
+        "# TYPE scp_responses_total counter\n");
+    for (idx=0; idx <= STATUS_ERROR; idx++)
+    {
+        put("scp_responses_total{status=\"%s\"} %lu\n", scp_status_str[idx],
+                atomic_load_explicit(&scp_counters.responses[idx],
+                    memory_order_relaxed));
+    }
+
+    put("# HELP scp_command_duration_seconds Time taken by the commands.\n"
+        "# TYPE scp_command_duration_seconds histogram\n");
+    for (idx=0; idx < LATENCY_BUCKETS; idx++)
+    {
+        count += atomic_load_explicit(&scp_counters.latency[idx],
+                memory_order_relaxed);
+        if (idx < LATENCY_BUCKETS - 1)
+            put("scp_command_duration_seconds_bucket{le=\"%g\"} %lu\n",
+                    scp_latency_bounds[idx] / 1e6, count);
+        else
+            put("scp_command_duration_seconds_bucket{le=\"+Inf\"} %lu\n",
+                    count);
+    }
+    put("scp_command_duration_seconds_sum %g\n"
+        "scp_command_duration_seconds_count %lu\n",
+        atomic_load_explicit(&scp_counters.latency_us,
+            memory_order_relaxed) / 1e6, count);
+
+    put("# HELP scp_events_total Event reports, not counted as responses.\n"
+        "# TYPE scp_events_total counter\n"
+        "scp_events_total %lu\n",
+        atomic_load_explicit(&scp_counters.events, memory_order_relaxed));
+
+    put("# HELP scp_sessions Parse loops running.\n"
+        "# TYPE scp_sessions gauge\n"
+        "scp_sessions %d\n",
+        atomic_load(&scp_counters.sessions));
+
+    put("# HELP scp_retired_pending Data waiting to be freed.\n"
+        "# TYPE scp_retired_pending gauge\n"
+        "scp_retired_pending %u\n",
+        scp_epoch_pending());
+
+    count_rings = atomic_load(&nrings);
+    if (count_rings > SCP_METRICS_MAX_RINGS)
+        count_rings = SCP_METRICS_MAX_RINGS;
+    put("# HELP scp_ring_used Words in a ring, not yet consumed.\n"
+        "# TYPE scp_ring_used gauge\n");
+    for (idx=0; idx < count_rings; idx++)
+    {
+        if ((ring = atomic_load(&rings[idx].ring)) != NULL)
+            put("scp_ring_used{ring=\"%s\"} %u\n", rings[idx].name,
+                    scp_ring_used(ring));
+    }
+    put("# HELP scp_ring_dropped_total Records dropped by a full ring.\n"
+        "# TYPE scp_ring_dropped_total counter\n");
+    for (idx=0; idx < count_rings; idx++)
+    {
+        if ((ring = atomic_load(&rings[idx].ring)) != NULL)
+            put("scp_ring_dropped_total{ring=\"%s\"} %u\n", rings[idx].name,
+                    atomic_load_explicit(&ring->dropped,
+                        memory_order_relaxed));
+    }
+}
+
+
+/**
+ * \brief Writes all of a buffer to a socket.
+ *
+ * \param   fd      The socket.
+ * \param   data    The buffer.
+ * \param   len     Number of bytes.
+ */
+static void send_all(int fd, const char *data, int len)
+{
+    ssize_t sent;
+
+    while (len > 0)
+    {
+        if ((sent = send(fd, data, len, MSG_NOSIGNAL)) <= 0)
+            return;
+        data += sent;
+        len  -= (int)sent;
+    }
+}
+
+
+/**
+ * \brief Answers a request.
+ *
+ * \param   fd      The connection.
+ */
+static void serve(int fd)
+{
+    static const char not_found[] =
+        "HTTP/1.0 404 Not Found\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n\r\n";
+    struct timeval timeout = { REQUEST_TIMEOUT, 0 };
+    char request[512];
+    char header[128];
+    ssize_t len = 0;
+    ssize_t got;
+
+    /* Only the request line matters, the rest of the request is ignored. */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    while (len < (ssize_t)sizeof(request) - 1 &&
+            (got = recv(fd, &request[len], sizeof(request) - 1 - len, 0)) > 0)
+    {
+        len += got;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+    request[len] = '\0';
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 &&
+            strncmp(request, "GET / ", 6) != 0)
+    {
+        send_all(fd, not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    format_page();
+    send_all(fd, header, snprintf(header, sizeof(header),
+            "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %d\r\n"
+            "Connection: close\r\n\r\n", page_len));
+    send_all(fd, page, page_len);
+}
+
+
+/**
+ * \brief The serving thread, until the socket is shut down.
+ *
+ * \param   arg     ignored.
+ *
+ * \return  NULL
+ */
+static void *serve_thread(void *arg)
+{
+    int fd;
+
+    while ((fd = accept(listen_fd, NULL, NULL)) >= 0)
+    {
+        serve(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+
+/*
+ * Adds a ring to export.
+ */
+int scp_metrics_add_ring(const char *name, scp_ring_t *ring)
+{
+    int slot = atomic_fetch_add(&nrings, 1);
+
+    if (slot >= SCP_METRICS_MAX_RINGS)
+        return 0;
+
+    /* The name is seen by the serving thread once the ring is. */
+    rings[slot].name = name;
+    atomic_store(&rings[slot].ring, ring);
+    return 1;
+}
+
+
+/*
+ * Starts serving the metrics.
+ */
+int scp_metrics_start(int port)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+
+    if (listen_fd >= 0 || port < 0 || port > 65535)
+        return 0;
+
+    if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return 0;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+            listen(listen_fd, 8) != 0 ||
+            getsockname(listen_fd, (struct sockaddr *)&addr, &addr_len) != 0 ||
+            pthread_create(&server, NULL, serve_thread, NULL) != 0)
+    {
+        close(listen_fd);
+        listen_fd = -1;
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+
+/*
+ * Stops serving the metrics.
+ */
+void scp_metrics_stop(void)
+{
+    if (listen_fd < 0)
+        return;
+
+    /* Makes accept() fail, ending the thread. */
+    shutdown(listen_fd, SHUT_RDWR);
+    pthread_join(server, NULL);
+    close(listen_fd);
+    listen_fd = -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,74 @@
+/**
+ * \file
+ *
+ * \brief Metrics of the Simple Command Parser, served over HTTP in the
+ * Prometheus text exposition format.
+ *
+ * Linux only. The metrics are read from the counters the parser keeps as
+ * each response ends, with relaxed atomic adds, so the commands never wait
+ * for the exporter. They are
+ *
+ * -# scp_responses_total{status} - responses by status, "ok" or an error.
+ * -# scp_command_duration_seconds - histogram of the time taken by the
+ *    commands executed.
+ * -# scp_events_total - event reports, e.g. of watched GPIO edges, which
+ *    are not counted as responses.
+ * -# scp_sessions - parse loops running.
+ * -# scp_retired_pending - data waiting to be freed once no command can use
+ *    it, see scp_epoch.h.
+ * -# scp_ring_used{ring} - words in each ring added with
+ *    scp_metrics_add_ring(), not yet consumed.
+ * -# scp_ring_dropped_total{ring} - records dropped by each ring as it was
+ *    full.
+ */
+
+#ifndef SCP_METRICS_H_
+#define SCP_METRICS_H_
+
+#include "scp_ring.h"
+
+/**
+ * Size of the buffer the page of metrics is formatted in, once per scrape.
+ */
+#ifndef SCP_METRICS_PAGE
+    #define SCP_METRICS_PAGE    4096
+#endif
+
+/**
+ * Maximum number of rings exported, see scp_metrics_add_ring().
+ */
+#ifndef SCP_METRICS_MAX_RINGS
+    #define SCP_METRICS_MAX_RINGS   4
+#endif
+
+/**
+ * \brief Adds a ring whose fill and dropped records are exported.
+ *
+ * The ring is read by the serving thread without a lock, so it must stay
+ * initialised for as long as the program runs.
+ *
+ * \param   name    Name of the ring, the value of the ring label.
+ * \param   ring    The ring.
+ *
+ * \return  1, or 0 if #SCP_METRICS_MAX_RINGS rings were already added.
+ */
+int scp_metrics_add_ring(const char *name, scp_ring_t *ring);
+
+/**
+ * \brief Starts serving the metrics on a loopback port.
+ *
+ * A thread serves GET /metrics on 127.0.0.1, one request at a time.
+ *
+ * \param   port    The port, or 0 for any free port.
+ *
+ * \return  The port, or 0 if it cannot be listened on or the metrics are
+ *          already served.
+ */
+int scp_metrics_start(int port);
+
+/**
+ * \brief Stops serving the metrics.
+ */
+void scp_metrics_stop(void);
+
+#endif /* SCP_METRICS_H_ */
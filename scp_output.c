@@ -0,0 +1,527 @@
+/**
+ * \file
+ *
+ * \brief Simple command parser - buffered output writer.
+ *
+ * All output of the parser, and the values streamed by command functions
+ * using the #cmd_ex_func_t prototype, is collected in the output buffer and
+ * written out in large chunks when the buffer fills or before the parser
+ * waits for input.
+ *
+ * The response to each command is framed here for the output mode: as
+ * 'Out[n]>' text, a JSON object or a CSV record. Values are serialized
+ * directly into the output buffer, without printf() or memory allocation.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "scp_internal.h"
+#include "scp_trace.h"
+
+/*
+ * The output of the parser.
+ */
+scp_out_t scp_output;
+
+/*
+ * Status names for JSON and CSV responses and the metrics.
+ */
+const char *const scp_status_str[] = {
+    "ok",
+    "too_few_args",
+    "too_many_args",
+    "unknown_command",
+    "line_too_long",
+    "error"
+};
+
+/*
+ * The counters of the responses.
+ */
+scp_counters_t scp_counters;
+
+/*
+ * Bounds of the latency histogram.
+ */
+const unsigned long scp_latency_bounds[LATENCY_BUCKETS - 1] = {
+    1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+
+/**
+ * \brief Formats an integer in decimal.
+ *
+ * \param   buffer  Buffer of at least #MAX_INT_STR characters. Not 0
+ *                  terminated.
+ * \param   value   The value to format.
+ *
+ * \return  The number of characters written.
+ */
+static int format_int(char *buffer, int value)
+{
+    char digits[MAX_INT_STR];
+    unsigned int uvalue = (unsigned int)value;
+    int ndigits = 0;
+    int len = 0;
+
+    if (value < 0)
+        uvalue = 0u - uvalue;
+
+    do
+    {
+        digits[ndigits++] = (char)('0' + uvalue % 10);
+        uvalue /= 10;
+    } while (uvalue);
+
+    if (value < 0)
+        buffer[len++] = '-';
+    while (ndigits)
+        buffer[len++] = digits[--ndigits];
+
+    return len;
+}
+
+
+/**
+ * \brief Formats a 64 bit integer in decimal.
+ *
+ * Separate from format_int(), as 64 bit division is slow on small targets.
+ *
+ * \param   buffer  Buffer of at least #MAX_INT64_STR characters. Not 0
+ *                  terminated.
+ * \param   value   The value to format.
+ *
+ * \return  The number of characters written.
+ */
+static int format_int64(char *buffer, int64_t value)
+{
+    char digits[MAX_INT64_STR];
+    uint64_t uvalue = (uint64_t)value;
+    int ndigits = 0;
+    int len = 0;
+
+    if (value < 0)
+        uvalue = 0u - uvalue;
+
+    do
+    {
+        digits[ndigits++] = (char)('0' + uvalue % 10);
+        uvalue /= 10;
+    } while (uvalue);
+
+    if (value < 0)
+        buffer[len++] = '-';
+    while (ndigits)
+        buffer[len++] = digits[--ndigits];
+
+    return len;
+}
+
+
+/**
+ * \brief Makes sure there is space in the output buffer.
+ *
+ * \param   out     The output.
+ * \param   len     Number of characters needed, at most #MAX_OUTPUT_BUFFER.
+ *
+ * \return  Pointer to the free space.
+ */
+static char *reserve(scp_out_t *out, int len)
+{
+    if (out->len + len > MAX_OUTPUT_BUFFER)
+        scp_out_flush(out);
+    return &out->buffer[out->len];
+}
+
+
+/**
+ * \brief Outputs a single character.
+ *
+ * \param   out     The output.
+ * \param   ch      The character.
+ */
+static void put_char(scp_out_t *out, char ch)
+{
+    *reserve(out, 1) = ch;
+    out->len++;
+}
+
+
+/**
+ * \brief Outputs a 0 terminated string.
+ *
+ * \param   out     The output.
+ * \param   str     The string.
+ */
+static void put_str(scp_out_t *out, const char *str)
+{
+    scp_out_write(out, str, (int)strlen(str));
+}
+
+
+/**
+ * \brief Outputs an integer.
+ *
+ * \param   out     The output.
+ * \param   value   The value.
+ */
+static void put_int(scp_out_t *out, int value)
+{
+    out->len += format_int(reserve(out, MAX_INT_STR), value);
+}
+
+
+/**
+ * \brief Outputs a string escaped for the output mode.
+ *
+ * In JSON, " \ and control characters are escaped. In CSV, " is doubled.
+ *
+ * \param   out     The output.
+ * \param   str     The string.
+ */
+static void put_escaped(scp_out_t *out, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for (; *str; str++)
+    {
+        unsigned char ch = (unsigned char)*str;
+
+        if (out->mode == SCP_MODE_JSON && (ch == '"' || ch == '\\'))
+        {
+            put_char(out, '\\');
+        }
+        else if (out->mode == SCP_MODE_JSON && ch < 0x20)
+        {
+            put_str(out, "\\u00");
+            put_char(out, hex[ch >> 4]);
+            ch = (unsigned char)hex[ch & 0x0f];
+        }
+        else if (out->mode == SCP_MODE_CSV && ch == '"')
+        {
+            put_char(out, '"');
+        }
+        put_char(out, (char)ch);
+    }
+}
+
+
+/**
+ * \brief Outputs the start of the response, up to the first value.
+ *
+ * \param   out     The output.
+ */
+static void put_header(scp_out_t *out)
+{
+    switch (out->mode)
+    {
+    case SCP_MODE_JSON:
+        put_str(out, "{\"seq\":");
+        put_int(out, out->seq);
+        put_str(out, ",\"cmd\":\"");
+        put_escaped(out, out->name);
+        put_str(out, "\",\"values\":[");
+        break;
+
+    case SCP_MODE_CSV:
+        put_int(out, out->seq);
+        put_str(out, ",\"");
+        put_escaped(out, out->name);
+        put_str(out, "\",\"");
+        break;
+
+    default:
+        /* Events have no sequence number, and are shown by source name
+         * on a new line, as they interrupt the prompt.
+         */
+        if (out->seq == 0)
+        {
+            put_str(out, NL);
+            put_str(out, out->name);
+            put_str(out, "> ");
+        }
+        else
+        {
+            put_str(out, "Out[");
+            put_int(out, out->seq);
+            put_str(out, "]> ");
+        }
+        break;
+    }
+}
+
+
+/**
+ * \brief Starts a new value, separating it from any previous value.
+ *
+ * The first value of a response also starts the response.
+ *
+ * \param   out     The output.
+ */
+static void begin_value(scp_out_t *out)
+{
+    if (out->nvalues++ == 0)
+        put_header(out);
+    else
+        put_char(out, out->mode == SCP_MODE_JSON ? ',' : ' ');
+}
+
+
+/*
+ * Writes the contents of the output buffer to its stream, or memory.
+ */
+void scp_out_flush(scp_out_t *out)
+{
+    if (out->len)
+    {
+        scp_trace(SCP_TRACE_FLUSH, -1, out->len);
+#ifdef SCP_MEMORY_IO
+        scp_memory_write(out->buffer, out->len);
+#else
+        fwrite(out->buffer, 1, out->len, out->file ? out->file : stdout);
+#endif
+        out->len = 0;
+    }
+}
+
+
+/*
+ * Copies characters to the output buffer, flushing it as it fills.
+ */
+void scp_out_write(scp_out_t *out, const char *data, int len)
+{
+    int space;
+
+    while (len > (space = MAX_OUTPUT_BUFFER - out->len))
+    {
+        memcpy(&out->buffer[out->len], data, space);
+        out->len += space;
+        data += space;
+        len -= space;
+        scp_out_flush(out);
+    }
+
+    /* Usually everything fits, in one copy. */
+    memcpy(&out->buffer[out->len], data, len);
+    out->len += len;
+}
+
+
+/*
+ * printf() to the output buffer. Output longer than the buffer is truncated.
+ */
+void scp_out_printf(scp_out_t *out, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(&out->buffer[out->len], MAX_OUTPUT_BUFFER - out->len + 1,
+            format, args);
+    va_end(args);
+
+    if (len > MAX_OUTPUT_BUFFER - out->len)
+    {
+        scp_out_flush(out);
+
+        va_start(args, format);
+        len = vsnprintf(out->buffer, MAX_OUTPUT_BUFFER + 1, format, args);
+        va_end(args);
+
+        if (len > MAX_OUTPUT_BUFFER)
+            len = MAX_OUTPUT_BUFFER;
+    }
+    out->len += len;
+}
+
+
+/*
+ * Starts the response to a command.
+ */
+void scp_out_begin(scp_out_t *out, int seq, const char *name)
+{
+    out->seq      = seq;
+    out->name     = name;
+    out->nvalues  = 0;
+    out->start_us = scp_time_us();
+}
+
+
+/*
+ * Ends the response to a command.
+ */
+void scp_out_end(scp_out_t *out, int status, int result)
+{
+    int elapsed = (int)(scp_time_us() - out->start_us);
+#if SCP_METRICS
+    int bucket = 0;
+
+    /* Events are not responses, and take no command's time. */
+    if (out->seq == 0)
+    {
+        atomic_fetch_add_explicit(&scp_counters.events, 1,
+                memory_order_relaxed);
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&scp_counters.responses[status], 1,
+                memory_order_relaxed);
+    }
+    if (status == STATUS_OK && out->seq != 0)
+    {
+        while (bucket < LATENCY_BUCKETS - 1 &&
+                (unsigned long)elapsed > scp_latency_bounds[bucket])
+            bucket++;
+        atomic_fetch_add_explicit(&scp_counters.latency[bucket], 1,
+                memory_order_relaxed);
+        atomic_fetch_add_explicit(&scp_counters.latency_us,
+                (unsigned long)elapsed, memory_order_relaxed);
+    }
+#endif
+
+    if (out->nvalues == 0)
+        put_header(out);
+
+    switch (out->mode)
+    {
+    case SCP_MODE_JSON:
+        put_str(out, "],\"status\":\"");
+        put_str(out, scp_status_str[status]);
+        put_str(out, "\",\"result\":");
+        if (status == STATUS_OK)
+            put_int(out, result);
+        else
+            put_str(out, "null");
+        put_str(out, ",\"us\":");
+        put_int(out, elapsed);
+        put_char(out, '}');
+        break;
+
+    case SCP_MODE_CSV:
+        put_str(out, "\",");
+        put_str(out, scp_status_str[status]);
+        put_char(out, ',');
+        if (status == STATUS_OK)
+            put_int(out, result);
+        put_char(out, ',');
+        put_int(out, elapsed);
+        break;
+
+    default:
+        switch (status)
+        {
+        case STATUS_OK:
+            if (out->nvalues == 0)
+                put_int(out, result);
+            break;
+        case STATUS_TOO_FEW:
+            scp_out_printf(out, "ERROR: [%s] too few args (less than %d)!",
+                    out->name, result);
+            break;
+        case STATUS_TOO_MANY:
+            scp_out_printf(out, "ERROR: [%s] too many args (more than %d)!",
+                    out->name, result);
+            break;
+        case STATUS_TOO_LONG:
+            scp_out_printf(out,
+                    "ERROR: line too long (more than %d characters)!",
+                    result);
+            break;
+        case STATUS_ERROR:
+            /* The error messages are the values. */
+            break;
+        default:
+            put_str(out, "Unknown Command: ");
+            put_str(out, out->name);
+            break;
+        }
+        break;
+    }
+    put_str(out, NL);
+}
+
+
+/*
+ * Streams an integer value.
+ */
+void scp_out_int(scp_out_t *out, int value)
+{
+    begin_value(out);
+    put_int(out, value);
+}
+
+
+/*
+ * Streams a 64 bit integer value.
+ */
+void scp_out_int64(scp_out_t *out, int64_t value)
+{
+    begin_value(out);
+    out->len += format_int64(reserve(out, MAX_INT64_STR), value);
+}
+
+
+/*
+ * Streams an array of integer values.
+ */
+void scp_out_ints(scp_out_t *out, const int *values, int count)
+{
+    int idx;
+
+    for (idx=0; idx < count; idx++)
+    {
+        scp_out_int(out, values[idx]);
+    }
+}
+
+
+/*
+ * Streams bytes as a single value of hex digit pairs.
+ */
+void scp_out_bytes(scp_out_t *out, const unsigned char *bytes, int count)
+{
+    static const char hex[] = "0123456789abcdef";
+    int idx;
+
+    begin_value(out);
+    if (out->mode == SCP_MODE_JSON)
+        put_char(out, '"');
+
+    for (idx=0; idx < count; idx++)
+    {
+        char *ptr = reserve(out, 2);
+
+        ptr[0] = hex[bytes[idx] >> 4];
+        ptr[1] = hex[bytes[idx] & 0x0f];
+        out->len += 2;
+    }
+
+    if (out->mode == SCP_MODE_JSON)
+        put_char(out, '"');
+}
+
+
+/*
+ * Streams a string value.
+ */
+void scp_out_str(scp_out_t *out, const char *str)
+{
+    begin_value(out);
+
+    if (out->mode == SCP_MODE_JSON)
+    {
+        put_char(out, '"');
+        put_escaped(out, str);
+        put_char(out, '"');
+    }
+    else if (out->mode == SCP_MODE_CSV)
+    {
+        put_escaped(out, str);
+    }
+    else
+    {
+        put_str(out, str);
+    }
+}
@@ -0,0 +1,298 @@
+/**
+ * \file
+ *
+ * \brief Command plugins loaded with dlopen().
+ *
+ * Linux only. Unloading removes the plugin's table from the registry, then
+ * retires the library handle after it, see scp_epoch.h, so dlclose() is only
+ * called once no thread can be running one of its commands.
+ */
+
+#ifdef __linux__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "scp_internal.h"
+#include "scp_epoch.h"
+#include "scp_plugin.h"
+#include "scp_batch.h"
+
+/**
+ * \typedef loaded_t
+ *
+ * \brief Typedef of the _loaded_t struct.
+ */
+typedef struct _loaded_t loaded_t;
+
+/**
+ * \struct _loaded_t
+ *
+ * \brief A loaded plugin.
+ */
+struct _loaded_t {
+    /** Handle returned by dlopen(). */
+    void                *handle;
+    /** The commands exported by the plugin. */
+    const scp_plugin_t  *plugin;
+    /** Next loaded_t node */
+    loaded_t            *next;
+    /** Name the plugin was loaded as. */
+    char                name[];
+};
+
+/**
+ * \var loaded_list
+ *
+ * List of the loaded plugins.
+ */
+static loaded_t *loaded_list;
+
+
+/**
+ * \brief Search for a plugin by the name it was loaded as.
+ *
+ * \param   name    The name.
+ *
+ * \return  Link to the plugin in loaded_list, or to the NULL at its end if
+ *          there is no such plugin.
+ */
+static loaded_t **find_loaded(const char *name)
+{
+    loaded_t **link;
+
+    for (link=&loaded_list; *link; link=&(*link)->next)
+    {
+        if (strcmp(name, (*link)->name) == 0)
+            break;
+    }
+    return link;
+}
+
+
+/**
+ * \brief Opens the library of a plugin.
+ *
+ * The tokenizer splits arguments at '.', so the name is given without the
+ * .so suffix. A name without a '/' is relative to the current directory,
+ * rather than searched for by dlopen().
+ *
+ * \param   name    The name.
+ *
+ * \return  The handle, or NULL on failure.
+ */
+static void *open_plugin(const char *name)
+{
+    char *path;
+    void *handle;
+
+    path = (char *)malloc(strlen(name) + sizeof("./.so"));
+    if (path == NULL)
+        return NULL;
+
+    sprintf(path, "%s%s.so", strchr(name, '/') ? "" : "./", name);
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    free(path);
+    return handle;
+}
+
+
+/**
+ * \brief Closes an unloaded plugin, once its commands have returned.
+ *
+ * \param   ptr     The loaded_t of the plugin.
+ */
+static void close_plugin(void *ptr)
+{
+    loaded_t *loaded = (loaded_t *)ptr;
+
+    dlclose(loaded->handle);
+    free(loaded);
+}
+
+
+/**
+ * \brief Load command - loads a plugin and registers its commands.
+ *
+ * \param out       Output for errors.
+ * \param argc      1
+ * \param argv      Name of the plugin, see open_plugin().
+ *
+ * \returns         The number of commands registered, 0 on failure.
+ */
+static int load_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    const scp_plugin_t *plugin;
+    const command_t *command;
+    loaded_t *loaded;
+    void *handle;
+    int idx;
+
+    if (scp_batch_refuse(out))
+        return 0;
+
+    if (*find_loaded(argv[0]))
+    {
+        scp_out_str(out, "ERROR: already loaded!");
+        return 0;
+    }
+
+    if ((handle = open_plugin(argv[0])) == NULL)
+    {
+        const char *error = dlerror();
+
+        scp_out_str(out, "ERROR: cannot load!");
+        if (error)
+            scp_out_str(out, error);
+        return 0;
+    }
+
+    plugin = (const scp_plugin_t *)dlsym(handle, SCP_PLUGIN_SYMBOL);
+    if (plugin == NULL || plugin->commands == NULL || plugin->count <= 0)
+    {
+        scp_out_str(out, "ERROR: not a plugin!");
+        dlclose(handle);
+        return 0;
+    }
+
+    /* A clash would hide a command, or the plugin's own. */
+    for (idx=0; idx < plugin->count; idx++)
+    {
+        command = &plugin->commands[idx];
+        if (scp_find_command(CMD_NAME(command)) ||
+                (CMD_ABBR(command) && *CMD_ABBR(command) &&
+                 scp_find_command(CMD_ABBR(command))))
+        {
+            scp_out_str(out, "ERROR: command already defined!");
+            scp_out_str(out, CMD_NAME(command));
+            dlclose(handle);
+            return 0;
+        }
+    }
+
+    loaded = (loaded_t *)malloc(sizeof(loaded_t) + strlen(argv[0]) + 1);
+    if (loaded == NULL)
+    {
+        scp_out_str(out, "ERROR: out of memory!");
+        dlclose(handle);
+        return 0;
+    }
+    strcpy(loaded->name, argv[0]);
+    loaded->handle = handle;
+    loaded->plugin = plugin;
+    loaded->next   = loaded_list;
+    loaded_list    = loaded;
+
+    scp_add_command_table(plugin->commands, plugin->count, NULL);
+    return plugin->count;
+}
+
+
+/**
+ * \brief Unload command - removes the commands of a plugin and unloads it.
+ *
+ * \param out       Output for errors.
+ * \param argc      1
+ * \param argv      Name the plugin was loaded as.
+ *
+ * \returns         The number of commands removed, 0 on failure.
+ */
+static int unload_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    loaded_t **link;
+    loaded_t *loaded;
+    int removed;
+
+    if (scp_batch_refuse(out))
+        return 0;
+
+    link   = find_loaded(argv[0]);
+    loaded = *link;
+    if (loaded == NULL)
+    {
+        scp_out_str(out, "ERROR: not loaded!");
+        return 0;
+    }
+    *link = loaded->next;
+
+    removed = scp_remove_command_table(loaded->plugin->commands,
+            loaded->plugin->count);
+
+    /* Closed after the commands are freed, e.g. after this line. */
+    scp_epoch_retire(close_plugin, loaded);
+    return removed;
+}
+
+
+/**
+ * \brief Plugins command - lists the loaded plugins.
+ *
+ * \param out       Output for the name and number of commands of each.
+ * \param argc      ignored.
+ * \param argv      ignored.
+ *
+ * \returns         The number of plugins loaded.
+ */
+static int plugins_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    loaded_t *loaded;
+    int count = 0;
+
+    if (scp_batch_refuse(out))
+        return 0;
+
+    for (loaded=loaded_list; loaded; loaded=loaded->next)
+    {
+        scp_out_str(out, loaded->name);
+        scp_out_int(out, loaded->plugin->count);
+        count++;
+    }
+    return count;
+}
+
+
+/**
+ * \var plugin_commands
+ *
+ * The plugin commands.
+ */
+static const scp_command_t plugin_commands[] = {
+    SCP_COMMAND_DEF_EX(
+            "load",
+            "",
+            "Load plugin <name>.so",
+            1,
+            1,
+            load_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "unload",
+            "",
+            "Unload plugin <name>",
+            1,
+            1,
+            unload_cmd_func
+            ),
+    SCP_COMMAND_DEF_EX(
+            "plugins",
+            "",
+            "List loaded plugins.",
+            0,
+            0,
+            plugins_cmd_func
+            )
+};
+
+
+/*
+ * Adds the plugin commands.
+ */
+void scp_add_plugin_commands(void)
+{
+    scp_add_command_table(plugin_commands,
+            sizeof(plugin_commands) / sizeof(plugin_commands[0]), NULL);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,75 @@
+/**
+ * \file
+ *
+ * \brief Command plugins for the Simple Command Parser.
+ *
+ * Linux only. A plugin is a shared library exporting a table of commands,
+ * which can be loaded into and unloaded from a running parser, e.g.
+ *
+ * \code{c}
+ * static const scp_command_t commands[] = {
+ *     SCP_COMMAND_DEF("diag", "", "Run diagnostics", 0, 0, diag_cmd_func),
+ * };
+ *
+ * SCP_PLUGIN(commands);
+ * \endcode
+ *
+ * built with 'cc -shared -fPIC'. The program loading it must export the
+ * parser functions the commands use, e.g. by linking with -rdynamic.
+ */
+
+#ifndef SCP_PLUGIN_H_
+#define SCP_PLUGIN_H_
+
+#include "simple_command_parser.h"
+
+/**
+ * Name of the #scp_plugin_t exported by a plugin.
+ */
+#define SCP_PLUGIN_SYMBOL   "scp_plugin"
+
+/**
+ * \typedef scp_plugin_t
+ *
+ * \brief The commands of a plugin.
+ */
+typedef struct {
+    /** The commands. */
+    const scp_command_t *commands;
+    /** Number of commands. */
+    int                 count;
+} scp_plugin_t;
+
+/**
+ * \brief Exports a table of commands from a plugin.
+ *
+ * \param   table   The table, an array of #scp_command_t.
+ */
+#define SCP_PLUGIN(table) \
+    const scp_plugin_t scp_plugin = { \
+        (table), (int)(sizeof(table) / sizeof((table)[0])) \
+    }
+
+/**
+ * \brief Add the plugin commands to the parser. Linux only.
+ *
+ * -# load \<name\> - load the plugin \<name\>.so and register its commands,
+ *    returning the number of commands. The name is a path without the .so
+ *    suffix, relative to the current directory if it has no '/', and cannot
+ *    contain the '.' or ',' that separate arguments. A plugin whose commands
+ *    clash with the commands already registered is not loaded.
+ * -# unload \<name\> - remove the commands of a plugin and unload it,
+ *    returning the number of commands removed.
+ * -# plugins - list the loaded plugins and their number of commands.
+ *
+ * The commands of a plugin are registered together as one table, see
+ * scp_add_command_table(). The library is closed only once every command of
+ * the plugin that was running, in any thread, has returned. The list of
+ * plugins is kept by the parse loop, so the commands are refused in a batch
+ * job.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_plugin_commands(void);
+
+#endif /* SCP_PLUGIN_H_ */
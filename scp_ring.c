@@ -0,0 +1,85 @@
+/**
+ * \file
+ *
+ * \brief Lock-free single producer, single consumer ring buffer.
+ */
+
+#include <assert.h>
+
+#include "scp_ring.h"
+
+
+/*
+ * Initialise a ring buffer.
+ */
+void scp_ring_init(scp_ring_t *ring, uint32_t *words, unsigned int size)
+{
+    assert(words);
+    assert(size && (size & (size - 1)) == 0);
+
+    ring->words = words;
+    ring->size  = size;
+    atomic_init(&ring->dropped, 0);
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+
+/*
+ * Push a record.
+ */
+int scp_ring_push(scp_ring_t *ring, const uint32_t *record,
+        unsigned int nwords)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    unsigned int idx;
+
+    if (ring->size - (head - tail) < nwords)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return 0;
+    }
+
+    for (idx=0; idx < nwords; idx++)
+    {
+        ring->words[(head + idx) & (ring->size - 1)] = record[idx];
+    }
+
+    /* Publish the words to the consumer. */
+    atomic_store_explicit(&ring->head, head + nwords, memory_order_release);
+    return 1;
+}
+
+
+/*
+ * Pop a record.
+ */
+int scp_ring_pop(scp_ring_t *ring, uint32_t *record, unsigned int nwords)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    unsigned int idx;
+
+    if (head - tail < nwords)
+        return 0;
+
+    for (idx=0; idx < nwords; idx++)
+    {
+        record[idx] = ring->words[(tail + idx) & (ring->size - 1)];
+    }
+
+    /* Hand the space back to the producer. */
+    atomic_store_explicit(&ring->tail, tail + nwords, memory_order_release);
+    return 1;
+}
+
+
+/*
+ * Number of words in the ring.
+ */
+unsigned int scp_ring_used(scp_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+        atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
@@ -0,0 +1,92 @@
+/**
+ * \file
+ *
+ * \brief Lock-free single producer, single consumer ring buffer.
+ *
+ * Passes records of 32 bit words from one thread, or an interrupt handler,
+ * to another without locks. The producer only writes head and the consumer
+ * only writes tail, so each side needs only acquire/release ordering on the
+ * other's index. A record is pushed whole or, if there is no space, dropped
+ * and counted, so the producer never waits for the consumer.
+ */
+
+#ifndef SCP_RING_H_
+#define SCP_RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Size of a cache line, used to keep the producer and consumer indexes
+ * apart.
+ */
+#define SCP_CACHE_LINE      64
+
+/**
+ * \typedef scp_ring_t
+ *
+ * \brief Typedef of the _scp_ring_t struct.
+ */
+typedef struct _scp_ring_t scp_ring_t;
+
+/**
+ * \struct _scp_ring_t
+ *
+ * \brief A ring buffer of 32 bit words.
+ */
+struct _scp_ring_t {
+    /** Storage for the words. */
+    uint32_t            *words;
+    /** Number of words, a power of 2. */
+    unsigned int        size;
+    /** Number of records dropped because the ring was full. */
+    atomic_uint         dropped;
+
+    /** Words pushed, free running. Written by the producer only. */
+    _Alignas(SCP_CACHE_LINE) atomic_uint head;
+    /** Words popped, free running. Written by the consumer only. */
+    _Alignas(SCP_CACHE_LINE) atomic_uint tail;
+};
+
+/**
+ * \brief Initialise a ring buffer.
+ *
+ * \param   ring    The ring.
+ * \param   words   Storage for the words.
+ * \param   size    Number of words in storage, a power of 2.
+ */
+void scp_ring_init(scp_ring_t *ring, uint32_t *words, unsigned int size);
+
+/**
+ * \brief Push a record. Producer only.
+ *
+ * \param   ring    The ring.
+ * \param   record  The words of the record.
+ * \param   nwords  Number of words in the record.
+ *
+ * \return  1 if the record was pushed, 0 if it was dropped.
+ */
+int scp_ring_push(scp_ring_t *ring, const uint32_t *record,
+        unsigned int nwords);
+
+/**
+ * \brief Pop a record. Consumer only.
+ *
+ * \param   ring    The ring.
+ * \param   record  Where to store the words of the record.
+ * \param   nwords  Number of words in the record.
+ *
+ * \return  1 if a record was popped, 0 if the ring is empty.
+ */
+int scp_ring_pop(scp_ring_t *ring, uint32_t *record, unsigned int nwords);
+
+/**
+ * \brief Number of words in the ring.
+ *
+ * \param   ring    The ring.
+ *
+ * \return  The number of words pushed but not yet popped.
+ */
+unsigned int scp_ring_used(scp_ring_t *ring);
+
+#endif /* SCP_RING_H_ */
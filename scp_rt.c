@@ -0,0 +1,48 @@
+/**
+ * \file
+ *
+ * \brief Timing helpers for the GPIO sampling and playback threads.
+ */
+
+#ifdef __linux__
+
+#include <time.h>
+#include <errno.h>
+
+#include "scp_rt.h"
+
+
+/*
+ * Returns CLOCK_MONOTONIC in nanoseconds.
+ */
+uint64_t scp_rt_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+
+/*
+ * Sleeps until shortly before the deadline, then busy-waits.
+ */
+void scp_rt_wait_until(uint64_t deadline)
+{
+    uint64_t sleep_until = deadline - SCP_RT_SPIN_NS;
+
+    if (deadline > SCP_RT_SPIN_NS && scp_rt_now_ns() < sleep_until)
+    {
+        struct timespec wake;
+
+        wake.tv_sec  = (time_t)(sleep_until / 1000000000u);
+        wake.tv_nsec = (long)(sleep_until % 1000000000u);
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL)
+                == EINTR);
+    }
+
+    while (scp_rt_now_ns() < deadline);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,38 @@
+/**
+ * \file
+ *
+ * \brief Timing helpers for the GPIO sampling and playback threads.
+ *
+ * Linux only. Deadlines are absolute times on CLOCK_MONOTONIC, so periodic
+ * loops do not drift however long each iteration takes.
+ */
+
+#ifndef SCP_RT_H_
+#define SCP_RT_H_
+
+#include <stdint.h>
+
+/**
+ * Time before a deadline at which scp_rt_wait_until() stops sleeping and
+ * busy-waits, to absorb the wake up latency of the scheduler.
+ */
+#define SCP_RT_SPIN_NS      50000
+
+/**
+ * \brief Returns the current time.
+ *
+ * \return  CLOCK_MONOTONIC in nanoseconds.
+ */
+uint64_t scp_rt_now_ns(void);
+
+/**
+ * \brief Waits until an absolute deadline.
+ *
+ * Sleeps with clock_nanosleep() until #SCP_RT_SPIN_NS before the deadline,
+ * then busy-waits for the remainder.
+ *
+ * \param   deadline    Time to wait until, see scp_rt_now_ns().
+ */
+void scp_rt_wait_until(uint64_t deadline);
+
+#endif /* SCP_RT_H_ */
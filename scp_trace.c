@@ -0,0 +1,388 @@
+/**
+ * \file
+ *
+ * \brief Trace of the dispatch events of the parser, and its export in the
+ * Chrome trace event format.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+    #include <pthread.h>
+#endif
+
+#include "scp_trace.h"
+
+#if SCP_TRACE_SIZE
+
+/*
+ * The ring of this thread.
+ */
+SCP_THREAD_LOCAL scp_trace_ring_t *scp_trace_my_ring;
+
+/**
+ * \typedef ring_slot_t
+ *
+ * \brief A ring, and whether a thread owns it.
+ */
+typedef struct {
+    /** The ring, NULL until a thread needs it. */
+    _Atomic(scp_trace_ring_t *) ring;
+    /** Non-zero while the ring belongs to a thread. */
+    atomic_int          owned;
+    /** Head of the ring when the trace was last cleared. */
+    uint32_t            clear_mark;
+} ring_slot_t;
+
+/**
+ * \var rings
+ *
+ * The rings of the threads.
+ */
+static ring_slot_t rings[SCP_TRACE_THREADS];
+
+/**
+ * \var nthreads
+ *
+ * Number of threads that have claimed a ring.
+ */
+static atomic_uint nthreads;
+
+#ifdef __linux__
+/**
+ * \var ring_key
+ *
+ * Releases the ring of a thread when it exits.
+ */
+static pthread_key_t ring_key;
+
+/**
+ * \var ring_key_once
+ *
+ * Creates ring_key.
+ */
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * \brief Releases the ring of an exiting thread, keeping its events.
+ *
+ * \param   ptr     The slot of the ring.
+ */
+static void release_ring(void *ptr)
+{
+    atomic_store(&((ring_slot_t *)ptr)->owned, 0);
+}
+
+/**
+ * \brief Creates ring_key.
+ */
+static void create_ring_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+#endif
+
+/**
+ * \var start_cycles
+ *
+ * Cycle counter when the parser was initialised.
+ */
+static uint64_t start_cycles;
+
+/**
+ * \var start_us
+ *
+ * scp_time_us() when the parser was initialised.
+ */
+static unsigned long start_us;
+
+/**
+ * \var event_names
+ *
+ * Names of the events other than the calls of commands, by type.
+ */
+static const char *const event_names[] = {
+    "line", "lookup", "tokenized", "", "", "flush"
+};
+
+
+/*
+ * Claims a ring, reusing that of a thread which has exited.
+ */
+scp_trace_ring_t *scp_trace_claim(void)
+{
+    scp_trace_ring_t *ring;
+    int expected;
+    int idx;
+
+    for (idx=0; idx < SCP_TRACE_THREADS; idx++)
+    {
+        expected = 0;
+        if (!atomic_compare_exchange_strong(&rings[idx].owned, &expected, 1))
+            continue;
+
+        ring = atomic_load(&rings[idx].ring);
+        if (ring == NULL)
+        {
+            ring = (scp_trace_ring_t *)calloc(1, sizeof(scp_trace_ring_t));
+            if (ring == NULL)
+            {
+                atomic_store(&rings[idx].owned, 0);
+                return NULL;
+            }
+            atomic_store(&rings[idx].ring, ring);
+        }
+#ifdef __linux__
+        pthread_once(&ring_key_once, create_ring_key);
+        pthread_setspecific(ring_key, &rings[idx]);
+#endif
+        ring->thread = (uint8_t)(atomic_fetch_add(&nthreads, 1) % 255 + 1);
+        scp_trace_my_ring = ring;
+        return ring;
+    }
+    return NULL;
+}
+
+
+/*
+ * Starts the clock.
+ */
+void scp_trace_init(void)
+{
+    start_cycles = scp_trace_clock();
+    start_us     = scp_time_us();
+}
+
+
+/**
+ * \brief Formats an event as a Chrome trace event.
+ *
+ * Calls of commands are duration events named after the command, the other
+ * events instant events.
+ *
+ * \param   buffer  Where to format the event.
+ * \param   size    Size of buffer.
+ * \param   event   The event.
+ * \param   us_per_cycle    Rate of the cycle counter.
+ *
+ * \return  Length of the event formatted.
+ */
+static int format_event(char *buffer, int size,
+        const scp_trace_event_t *event, double us_per_cycle)
+{
+    char name[MAX_INT_STR + 1];
+    const command_t *command = NULL;
+    double ts = ((int64_t)(event->time - start_cycles)) * us_per_cycle;
+
+    if (event->type == SCP_TRACE_BEGIN || event->type == SCP_TRACE_END)
+    {
+        if (event->id >= 0)
+            command = scp_command_by_id(event->id);
+        if (command == NULL)
+            sprintf(name, "#%d", (int)event->id);
+
+        return snprintf(buffer, size,
+                "{\"name\":\"%s\",\"cat\":\"command\",\"ph\":\"%c\","
+                "\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%d}}",
+                command ? CMD_NAME(command) : name,
+                event->type == SCP_TRACE_BEGIN ? 'B' : 'E',
+                ts, event->thread, (int)event->id);
+    }
+
+    return snprintf(buffer, size,
+            "{\"name\":\"%s\",\"cat\":\"parser\",\"ph\":\"i\",\"s\":\"t\","
+            "\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"id\":%d,\"arg\":%u}}",
+            event->type < sizeof(event_names) / sizeof(event_names[0]) ?
+                event_names[event->type] : "",
+            ts, event->thread, (int)event->id, event->arg);
+}
+
+
+/**
+ * \brief Copies the events of a ring recorded since the trace was last
+ * cleared.
+ *
+ * The thread owning the ring may be recording meanwhile, so the events it
+ * may have overwritten during the copy are left out.
+ *
+ * \param   slot    The slot of the ring.
+ * \param   events  Where to copy the events, #SCP_TRACE_SIZE of them.
+ *
+ * \return  The number of events copied.
+ */
+static unsigned int copy_ring(const ring_slot_t *slot,
+        scp_trace_event_t *events)
+{
+    scp_trace_ring_t *ring = atomic_load(&slot->ring);
+    uint32_t head;
+    uint32_t first;
+    uint32_t count;
+    uint32_t idx;
+
+    if (ring == NULL)
+        return 0;
+
+    head  = SCP_TRACE_LOAD(ring->head);
+    first = SCP_TRACE_LOAD(slot->clear_mark);
+    if (head - first > SCP_TRACE_SIZE)
+        first = head - SCP_TRACE_SIZE;
+    for (idx=first; idx != head; idx++)
+    {
+        scp_trace_event_t *event =
+            &ring->events[idx & (SCP_TRACE_SIZE - 1)];
+        scp_trace_event_t *copy = &events[idx - first];
+
+        copy->time   = SCP_TRACE_LOAD(event->time);
+        copy->id     = SCP_TRACE_LOAD(event->id);
+        copy->arg    = SCP_TRACE_LOAD(event->arg);
+        copy->type   = SCP_TRACE_LOAD(event->type);
+        copy->thread = SCP_TRACE_LOAD(event->thread);
+    }
+
+    /* Slots written again since head was read hold newer events. */
+    count = SCP_TRACE_LOAD(ring->head) - first;
+    if (count > SCP_TRACE_SIZE)
+    {
+        count -= SCP_TRACE_SIZE;
+        if (count >= head - first)
+            return 0;
+        memmove(events, &events[count],
+                (head - first - count) * sizeof(scp_trace_event_t));
+        return head - first - count;
+    }
+    return head - first;
+}
+
+
+/**
+ * \brief Exports the events recorded since the trace was last cleared.
+ *
+ * The events of each ring are copied first, as dumping records events of
+ * its own, and exported in order, ring after ring. A file is written as a
+ * Chrome trace document. On the output each event is a value of the
+ * response, so the framing of the JSON and CSV modes is kept.
+ *
+ * \param   out     Output for the events, if file is NULL.
+ * \param   file    File for the events, or NULL.
+ *
+ * \return  The number of events, or -1 if out of memory.
+ */
+static int dump_trace(scp_out_t *out, FILE *file)
+{
+    char buffer[256];
+    scp_trace_event_t *events;
+    unsigned long now_us = scp_time_us();
+    uint64_t now_cycles = scp_trace_clock();
+    double us_per_cycle = 1.0;
+    unsigned int total = 0;
+    unsigned int count;
+    unsigned int idx;
+    int nring;
+    int len;
+
+    events = (scp_trace_event_t *)malloc(
+            SCP_TRACE_SIZE * sizeof(scp_trace_event_t));
+    if (events == NULL)
+        return -1;
+
+    /* Without a clock, the counter is in microseconds. */
+    if (now_us != start_us && now_cycles != start_cycles)
+        us_per_cycle = (double)(now_us - start_us) /
+            (double)(now_cycles - start_cycles);
+
+    if (file)
+        fputs("{\"traceEvents\":[", file);
+    for (nring=0; nring < SCP_TRACE_THREADS; nring++)
+    {
+        count = copy_ring(&rings[nring], events);
+        for (idx=0; idx < count; idx++)
+        {
+            len = format_event(buffer, sizeof(buffer), &events[idx],
+                    us_per_cycle);
+            if (len > (int)sizeof(buffer) - 1)
+                len = sizeof(buffer) - 1;
+            buffer[len] = '\0';
+
+            if (file == NULL)
+                scp_out_str(out, buffer);
+            else if (total)
+                fprintf(file, ","NL"%s", buffer);
+            else
+                fputs(buffer, file);
+            total++;
+        }
+    }
+    if (file)
+        fputs("]}"NL, file);
+
+    free(events);
+    return (int)total;
+}
+
+
+/*
+ * Trace command.
+ */
+int scp_trace_cmd_func(scp_out_t *out, int argc, char *argv[])
+{
+    scp_trace_ring_t *ring;
+    uint32_t head;
+    uint32_t cleared;
+    char *path;
+    FILE *file;
+    int count = 0;
+    int nring;
+
+    if (strcmp(argv[0], "clear") == 0)
+    {
+        for (nring=0; nring < SCP_TRACE_THREADS; nring++)
+        {
+            if ((ring = atomic_load(&rings[nring].ring)) == NULL)
+                continue;
+            head    = SCP_TRACE_LOAD(ring->head);
+            cleared = head - SCP_TRACE_LOAD(rings[nring].clear_mark);
+            count  += cleared > SCP_TRACE_SIZE ? SCP_TRACE_SIZE : cleared;
+            SCP_TRACE_STORE(rings[nring].clear_mark, head);
+        }
+        return count;
+    }
+
+    if (strcmp(argv[0], "dump") != 0)
+    {
+        scp_out_str(out, "ERROR: expected dump or clear!");
+        return 0;
+    }
+
+    file = NULL;
+    if (argc == 2)
+    {
+        path = (char *)malloc(strlen(argv[1]) + sizeof(".json"));
+        if (path == NULL)
+        {
+            scp_out_str(out, "ERROR: out of memory!");
+            return 0;
+        }
+        sprintf(path, "%s.json", argv[1]);
+        file = fopen(path, "w");
+        free(path);
+        if (file == NULL)
+        {
+            scp_out_str(out, "ERROR: cannot open file!");
+            return 0;
+        }
+    }
+
+    count = dump_trace(out, file);
+    if (file)
+        fclose(file);
+    if (count < 0)
+    {
+        scp_out_str(out, "ERROR: out of memory!");
+        return 0;
+    }
+    return count;
+}
+
+#endif /* SCP_TRACE_SIZE */
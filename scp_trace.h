@@ -0,0 +1,195 @@
+/**
+ * \file
+ *
+ * \brief Trace of the dispatch events of the parser.
+ *
+ * Every line parsed records a few fixed size events in a ring buffer of the
+ * thread parsing it, which the 'trace dump' command exports in the Chrome
+ * trace event format, for viewing in chrome://tracing or Perfetto.
+ * Recording an event is a read of the cycle counter and plain stores to the
+ * ring of the thread, so the trace is always on, and threads recording
+ * events do not share a cache line.
+ *
+ * Each ring holds the last #SCP_TRACE_SIZE events of its thread,
+ * overwritten as new ones are recorded. Events are timestamped in cycles,
+ * converted to time when dumped.
+ */
+
+#ifndef SCP_TRACE_H_
+#define SCP_TRACE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+#include "scp_internal.h"
+#include "scp_epoch.h"
+
+/**
+ * Number of events a ring holds, a power of 2, or 0 for no trace.
+ */
+#ifndef SCP_TRACE_SIZE
+    #ifdef SCP_TINY
+        #define SCP_TRACE_SIZE  0
+    #else
+        #define SCP_TRACE_SIZE  4096
+    #endif
+#endif
+
+/*
+ * Types of event.
+ */
+#define SCP_TRACE_LINE      0   /**< Line received, arg is its length. */
+#define SCP_TRACE_LOOKUP    1   /**< Command looked up, -1 if unknown. */
+#define SCP_TRACE_TOKENIZED 2   /**< Arguments split, arg is their count. */
+#define SCP_TRACE_BEGIN     3   /**< Command function called. */
+#define SCP_TRACE_END       4   /**< Command function returned. */
+#define SCP_TRACE_FLUSH     5   /**< Output written, arg is its length. */
+
+/**
+ * \typedef scp_trace_event_t
+ *
+ * \brief An event of the trace.
+ */
+typedef struct {
+    /** Cycle counter, see scp_trace_clock(). */
+    uint64_t            time;
+    /** ID of the command, see scp_lookup_id(), or -1. */
+    int32_t             id;
+    /** Argument of the event, up to 65535. */
+    uint16_t            arg;
+    /** One of the SCP_TRACE_ types. */
+    uint8_t             type;
+    /** Number of the thread recording the event, from 1. */
+    uint8_t             thread;
+} scp_trace_event_t;
+
+#if SCP_TRACE_SIZE
+
+/**
+ * The maximum number of threads recording events at once, each in a ring
+ * of its own. The events of further threads are not recorded.
+ */
+#ifndef SCP_TRACE_THREADS
+    #define SCP_TRACE_THREADS   SCP_EPOCH_MAX_THREADS
+#endif
+
+/**
+ * \typedef scp_trace_ring_t
+ *
+ * \brief The ring of events of a thread.
+ *
+ * Only the thread owning the ring writes it, so recording an event needs no
+ * atomic read-modify-write. A ring is allocated by the first thread to need
+ * it and kept for the next one once its thread exits.
+ */
+typedef struct {
+    /** Number of events ever recorded, the next one's index in events
+     *  modulo #SCP_TRACE_SIZE. */
+    _Alignas(64) uint32_t head;
+    /** Number of the thread owning the ring, from 1. */
+    uint8_t             thread;
+    /** The events. */
+    scp_trace_event_t   events[SCP_TRACE_SIZE];
+} scp_trace_ring_t;
+
+/**
+ * \brief The ring of this thread, NULL until its first event.
+ */
+extern SCP_THREAD_LOCAL scp_trace_ring_t *scp_trace_my_ring;
+
+/**
+ * \brief Claims a ring for the thread recording its first event.
+ *
+ * \return  The ring, or NULL if #SCP_TRACE_THREADS threads already have
+ *          one or it cannot be allocated.
+ */
+scp_trace_ring_t *scp_trace_claim(void);
+
+/*
+ * The head and events are written and read with relaxed atomics on Linux,
+ * where the trace command reads the rings of the other threads.
+ */
+#ifdef __linux__
+    #define SCP_TRACE_STORE(field, value) \
+        __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+    #define SCP_TRACE_LOAD(field) \
+        __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#else
+    #define SCP_TRACE_STORE(field, value)   ((field) = (value))
+    #define SCP_TRACE_LOAD(field)           (field)
+#endif
+
+/**
+ * \brief Reads the cycle counter.
+ *
+ * \return  The cycle counter, or microseconds on a platform without one.
+ */
+static inline uint64_t scp_trace_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t cycles;
+
+    __asm__ volatile ("mrs %0, cntvct_el0" : "=r" (cycles));
+    return cycles;
+#else
+    return scp_time_us();
+#endif
+}
+
+/**
+ * \brief Records an event.
+ *
+ * \param   type    One of the SCP_TRACE_ types.
+ * \param   id      ID of the command, or -1.
+ * \param   arg     Argument of the event, clipped to 65535.
+ */
+static inline void scp_trace(int type, int id, unsigned int arg)
+{
+    scp_trace_ring_t *ring = scp_trace_my_ring;
+    scp_trace_event_t *event;
+    uint32_t head;
+
+    if (ring == NULL && (ring = scp_trace_claim()) == NULL)
+        return;
+
+    head  = ring->head;
+    event = &ring->events[head & (SCP_TRACE_SIZE - 1)];
+    SCP_TRACE_STORE(event->time, scp_trace_clock());
+    SCP_TRACE_STORE(event->id, (int32_t)id);
+    SCP_TRACE_STORE(event->arg,
+            arg > UINT16_MAX ? (uint16_t)UINT16_MAX : (uint16_t)arg);
+    SCP_TRACE_STORE(event->type, (uint8_t)type);
+    SCP_TRACE_STORE(event->thread, ring->thread);
+    SCP_TRACE_STORE(ring->head, head + 1);
+}
+
+/**
+ * \brief Starts the clock the events are timed against.
+ *
+ * Called by scp_init().
+ */
+void scp_trace_init(void);
+
+/**
+ * \brief Trace command.
+ *
+ * -# trace dump [\<name\>] - output the events in the Chrome trace event
+ *    format, each as a value of the response, or write them to \<name\>.json
+ *    as a trace document.
+ * -# trace clear - discard the events.
+ *
+ * Returns the number of events dumped or discarded.
+ */
+int scp_trace_cmd_func(scp_out_t *out, int argc, char *argv[]);
+
+#else
+    #define scp_trace(type, id, arg)    ((void)0)
+    #define scp_trace_init()            ((void)0)
+#endif /* SCP_TRACE_SIZE */
+
+#endif /* SCP_TRACE_H_ */
@@ -8,17 +8,33 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <stdatomic.h>
+#ifdef __linux__
+    #include <pthread.h>
+    #include <time.h>
+    #include <errno.h>
+    #include <poll.h>
+    #include <unistd.h>
+#endif
 
-#include "simple_command_parser.h"
+#include "scp_internal.h"
+#include "scp_epoch.h"
+#include "scp_trace.h"
 
 /*
- * Multiplatform support for putch/putchar and getch/getchar
+ * Multiplatform support for putch/putchar and getch/getchar, or memory with
+ * SCP_MEMORY_IO, see scp_memory_io().
  */
-#ifdef __MINGW32__
+#if defined(SCP_MEMORY_IO)
+    #define PUTCH memory_putch
+    #define GETCH memory_getch
+#elif defined(__MINGW32__)
     #define PUTCH putch
     #define GETCH getch
-#endif
-#if defined(__linux__) || defined(__SAML21J18A__)
+#elif defined(__linux__)
+    #define PUTCH putchar
+    #define GETCH event_getch
+#elif defined(__SAML21J18A__)
     #define PUTCH putchar
     #define GETCH getchar
 #endif
@@ -35,126 +51,311 @@
 #endif
 
 /*
- * In a serial terminal, both \r and \n are required, e.g. on the SAML21.
+ * Multiplatform support for a microsecond clock, used to time commands.
+ */
+unsigned long scp_time_us(void)
+{
+#ifdef __linux__
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)now.tv_sec * 1000000ul +
+        (unsigned long)(now.tv_nsec / 1000);
+#else
+    return 0;
+#endif
+}
+
+#if SCP_NAME_INDEX
+/**
+ * Set in the ref of an entry of a name table for an abbreviation.
+ */
+#define NAME_ABBR           0x80000000u
+
+/**
+ * \typedef name_entry_t
  *
- * The C preprocessor concatenates two string literals next to each other, 
- * for example:
- *      "Hello, World!"NL
+ * \brief A name of a command in a name table.
+ */
+typedef struct {
+    /** Hash of the name, see hash_name(). */
+    uint32_t            hash;
+    /** ID + 1 of the command, with NAME_ABBR set for its abbreviation, 0 if
+     *  the entry is empty. Stored last, with release order. */
+    uint32_t            ref;
+} name_entry_t;
+
+/**
+ * \typedef name_table_t
  *
- * Expands to...
- *      "Hello, World!""\n"
+ * \brief The names of the commands of snapshots, hashed.
  *
- * Which is concatenated to...
- *      "Hello, World!\n"
+ * The names are not copied: an entry holds the hash of a name and the ID
+ * of its command, whose descriptor holds the name. Adding commands adds
+ * their names to the table of the current snapshot in place, while there
+ * is room, and the new snapshot shares the table. Snapshots that do not
+ * have the commands skip their names by ID.
  */
-#ifdef __SAML21J18A__
-    #define NL "\r\n"
-#else
-    #define NL "\n"
+typedef struct {
+    /** Number of snapshots using the table. */
+    atomic_int          refs;
+    /** Number of names and abbreviations. */
+    uint32_t            nnames;
+    /** Number of entries - 1, the number being a power of 2. */
+    uint32_t            mask;
+    /** The entries, by hash, with linear probing. */
+    name_entry_t        entries[];
+} name_table_t;
 #endif
 
 /**
- * Maximum size of the input command string
+ * \typedef block_t
+ *
+ * \brief Typedef of the _block_t struct.
+ */
+typedef struct _block_t block_t;
+
+/**
+ * \struct _block_t
+ *
+ * \brief A block of the registry, holding a table of commands.
+ *
+ * A table added with scp_add_command_table() is one block, used in place.
+ * A command added with scp_add_command() is a block of one, allocated with
+ * the command. Blocks are not modified once in the registry.
+ */
+struct _block_t {
+    /** The commands. */
+    const command_t     *commands;
+    /** Number of commands. */
+    int                 count;
+    /** State of each command, or NULL. */
+    scp_command_state_t *state;
+    /** Non-zero if the block is freed when removed, see free_block(). */
+    int                 allocated;
+    /** ID of the first command, see scp_lookup_id(). */
+    int                 first_id;
+};
+
+/**
+ * \typedef dynamic_command_t
+ *
+ * \brief A command added at run time, with its block.
  */
-#define MAX_INPUT_BUFFER    128
+typedef struct {
+    /** The block holding command. */
+    block_t             block;
+    /** The command. */
+    command_t           command;
+} dynamic_command_t;
 
 /**
- * Maximum number of arguments a command can have
+ * \typedef registry_t
+ *
+ * \brief A snapshot of all the commands defined for the parser.
+ *
+ * Snapshots are never modified. Adding or removing commands publishes a new
+ * snapshot and retires the old one, see scp_epoch.h, so commands are looked
+ * up without a lock while other threads change them.
  */
-#define MAX_ARGC            6
+typedef struct {
+    /** Counts the snapshots published, see #dispatch_cache_t. */
+    unsigned int        generation;
+    /** Number of IDs ever given to commands. */
+    int                 nids;
+    /** The command with each ID, NULL once removed. */
+    const command_t     **ids;
+    /** The state of the command with each ID, NULL if it has none. */
+    scp_command_state_t **states;
+#if SCP_NAME_INDEX
+    /** The names of the commands, NULL until published. */
+    name_table_t        *names;
+#endif
+    /** Number of blocks. */
+    int                 nblocks;
+    /** The blocks, in the order the commands were added. */
+    block_t             *blocks[];
+} registry_t;
 
 /**
- * \typedef command_t
+ * \var registry
  *
- * \brief Typedef of the _command_t struct.
+ * The current snapshot, NULL until scp_init().
+ */
+static _Atomic(registry_t *) registry;
+
+#ifdef __linux__
+/**
+ * \var registry_lock
  *
+ * Serialises the changes to the registry. Readers do not take it.
  */
-typedef struct _command_t command_t;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+    #define LOCK_REGISTRY()     pthread_mutex_lock(&registry_lock)
+    #define UNLOCK_REGISTRY()   pthread_mutex_unlock(&registry_lock)
+#else
+    #define LOCK_REGISTRY()
+    #define UNLOCK_REGISTRY()
+#endif
 
 /**
- * \struct _command_t
+ * \var end_parsing
  *
- * \brief Structure for defining commands to read from the command line.
+ * Flag for the main parse loop, or the script being executed by this thread.
+ * Set to 1 to exit the parse loop. See the built-in 'end' command function -
+ * end_cmd_func().
+ */
+static SCP_THREAD_LOCAL int end_parsing;
+
+/**
+ * \var parse_context
  *
+ * The context of the parse loop.
  */
-struct _command_t{
-    /** Command name string. */
-    const char          *cmd_str;
-    /** Abbreviated command name string. */
-    const char          *abbr_str;
-    /** Command help description */
-    const char          *help_str;
-    /** Minimum number of arguments */
-    int                 min_arg;
-    /** Maximum number of arguments */
-    int                 max_arg;
-    /** Function called for the command */
-    cmd_func_t          func;
-    /** Next command_t node */
-    command_t           *next;
-};
+static scp_ctx_t parse_context = { .out = &scp_output };
 
+/**
+ * \var prompt_count
+ *
+ * Number shown in the 'In [n]>' prompt.
+ */
+static int prompt_count = 1;
 
+#ifdef __linux__
 /**
- * \struct _list_t
+ * \typedef event_source_t
  *
- * List structure for storing all command nodes.
+ * \brief An event source polled by the input loop.
  */
-struct _list_t {
-    command_t           *head;
-    int                 size;
-};
+typedef struct {
+    /** Name shown with the events. */
+    const char          *name;
+    /** File descriptor polled for input. */
+    int                 fd;
+    /** Called when fd is readable. */
+    scp_event_func_t    func;
+    /** Passed to func. */
+    void                *arg;
+} event_source_t;
 
 /**
- * \typedef list_t
+ * \var event_sources
  *
- * Command node list type.
+ * The event sources added with scp_add_event_source().
  */
-typedef struct _list_t list_t;
+static event_source_t event_sources[MAX_EVENT_SOURCES];
 
 /**
- * \var cmd_list
+ * \var nevent_sources
  *
- * List of all commands defined for the parser.
+ * Number of event sources.
+ */
+static int nevent_sources;
+#endif
+
+/**
+ * \var pipe_mode
  *
- * As a static, this will initialise to NULL and 0.
+ * Set when the input is not typed, see scp_set_pipe_mode().
+ */
+static int pipe_mode;
+
+/*
+ * Hooks and state shared with the optional parser modules, see scp_internal.h
  */
-static list_t cmd_list;
+line_hook_t scp_line_hook;
+input_hook_t scp_input_hook;
+remove_hook_t scp_remove_hook;
+release_hook_t scp_release_hook;
+const char *scp_prompt_override;
+SCP_THREAD_LOCAL command_t *scp_current_command;
+SCP_THREAD_LOCAL int scp_last_result;
+SCP_THREAD_LOCAL scp_ctx_t *scp_current_context;
+
 
 /**
- * \var end_parsing
+ * \brief Outputs the prompt for the next line of input.
  *
- * Flag for the main parse loop. Set to 1 to exit the parse loop.
- * See the built-in 'end' command function - end_cmd_func().
+ * There is no prompt in the JSON and CSV output modes, or in the pipe mode.
+ *
+ * \param   out     The output.
  */
-static int end_parsing;
+static void put_prompt(scp_out_t *out)
+{
+    if (out->mode == SCP_MODE_TEXT && !pipe_mode)
+    {
+        if (scp_prompt_override)
+            scp_out_printf(out, "%s> ", scp_prompt_override);
+        else
+            scp_out_printf(out, "In [%d]> ", prompt_count);
+    }
+}
 
 
 /**
  * \brief Help command, which is added to the command parser by default.
  *
- * Lists all the commands that have been added to the parser.
+ * Lists all the commands that have been added to the parser. In the text
+ * output mode this is a table, otherwise the command names are output as
+ * values.
  *
+ * \param out       Output for the list.
  * \param argc      ignored.
  * \param argv      ignored.
  *
- * \returns         0
+ * \returns         1
  */
-static int help_cmd_func(int argc, char *argv[])
+static int help_cmd_func(scp_out_t *out, int argc, char *argv[])
 {
-    command_t *cmd_ptr;
+    const registry_t *reg = atomic_load(&registry);
+    const command_t *command;
+    const block_t *block;
+    int nblock;
+    int idx;
+
+    if (out->mode != SCP_MODE_TEXT)
+    {
+        for (nblock=0; nblock < reg->nblocks; nblock++)
+        {
+            block = reg->blocks[nblock];
+            for (idx=0; idx < block->count; idx++)
+            {
+                scp_out_str(out, CMD_NAME(&block->commands[idx]));
+            }
+        }
+        return 1;
+    }
 
-    printf(NL"%-11s  %-5s  %-61s"NL, "COMMAND", "ABBR", "DESCRIPTION");
+#ifdef SCP_TINY
+    /* There are no descriptions. */
+    scp_out_printf(out, NL"%-11s  %-5s"NL, "COMMAND", "ABBR");
+#else
+    scp_out_printf(out, NL"%-11s  %-5s  %-61s"NL,
+            "COMMAND", "ABBR", "DESCRIPTION");
+#endif
 
-    for (cmd_ptr=cmd_list.head; cmd_ptr; cmd_ptr=cmd_ptr->next)
+    for (nblock=0; nblock < reg->nblocks; nblock++)
     {
-        printf(" %-11s  %-5s  %-61s"NL,
-            cmd_ptr->cmd_str,
-            cmd_ptr->abbr_str,
-            cmd_ptr->help_str
-            );
+        block = reg->blocks[nblock];
+        for (idx=0; idx < block->count; idx++)
+        {
+            command = &block->commands[idx];
+#ifdef SCP_TINY
+            scp_out_printf(out, " %-11s  %-5s"NL,
+                CMD_NAME(command),
+                CMD_ABBR(command) ? CMD_ABBR(command) : ""
+                );
+#else
+            scp_out_printf(out, " %-11s  %-5s  %-61s"NL,
+                CMD_NAME(command),
+                CMD_ABBR(command) ? CMD_ABBR(command) : "",
+                CMD_HELP(command)
+                );
+#endif
+        }
     }
-    printf(NL);
+    scp_out_write(out, NL, sizeof(NL) - 1);
 
     return 1;
 }
@@ -178,263 +379,1734 @@ static int end_cmd_func(int argc, char *argv[])
 
 
 /**
- * \brief Allocates and populates a new command node.
+ * \brief Mode command.
  *
- * Parameters are as for scp_add_command().
+ * Selects the output mode of the output the command is run with, see
+ * scp_set_output_mode().
  *
- * \returns a new command_t node.
+ * \param out       The output.
+ * \param argc      1
+ * \param argv      text, json or csv.
+ *
+ * \returns         1 on success, 0 for an unknown mode.
  */
-static command_t *new_command(
-         const char*    cmd_str,
-         const char*    abbr_str,
-         const char*    help_str,
-         int            min_arg,
-         int            max_arg,
-         cmd_func_t     func
-         )
+static int mode_cmd_func(scp_out_t *out, int argc, char *argv[])
 {
-    command_t *new_cmd = (command_t *)malloc(sizeof(command_t));
-    assert(new_cmd);
-
-    new_cmd->cmd_str    = cmd_str;
-    new_cmd->abbr_str   = abbr_str;
-    new_cmd->help_str   = help_str;
-    new_cmd->min_arg    = min_arg;
-    new_cmd->max_arg    = max_arg;
-    new_cmd->func       = func;
-    new_cmd->next       = NULL;
+    static const char *mode_str[] = {"text", "json", "csv"};
+    int mode;
 
-    return new_cmd;
+    for (mode=SCP_MODE_TEXT; mode <= SCP_MODE_CSV; mode++)
+    {
+        if (strcmp(argv[0], mode_str[mode]) == 0)
+        {
+            out->mode = mode;
+            return 1;
+        }
+    }
+    return 0;
 }
 
 
-/*
- * Initialise the command list by adding the default help command, and
- * the end command, unless the 'do_not_exit' flag is set.
+/**
+ * \var builtin_commands
+ *
+ * The built-in commands. 'end' must be last, as it is left out if the
+ * parser must not exit.
  */
-void scp_init(int do_not_exit)
-{
-
-    /* Make sure we are not re-initialising */
-    assert(cmd_list.head == NULL);
-
-    /* Add the help command */
-    {
-        command_t *help_cmd = new_command(
+static const command_t builtin_commands[] = {
+    SCP_COMMAND_DEF_EX(
             "help",
             "h",
             "Lists all commands available.",
             0,
             0,
             help_cmd_func
-            );
+            ),
+    SCP_COMMAND_DEF_EX(
+            "mode",
+            "",
+            "Output mode <text|json|csv>",
+            1,
+            1,
+            mode_cmd_func
+            ),
+#if SCP_TRACE_SIZE
+    SCP_COMMAND_DEF_EX(
+            "trace",
+            "",
+            "Trace <dump [<name>]|clear>",
+            1,
+            2,
+            scp_trace_cmd_func
+            ),
+#endif
+    SCP_COMMAND_DEF(
+            "end",
+            "end",
+            "Exit the parser.",
+            0,
+            0,
+            end_cmd_func
+            )
+};
+
+/**
+ * \var builtin_block
+ *
+ * The block of the built-in commands.
+ */
+static block_t builtin_block;
 
-        cmd_list.head = help_cmd;
-        cmd_list.size++;
 
-        /* By default, also add the 'end' command. */
-        if (!do_not_exit)
-        {
-            command_t *end_cmd = new_command(
-                "end",
-                "end",
-                "Exit the parser.",
-                0,
-                0,
-                end_cmd_func
-                );
+#ifdef SCP_HAVE_COMMAND_SECTION
+/*
+ * Bounds of the scp_commands section, defined by the linker. Weak, so they
+ * are NULL if no command is defined with SCP_COMMAND().
+ */
+extern const command_t __start_scp_commands[] __attribute__((weak));
+extern const command_t __stop_scp_commands[] __attribute__((weak));
 
-            help_cmd->next = end_cmd;
-            cmd_list.size++;
-        }
+/**
+ * \var section_block
+ *
+ * The block of the commands defined with SCP_COMMAND().
+ */
+static block_t section_block;
+#endif
+
+
+/**
+ * \brief Hashes a name, with FNV-1a.
+ *
+ * \param   name    The name.
+ *
+ * \return  The hash.
+ */
+static uint32_t hash_name(const char *name)
+{
+    const unsigned char *ptr;
+    uint32_t hash = 2166136261u;
+
+    for (ptr=(const unsigned char *)name; *ptr; ptr++)
+    {
+        hash = (hash ^ *ptr) * 16777619u;
     }
+    return hash;
 }
 
 
-/*
- * scp_add_command - adds a new command to the command list.
+#if SCP_NAME_INDEX
+/**
+ * \brief Counts the names of the commands of blocks.
+ *
+ * \param   blocks  The blocks.
+ * \param   count   Number of blocks.
+ *
+ * \return  The number of names and abbreviations.
  */
- void scp_add_command(
-         const char*    cmd_str,
-         const char*    abbr_str,
-         const char*    help_str,
-         int            min_arg,
-         int            max_arg,
-         cmd_func_t     func
-         )
+static uint32_t count_names(block_t *const blocks[], int count)
 {
-    command_t *new_cmd;
-    command_t *cmd_ptr = cmd_list.head;
+    const command_t *command;
+    uint32_t nnames = 0;
+    int nblock;
+    int idx;
 
-    /* Validate scp has been initialised */
-    assert(cmd_list.head);
+    for (nblock=0; nblock < count; nblock++)
+    {
+        for (idx=0; idx < blocks[nblock]->count; idx++)
+        {
+            command = &blocks[nblock]->commands[idx];
+            nnames++;
+            if (CMD_ABBR(command) && *CMD_ABBR(command) &&
+                    strcmp(CMD_ABBR(command), CMD_NAME(command)) != 0)
+                nnames++;
+        }
+    }
+    return nnames;
+}
 
-    /* Validate inputs. */
-    assert(cmd_str);
-    /* abbr_str can be NULL */
-    assert(help_str);
-    assert(min_arg <= max_arg);
-    assert(func);
 
-    /* Validate strings are not too long. */
-    assert(strlen(cmd_str) < MAX_CMD_STR);
-    assert(strlen(abbr_str) < MAX_ABBR_STR);
-    assert(strlen(help_str) < MAX_HELP_STR);
+/**
+ * \brief Adds a name of a command to a name table.
+ *
+ * The table may be in use by readers. A name already in the table keeps its
+ * command, as probing finds the names in the order added.
+ *
+ * \param   names   The table.
+ * \param   name    The name.
+ * \param   ref     ID + 1 of the command, with NAME_ABBR for its
+ *                  abbreviation.
+ */
+static void add_name(name_table_t *names, const char *name, uint32_t ref)
+{
+    uint32_t hash = hash_name(name);
+    uint32_t bucket;
 
-    /* Create a new command node. */
-    new_cmd = new_command(cmd_str, abbr_str, help_str, min_arg, max_arg, func);
+    for (bucket = hash & names->mask;
+            names->entries[bucket].ref;
+            bucket = (bucket + 1) & names->mask);
 
-    /* Add it to the end of the command list */
-    for (cmd_ptr=cmd_list.head; cmd_ptr->next; cmd_ptr = cmd_ptr->next);
-    cmd_ptr->next = new_cmd;
-    cmd_list.size++;
+    names->entries[bucket].hash = hash;
+    __atomic_store_n(&names->entries[bucket].ref, ref, __ATOMIC_RELEASE);
+    names->nnames++;
 }
 
 
 /**
- * \brief Reads keyboard input until [return] is pressed.
- *
- * Reads the keyboard input. Outputs the key pressed and also
- * handles [backspace] for simple editing BUT NOT ANY OTHERS.
- *
- * \param   in_buffer   Pointer to a char array to store the input in.
- * \param   len         Maximum length of the buffer, if reached, function
- *                      returns immediately.
+ * \brief Adds the names of the commands of blocks to a name table.
  *
- * \return  The number of char actually read.
+ * \param   names   The table.
+ * \param   blocks  The blocks, with their IDs given.
+ * \param   count   Number of blocks.
  */
-static int input(char *in_buffer, int len)
+static void add_names(name_table_t *names, block_t *const blocks[],
+        int count)
 {
-    char *ptr = in_buffer;
-    char *max = in_buffer + len;
+    const command_t *command;
+    uint32_t ref;
+    int nblock;
+    int idx;
 
-    /* Read the keyboard until return or max char are read. */
-    while ( (*ptr = GETCH()) != RETURN && ptr < max)
+    for (nblock=0; nblock < count; nblock++)
     {
-        /* A backspace deletes the previous character */
-        if (*ptr == '\b' || (int)*ptr == 127)
+        for (idx=0; idx < blocks[nblock]->count; idx++)
         {
-            if (ptr > in_buffer)
-            {
-                --ptr;
-                /* Backspace, print space over the char, backspace again. */
-                printf("\b \b");
-            }
+            command = &blocks[nblock]->commands[idx];
+            ref     = (uint32_t)(blocks[nblock]->first_id + idx + 1);
+            add_name(names, CMD_NAME(command), ref);
+            if (CMD_ABBR(command) && *CMD_ABBR(command) &&
+                    strcmp(CMD_ABBR(command), CMD_NAME(command)) != 0)
+                add_name(names, CMD_ABBR(command), ref | NAME_ABBR);
         }
-        else
+    }
+}
+
+
+/**
+ * \brief Indexes the names of the commands of a new snapshot.
+ *
+ * When commands are only added, their names are added to the table of the
+ * old snapshot while it stays at most 3/4 full, otherwise the table is
+ * rebuilt twice the size of the names, so adding commands one by one costs
+ * the same per command however many there are.
+ *
+ * \param   reg     The new snapshot, with its blocks filled in.
+ * \param   old     The old snapshot, or NULL.
+ * \param   first   Index of the first block of reg not in old, or 0 if
+ *                  commands were removed.
+ */
+static void index_names(registry_t *reg, const registry_t *old, int first)
+{
+    name_table_t *names;
+    uint32_t nnames;
+    uint32_t size = 8;
+
+    if (first > 0)
+    {
+        names  = old->names;
+        nnames = count_names(&reg->blocks[first], reg->nblocks - first);
+        if (4 * (names->nnames + nnames) <= 3 * (names->mask + 1))
         {
-            PUTCH(*ptr++);
+            atomic_fetch_add(&names->refs, 1);
+            add_names(names, &reg->blocks[first], reg->nblocks - first);
+            reg->names = names;
+            return;
         }
     }
-    /* Replace the last read character with a 0 to terminate the string. */
-    *ptr = '\0';
 
-    return (int)(ptr - in_buffer);
+    nnames = count_names(reg->blocks, reg->nblocks);
+    while (size < 2 * nnames)
+        size *= 2;
+
+    names = (name_table_t *)calloc(1,
+            sizeof(name_table_t) + size * sizeof(name_entry_t));
+    assert(names);
+    atomic_init(&names->refs, 1);
+    names->mask = size - 1;
+    add_names(names, reg->blocks, reg->nblocks);
+    reg->names = names;
+}
+#endif /* SCP_NAME_INDEX */
+
+
+/**
+ * \brief Frees a snapshot of the registry.
+ *
+ * \param   ptr     The snapshot.
+ */
+static void free_registry(void *ptr)
+{
+    registry_t *reg = (registry_t *)ptr;
+
+#if SCP_NAME_INDEX
+    if (atomic_fetch_sub(&reg->names->refs, 1) == 1)
+        free(reg->names);
+#endif
+    free(reg);
 }
 
 
 /**
- * /brief Search for matching command function.
+ * \brief Allocates a snapshot of the registry.
+ *
+ * The blocks and the arrays indexed by ID are allocated with the snapshot.
  *
- * Search the list of 'command_t' structures for the one that matches
- * either the cmd_str or abbr_str (if defined). Simple linear search.
+ * \param   nblocks Number of blocks.
+ * \param   nids    Number of IDs.
+ *
+ * \return  The snapshot, with its blocks to fill in.
+ */
+static registry_t *new_registry(int nblocks, int nids)
+{
+    registry_t *reg;
+
+    reg = (registry_t *)malloc(sizeof(registry_t) +
+            nblocks * sizeof(block_t *) + nids * sizeof(command_t *) +
+            nids * sizeof(scp_command_state_t *));
+    assert(reg);
+    reg->nblocks = nblocks;
+    reg->nids    = nids;
+    reg->ids     = (const command_t **)&reg->blocks[nblocks];
+    reg->states  = (scp_command_state_t **)&reg->ids[nids];
+#if SCP_NAME_INDEX
+    reg->names   = NULL;
+#endif
+    return reg;
+}
+
+
+/**
+ * \brief Publishes a new snapshot of the registry and retires the old one.
  *
- * \param   name    Command name to search for.
+ * Must be called with the registry locked.
  *
- * \return  The cmd_func_t function pointer for that command or NULL if the
- *          command wasn't found.
+ * \param   reg     The new snapshot, with its blocks filled in.
+ * \param   first   Index of the first block added to the old snapshot, or
+ *                  0 if commands were removed.
  */
-static command_t *find_command(const char *name)
+static void publish(registry_t *reg, int first)
 {
-    command_t *cmd_ptr;
+    registry_t *old = atomic_load(&registry);
+    block_t *block;
+    int nblock;
+    int idx;
 
-    for (cmd_ptr=cmd_list.head; cmd_ptr; cmd_ptr = cmd_ptr->next)
+    /* Commands added have new IDs, after those of the old snapshot. */
+    if (first > 0)
+    {
+        memcpy(reg->ids, old->ids, old->nids * sizeof(command_t *));
+        memcpy(reg->states, old->states,
+                old->nids * sizeof(scp_command_state_t *));
+    }
+    else
+    {
+        memset(reg->ids, 0, reg->nids * sizeof(command_t *));
+        memset(reg->states, 0, reg->nids * sizeof(scp_command_state_t *));
+    }
+    for (nblock=first; nblock < reg->nblocks; nblock++)
     {
-        if (
-                strcmp(name, cmd_ptr->cmd_str) == 0 ||
-                (
-                    cmd_ptr->abbr_str &&
-                    strcmp(name, cmd_ptr->abbr_str) == 0
-                )
-           )
+        block = reg->blocks[nblock];
+        for (idx=0; idx < block->count; idx++)
         {
-            return  cmd_ptr;
+            reg->ids[block->first_id + idx]    = &block->commands[idx];
+            reg->states[block->first_id + idx] =
+                block->state ? &block->state[idx] : NULL;
         }
     }
-    return NULL;
+
+#if SCP_NAME_INDEX
+    index_names(reg, old, first);
+#else
+    (void)first;
+#endif
+    reg->generation = old ? old->generation + 1 : 1;
+    atomic_store(&registry, reg);
+    if (old)
+        scp_epoch_retire(free_registry, old);
 }
 
 
 /**
- * scp_parse function.
+ * \brief Frees a block removed from the registry.
+ *
+ * \param   ptr     The block.
  */
-void scp_parse(void)
+static void free_block(void *ptr)
 {
-    char strbuff[MAX_INPUT_BUFFER];
-    char *argv[MAX_ARGC];
-    int argc = 0;
-    int length;
-    int count = 1;
-    char *token;
-    command_t *command;
-
-    /* Call the built-in 'help' command to display the commands already
-     * added to the parser.
-     */
-    help_cmd_func(0, NULL);
+    block_t *block = (block_t *)ptr;
 
-    /* While the 'end_parsing' flag is not set, keep parsing commands.
-     * This flag can be set be the 'end' command - if it is enabled.
-     */
-    while (end_parsing == 0)
-    {
-        printf("In [%d]> ", count);
-        length = input(strbuff, MAX_INPUT_BUFFER);
-        printf(NL);
+    if (block->allocated)
+        free(block);
+}
 
-        /* If the input is empty (string size 0) then continue. */
-        if (length == 0)
-            continue;
 
-        token = strtok(strbuff, " .,");
+/**
+ * \brief Adds blocks to the end of the registry.
+ *
+ * \param   blocks  The blocks.
+ * \param   count   Number of blocks.
+ */
+static void add_blocks(block_t *blocks[], int count)
+{
+    registry_t *old;
+    registry_t *reg;
+    int nold;
+    int nids;
+    int idx;
 
-        if ( (command = find_command(token)) != NULL)
-        {
-            argc = 0;
-            while (
-                    (token = strtok( NULL, " .,")) != NULL &&
-                    argc < MAX_ARGC
-                  )
-            {
-                argv[argc++] = token;
-            }
+    LOCK_REGISTRY();
+    old  = atomic_load(&registry);
+    nold = old ? old->nblocks : 0;
+    nids = old ? old->nids : 0;
 
-            if (argc < command->min_arg)
-            {
-                printf("Out[%d]> ERROR: [%s] too few args (less than %d)!",
-                        count,
-                        command->cmd_str,
-                        command->min_arg
-                      );
-            }
-            else if (argc > command->max_arg)
-            {
-                printf("Out[%d]> ERROR: [%s] too many args (more than %d)!",
-                        count,
-                        command->cmd_str,
-                        command->max_arg
-                      );
-            }
-            else {
-                printf("Out[%d]> %d", count, (*command->func)(argc, argv));
-            }
-        }
-        else
-        {
-            printf("Out[%d]> Unknown Command: %s", count, token);
-        }
-        printf (NL);
-        ++count;
+    /* IDs are never reused, so they stay valid or become invalid. */
+    for (idx=0; idx < count; idx++)
+    {
+        blocks[idx]->first_id = nids;
+        nids += blocks[idx]->count;
     }
+
+    reg = new_registry(nold + count, nids);
+    if (old)
+        memcpy(reg->blocks, old->blocks, nold * sizeof(block_t *));
+    memcpy(&reg->blocks[nold], blocks, count * sizeof(block_t *));
+    publish(reg, nold);
+    UNLOCK_REGISTRY();
 }
 
+
+/**
+ * \brief Adds a block to the end of the registry.
+ *
+ * \param   block   The block.
+ */
+static void add_block(block_t *block)
+{
+    add_blocks(&block, 1);
+}
+
+
+/**
+ * \brief Validates a command.
+ *
+ * \param   command The command.
+ */
+static void validate_command(const command_t *command)
+{
+    /* Validate inputs. */
+    assert(CMD_NAME(command));
+    /* abbr_str can be NULL */
+    assert(command->min_arg <= command->max_arg);
+    assert(CMD_FUNC(command) || CMD_EX_FUNC(command));
+
+    /* Validate strings are not too long. */
+    assert(strlen(CMD_NAME(command)) < MAX_CMD_STR);
+    assert(!CMD_ABBR(command) || strlen(CMD_ABBR(command)) < MAX_ABBR_STR);
+    assert(strlen(CMD_HELP(command)) < MAX_HELP_STR);
+    (void)command;
+}
+
+
+/*
+ * Initialise the command list by adding the default help command, and
+ * the end command, unless the 'do_not_exit' flag is set, then the commands
+ * defined with SCP_COMMAND().
+ */
+void scp_init(int do_not_exit)
+{
+    int count = sizeof(builtin_commands) / sizeof(builtin_commands[0]);
+
+    /* Make sure we are not re-initialising */
+    assert(atomic_load(&registry) == NULL);
+
+    scp_trace_init();
+
+#if defined(__linux__) && !defined(SCP_MEMORY_IO)
+    scp_set_pipe_mode(!isatty(STDIN_FILENO));
+#endif
+
+    builtin_block.commands = builtin_commands;
+    builtin_block.count    = do_not_exit ? count - 1 : count;
+    add_block(&builtin_block);
+
+#ifdef SCP_HAVE_COMMAND_SECTION
+    if (&__start_scp_commands[0] != &__stop_scp_commands[0])
+    {
+#ifndef NDEBUG
+        const command_t *command;
+
+        for (command=__start_scp_commands; command < __stop_scp_commands;
+                command++)
+        {
+            validate_command(command);
+        }
+#endif
+        section_block.commands = __start_scp_commands;
+        section_block.count    =
+            (int)(__stop_scp_commands - __start_scp_commands);
+        add_block(&section_block);
+    }
+#endif
+}
+
+
+/**
+ * \brief Validates and adds a new command to the end of the command list.
+ *
+ * Parameters are as for scp_add_command(), with either func or ex_func
+ * set to NULL.
+ */
+static void add_command(
+         const char*    cmd_str,
+         const char*    abbr_str,
+         const char*    help_str,
+         int            min_arg,
+         int            max_arg,
+         cmd_func_t     func,
+         cmd_ex_func_t  ex_func
+         )
+{
+    dynamic_command_t *new_cmd;
+    command_t *command;
+
+    /* Validate scp has been initialised */
+    assert(atomic_load(&registry));
+    assert(help_str);
+
+    /* Create a new command node. */
+    new_cmd = (dynamic_command_t *)malloc(sizeof(dynamic_command_t));
+    assert(new_cmd);
+    command = &new_cmd->command;
+
+    command->cmd_str    = cmd_str;
+    command->abbr_str   = abbr_str;
+    command->min_arg    = min_arg;
+    command->max_arg    = max_arg;
+#ifdef SCP_TINY
+    (void)help_str;
+    assert(min_arg >= 0 && max_arg <= 255);
+    command->is_ex      = ex_func != NULL;
+    if (ex_func)
+        command->fn.ex_func = ex_func;
+    else
+        command->fn.func    = func;
+#else
+    command->help_str   = help_str;
+    command->func       = func;
+    command->ex_func    = ex_func;
+#endif
+    validate_command(command);
+
+    /* Add it to the end of the command list */
+    new_cmd->block.commands  = command;
+    new_cmd->block.count     = 1;
+    new_cmd->block.state     = NULL;
+    new_cmd->block.allocated = 1;
+    add_block(&new_cmd->block);
+}
+
+
+/*
+ * Adds a table of commands.
+ */
+void scp_add_command_table(
+        const scp_command_t *table,
+        int count,
+        scp_command_state_t *state
+        )
+{
+    block_t *block;
+    int idx;
+
+    assert(atomic_load(&registry));
+    assert(table && count > 0);
+
+#ifndef NDEBUG
+    for (idx=0; idx < count; idx++)
+    {
+        validate_command(&table[idx]);
+    }
+#endif
+
+    if (state)
+    {
+        for (idx=0; idx < count; idx++)
+        {
+            state[idx].calls = 0;
+        }
+    }
+
+    block = (block_t *)malloc(sizeof(block_t));
+    assert(block);
+    block->commands  = table;
+    block->count     = count;
+    block->state     = state;
+    block->allocated = 1;
+    add_block(block);
+}
+
+
+/*
+ * scp_add_command - adds a new command to the command list.
+ */
+ void scp_add_command(
+         const char*    cmd_str,
+         const char*    abbr_str,
+         const char*    help_str,
+         int            min_arg,
+         int            max_arg,
+         cmd_func_t     func
+         )
+{
+    assert(func);
+    add_command(cmd_str, abbr_str, help_str, min_arg, max_arg, func, NULL);
+}
+
+
+/*
+ * scp_add_command_ex - adds a new command that outputs values.
+ */
+ void scp_add_command_ex(
+         const char*    cmd_str,
+         const char*    abbr_str,
+         const char*    help_str,
+         int            min_arg,
+         int            max_arg,
+         cmd_ex_func_t  ex_func
+         )
+{
+    assert(ex_func);
+    add_command(cmd_str, abbr_str, help_str, min_arg, max_arg, NULL, ex_func);
+}
+
+
+/**
+ * \brief Makes a block of part of the table of another block.
+ *
+ * \param   block   The block.
+ * \param   first   Index of the first command of the part.
+ * \param   count   Number of commands in the part.
+ *
+ * \return  The new block.
+ */
+static block_t *split_block(const block_t *block, int first, int count)
+{
+    block_t *part = (block_t *)malloc(sizeof(block_t));
+
+    assert(part);
+    part->commands  = block->commands + first;
+    part->count     = count;
+    part->state     = block->state ? block->state + first : NULL;
+    part->allocated = 1;
+    part->first_id  = block->first_id + first;
+    return part;
+}
+
+
+/*
+ * Removes a command.
+ */
+int scp_remove_command(const char *name)
+{
+    const command_t *command;
+    registry_t *old;
+    registry_t *reg;
+    block_t *block = NULL;
+    int nblock;
+    int idx;
+
+    assert(name);
+
+    LOCK_REGISTRY();
+    old = atomic_load(&registry);
+    assert(old);
+
+    if ((command = scp_find_command(name)) == NULL)
+    {
+        UNLOCK_REGISTRY();
+        return 0;
+    }
+
+    /* The new snapshot has the block in up to two parts, without command. */
+    reg = new_registry(old->nblocks + 1, old->nids);
+    reg->nblocks = 0;
+    for (nblock=0; nblock < old->nblocks; nblock++)
+    {
+        block_t *other = old->blocks[nblock];
+
+        if (block || command < other->commands ||
+                command >= other->commands + other->count)
+        {
+            reg->blocks[reg->nblocks++] = other;
+            continue;
+        }
+
+        block = other;
+        idx = (int)(command - block->commands);
+        if (idx > 0)
+            reg->blocks[reg->nblocks++] = split_block(block, 0, idx);
+        if (idx < block->count - 1)
+            reg->blocks[reg->nblocks++] =
+                split_block(block, idx + 1, block->count - idx - 1);
+    }
+    publish(reg, 0);
+    UNLOCK_REGISTRY();
+
+    if (scp_remove_hook)
+        (*scp_remove_hook)(command);
+
+    /* The command may be running, in this thread or another. */
+    scp_epoch_retire(free_block, block);
+    return 1;
+}
+
+
+/*
+ * Removes the commands of a table.
+ */
+int scp_remove_command_table(const scp_command_t *table, int count)
+{
+    registry_t *old;
+    registry_t *reg;
+    block_t **removed;
+    block_t *block;
+    int nremoved = 0;
+    int ncommands = 0;
+    int nblock;
+    int idx;
+
+    assert(table && count > 0);
+
+    LOCK_REGISTRY();
+    old = atomic_load(&registry);
+    assert(old);
+
+    /* The table may have been split by scp_remove_command(). */
+    reg = new_registry(old->nblocks, old->nids);
+    reg->nblocks = 0;
+    removed = (block_t **)malloc(old->nblocks * sizeof(block_t *));
+    assert(removed);
+    for (nblock=0; nblock < old->nblocks; nblock++)
+    {
+        block = old->blocks[nblock];
+        if (block->commands >= table && block->commands < table + count)
+        {
+            removed[nremoved++] = block;
+            ncommands += block->count;
+        }
+        else
+        {
+            reg->blocks[reg->nblocks++] = block;
+        }
+    }
+
+    if (nremoved)
+        publish(reg, 0);
+    else
+        free(reg);
+    UNLOCK_REGISTRY();
+
+    for (nblock=0; nblock < nremoved; nblock++)
+    {
+        block = removed[nblock];
+        for (idx=0; scp_remove_hook && idx < block->count; idx++)
+        {
+            (*scp_remove_hook)(&block->commands[idx]);
+        }
+        scp_epoch_retire(free_block, block);
+    }
+    free(removed);
+
+    return ncommands;
+}
+
+
+/*
+ * Replaces a command with a new descriptor.
+ */
+command_t *scp_replace_command(
+        const command_t *command,
+        const char      *help_str,
+        int             min_arg,
+        int             max_arg
+        )
+{
+    dynamic_command_t *new_cmd;
+    command_t *replacement;
+    registry_t *old;
+    registry_t *reg;
+    block_t *block = NULL;
+    size_t help_len;
+    int nblock;
+    int idx;
+
+    assert(command && help_str);
+
+    /* The help string is copied after the new command. */
+#ifdef SCP_TINY
+    help_len = 0;
+#else
+    help_len = strlen(help_str) + 1;
+#endif
+    new_cmd = (dynamic_command_t *)malloc(sizeof(dynamic_command_t) +
+            help_len);
+    assert(new_cmd);
+    replacement = &new_cmd->command;
+    *replacement = *command;
+    replacement->min_arg = min_arg;
+    replacement->max_arg = max_arg;
+#ifdef SCP_TINY
+    assert(min_arg >= 0 && max_arg <= 255);
+#else
+    memcpy(new_cmd + 1, help_str, help_len);
+    replacement->help_str = (const char *)(new_cmd + 1);
+#endif
+    validate_command(replacement);
+
+    LOCK_REGISTRY();
+    old = atomic_load(&registry);
+    assert(old);
+
+    /* The new snapshot has the block in up to three parts, the middle one
+     * the new command with the ID and state of the one it replaces.
+     */
+    reg = new_registry(old->nblocks + 2, old->nids);
+    reg->nblocks = 0;
+    for (nblock=0; nblock < old->nblocks; nblock++)
+    {
+        block_t *other = old->blocks[nblock];
+
+        if (block || command < other->commands ||
+                command >= other->commands + other->count)
+        {
+            reg->blocks[reg->nblocks++] = other;
+            continue;
+        }
+
+        block = other;
+        idx = (int)(command - block->commands);
+        if (idx > 0)
+            reg->blocks[reg->nblocks++] = split_block(block, 0, idx);
+
+        new_cmd->block.commands  = replacement;
+        new_cmd->block.count     = 1;
+        new_cmd->block.state     = block->state ? &block->state[idx] : NULL;
+        new_cmd->block.allocated = 1;
+        new_cmd->block.first_id  = block->first_id + idx;
+        reg->blocks[reg->nblocks++] = &new_cmd->block;
+
+        if (idx < block->count - 1)
+            reg->blocks[reg->nblocks++] =
+                split_block(block, idx + 1, block->count - idx - 1);
+    }
+
+    if (block == NULL)
+    {
+        UNLOCK_REGISTRY();
+        free(reg);
+        free(new_cmd);
+        return NULL;
+    }
+    publish(reg, 0);
+    UNLOCK_REGISTRY();
+
+    /* The command may be running, in this thread or another. */
+    scp_epoch_retire(free_block, block);
+    return replacement;
+}
+
+
+/*
+ * Selects the output mode.
+ */
+void scp_set_output_mode(int mode)
+{
+    assert(mode >= SCP_MODE_TEXT && mode <= SCP_MODE_CSV);
+    scp_output.mode = mode;
+}
+
+
+/*
+ * Selects the pipe mode.
+ */
+void scp_set_pipe_mode(int pipe)
+{
+    pipe_mode = pipe;
+#ifndef SCP_MEMORY_IO
+    if (pipe)
+        setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+#endif
+}
+
+
+/*
+ * Returns the pipe mode.
+ */
+int scp_get_pipe_mode(void)
+{
+    return pipe_mode;
+}
+
+
+/*
+ * Calls the function of a command.
+ */
+int scp_call(scp_out_t *out, command_t *command, int id, int argc,
+        char *argv[])
+{
+    registry_t *reg = atomic_load(&registry);
+    scp_command_state_t *state;
+
+    /* Count the call in the state of a table with one. IDs are never
+     * reused, so a removed command has none.
+     */
+    if ((unsigned int)id < (unsigned int)reg->nids &&
+            (state = reg->states[id]) != NULL)
+    {
+        /* Relaxed, as the command can be called by several threads. */
+        __atomic_fetch_add(&state->calls, 1, __ATOMIC_RELAXED);
+    }
+
+    if (CMD_EX_FUNC(command))
+        return (*CMD_EX_FUNC(command))(out, argc, argv);
+
+    scp_out_flush(out);
+    return (*CMD_FUNC(command))(argc, argv);
+}
+
+
+#ifdef __linux__
+/*
+ * Add an event source to the input loop.
+ */
+int scp_add_event_source(const char *name, int fd, scp_event_func_t func,
+        void *arg)
+{
+    event_source_t *source;
+
+    assert(name);
+    assert(fd >= 0);
+    assert(func);
+
+    if (nevent_sources == MAX_EVENT_SOURCES)
+        return 0;
+
+    source = &event_sources[nevent_sources++];
+    source->name = name;
+    source->fd   = fd;
+    source->func = func;
+    source->arg  = arg;
+    return 1;
+}
+
+
+/*
+ * Remove an event source.
+ */
+void scp_remove_event_source(int fd)
+{
+    int idx;
+
+    for (idx=0; idx < nevent_sources; idx++)
+    {
+        if (event_sources[idx].fd == fd)
+        {
+            event_sources[idx] = event_sources[--nevent_sources];
+            return;
+        }
+    }
+}
+
+
+#ifndef SCP_MEMORY_IO
+/**
+ * \brief Calls the handler of a readable event source.
+ *
+ * If the handler outputs values, they are displayed as a response and in the
+ * text mode the prompt is displayed again.
+ *
+ * \param   source  The event source.
+ */
+static void dispatch_event(event_source_t *source)
+{
+    scp_out_t *out = &scp_output;
+    int result;
+
+    scp_out_begin(out, 0, source->name);
+    result = (*source->func)(out, source->fd, source->arg);
+    if (out->nvalues)
+    {
+        scp_out_end(out, STATUS_OK, result);
+        put_prompt(out);
+    }
+    scp_out_flush(out);
+}
+
+
+/**
+ * \brief Reads a character from stdin, handling events while waiting.
+ *
+ * stdin is read directly rather than through stdio, so that poll() sees all
+ * the input not yet returned.
+ *
+ * \return  The character, or EOF at the end of the input.
+ */
+static int event_getch(void)
+{
+    static char buffer[MAX_INPUT_BUFFER];
+    static int len;
+    static int pos;
+    struct pollfd fds[MAX_EVENT_SOURCES + 1];
+    event_source_t sources[MAX_EVENT_SOURCES];
+    int nsources;
+    int ready;
+    int idx;
+
+    while (pos == len)
+    {
+        /* Handlers may remove sources, so poll a copy. */
+        nsources = nevent_sources;
+        memcpy(sources, event_sources, sizeof(sources));
+
+        fds[0].fd     = STDIN_FILENO;
+        fds[0].events = POLLIN;
+        for (idx=0; idx < nsources; idx++)
+        {
+            fds[idx + 1].fd     = sources[idx].fd;
+            fds[idx + 1].events = POLLIN;
+        }
+
+        /* Input is echoed through stdio. The output of the pipe mode is
+         * only flushed when there is nothing to read, as the other end
+         * may be waiting for it before it writes more.
+         */
+        if (!pipe_mode)
+            fflush(stdout);
+        ready = poll(fds, (nfds_t)(nsources + 1), pipe_mode ? 0 : -1);
+        if (ready == 0)
+        {
+            fflush(stdout);
+            ready = poll(fds, (nfds_t)(nsources + 1), -1);
+        }
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return EOF;
+        }
+
+        for (idx=0; idx < nsources; idx++)
+        {
+            short revents = fds[idx + 1].revents;
+
+            if (revents & (POLLERR | POLLHUP | POLLNVAL))
+                scp_remove_event_source(sources[idx].fd);
+            else if (revents & POLLIN)
+                dispatch_event(&sources[idx]);
+        }
+
+        if (fds[0].revents)
+        {
+            pos = 0;
+            len = (int)read(STDIN_FILENO, buffer, sizeof(buffer));
+            if (len <= 0)
+            {
+                len = 0;
+                return EOF;
+            }
+        }
+    }
+    return (unsigned char)buffer[pos++];
+}
+#endif /* SCP_MEMORY_IO */
+#endif /* __linux__ */
+
+
+#ifdef SCP_MEMORY_IO
+/**
+ * \var memory_input
+ *
+ * The input not yet read, see scp_memory_io().
+ */
+static const char *memory_input;
+
+/**
+ * \var memory_input_len
+ *
+ * Number of characters of input not yet read.
+ */
+static int memory_input_len;
+
+/**
+ * \var memory_output
+ *
+ * The output, truncated to SCP_MEMORY_OUTPUT characters.
+ */
+static char memory_output[SCP_MEMORY_OUTPUT + 1];
+
+/**
+ * \var memory_output_len
+ *
+ * Number of characters in memory_output.
+ */
+static int memory_output_len;
+
+
+/*
+ * Sets the input and discards the output.
+ */
+void scp_memory_io(const char *input, int len)
+{
+    assert(input || len == 0);
+
+    memory_input      = input;
+    memory_input_len  = len;
+    memory_output_len = 0;
+}
+
+
+/*
+ * Appends to the output.
+ */
+void scp_memory_write(const char *data, int len)
+{
+    if (len > SCP_MEMORY_OUTPUT - memory_output_len)
+        len = SCP_MEMORY_OUTPUT - memory_output_len;
+    memcpy(&memory_output[memory_output_len], data, len);
+    memory_output_len += len;
+}
+
+
+/*
+ * Returns the output.
+ */
+const char *scp_memory_output(int *len)
+{
+    memory_output[memory_output_len] = '\0';
+    if (len)
+        *len = memory_output_len;
+    return memory_output;
+}
+
+
+/**
+ * \brief Reads a character of the input set by scp_memory_io().
+ *
+ * \return  The character, or EOF at the end of the input.
+ */
+static int memory_getch(void)
+{
+    if (memory_input_len == 0)
+        return EOF;
+    --memory_input_len;
+    return (unsigned char)*memory_input++;
+}
+
+
+/**
+ * \brief Appends a character to the output.
+ *
+ * \param   ch      The character.
+ *
+ * \return  The character.
+ */
+static int memory_putch(int ch)
+{
+    char data = (char)ch;
+
+    scp_memory_write(&data, 1);
+    return ch;
+}
+#endif /* SCP_MEMORY_IO */
+
+
+/*
+ * Values returned by input() other than the length of the line.
+ */
+#define INPUT_END           (-1)    /**< End of the input. */
+#define INPUT_TOO_LONG      (-2)    /**< Line too long, discarded. */
+
+/**
+ * \brief Reads keyboard input until [return] is pressed.
+ *
+ * Reads the keyboard input. Outputs the key pressed and also
+ * handles [backspace] for simple editing BUT NOT ANY OTHERS.
+ *
+ * \param   in_buffer   Pointer to a char array to store the input in.
+ * \param   len         Size of the buffer, including the terminating 0. A
+ *                      line of more than len - 1 characters is read up to
+ *                      its [return] and discarded, so none of it is taken
+ *                      for the next line.
+ * \param   echo        Set to 0 to not output the keys pressed.
+ *
+ * \return  The number of char actually read, #INPUT_END at the end of the
+ *          input or #INPUT_TOO_LONG for a line too long, with its first
+ *          len - 1 characters in in_buffer.
+ */
+static int input(char *in_buffer, int len, int echo)
+{
+    char *ptr = in_buffer;
+    char *max = in_buffer + len - 1;
+    int excess = 0;
+    int ch;
+
+    /* Read the keyboard until return or the end of the input. A character
+     * is only stored once there is space for it, and the others counted.
+     */
+    while ((ch = GETCH()) != RETURN)
+    {
+        /* The end of the input ends a last line without a return. */
+        if (ch == EOF)
+        {
+            if (ptr == in_buffer && excess == 0)
+                return INPUT_END;
+            break;
+        }
+
+        /* A backspace deletes the previous character */
+        if (ch == '\b' || ch == 127)
+        {
+            if (excess > 0 || ptr > in_buffer)
+            {
+                if (excess > 0)
+                    excess--;
+                else
+                    --ptr;
+                /* Backspace, print space over the char, backspace again. */
+                if (echo)
+                {
+                    PUTCH('\b');
+                    PUTCH(' ');
+                    PUTCH('\b');
+                }
+            }
+        }
+        else
+        {
+            if (ptr < max)
+                *ptr++ = (char)ch;
+            else
+                excess++;
+            if (echo)
+                PUTCH(ch);
+        }
+    }
+    /* Terminate the string after the last character read. */
+    *ptr = '\0';
+
+    return excess ? INPUT_TOO_LONG : (int)(ptr - in_buffer);
+}
+
+
+#if !SCP_NAME_INDEX
+/**
+ * \brief Compares a name of a command with a token.
+ *
+ * Inline rather than strcmp(), so a name that differs early, as most do, is
+ * rejected without a call. Nothing is stored per name, so the #SCP_NAME_INDEX
+ * 0 build uses no RAM for it.
+ *
+ * \param   cmd     The name or abbreviation, or NULL.
+ * \param   token   The token.
+ *
+ * \return  1 if they are equal, otherwise 0.
+ */
+static inline int same_name(const char *cmd, const char *token)
+{
+    if (cmd == NULL)
+        return 0;
+
+    while (*cmd == *token)
+    {
+        if (*cmd == '\0')
+            return 1;
+        cmd++;
+        token++;
+    }
+    return 0;
+}
+#endif
+
+
+/**
+ * \brief Search a snapshot of the registry for a hashed name.
+ *
+ * Probes the name table from the entry of the hash, comparing the hash of
+ * each name before the name itself. Without the table, in the
+ * #SCP_NAME_INDEX 0 build, the blocks are searched in order.
+ *
+ * \param   reg     The snapshot.
+ * \param   name    Command or abbreviated command name to search for.
+ * \param   hash    Hash of name, see hash_name().
+ *
+ * \return  ID of the matching command or -1 if the command wasn't found.
+ */
+static int find_hashed(registry_t *reg, const char *name, uint32_t hash)
+{
+#if SCP_NAME_INDEX
+    const name_table_t *names = reg->names;
+    const name_entry_t *entry;
+    const command_t *command;
+    uint32_t bucket;
+    uint32_t ref;
+    uint32_t id;
+
+    for (bucket = hash & names->mask;
+            (ref = __atomic_load_n(&(entry = &names->entries[bucket])->ref,
+                __ATOMIC_ACQUIRE)) != 0;
+            bucket = (bucket + 1) & names->mask)
+    {
+        if (entry->hash != hash)
+            continue;
+
+        /* The table may hold names of commands added since, or removed. */
+        id = (ref & ~NAME_ABBR) - 1;
+        if (id >= (uint32_t)reg->nids || (command = reg->ids[id]) == NULL)
+            continue;
+        if (strcmp(ref & NAME_ABBR ? CMD_ABBR(command) : CMD_NAME(command),
+                    name) == 0)
+            return (int)id;
+    }
+    return -1;
+#else
+    const command_t *command;
+    const block_t *block;
+    int nblock;
+    int idx;
+
+    (void)hash;
+    for (nblock=0; nblock < reg->nblocks; nblock++)
+    {
+        block = reg->blocks[nblock];
+        for (idx=0; idx < block->count; idx++)
+        {
+            command = &block->commands[idx];
+            if (same_name(CMD_NAME(command), name) ||
+                    same_name(CMD_ABBR(command), name))
+                return block->first_id + idx;
+        }
+    }
+    return -1;
+#endif
+}
+
+
+/**
+ * \brief Search a snapshot of the registry for a command.
+ *
+ * Search the command tables for the one that matches either the cmd_str or
+ * abbr_str (if defined). The first command added with the name is found.
+ *
+ * \param   reg     The snapshot.
+ * \param   name    Command or abbreviated command name to search for.
+ *
+ * \return  The matching command_t or NULL if the command wasn't found.
+ */
+static command_t *find_command(registry_t *reg, const char *name)
+{
+    int id = find_hashed(reg, name, hash_name(name));
+
+    /* Commands are not modified once published, see scp_replace_command(),
+     * but are returned as for scp_find_command().
+     */
+    return id < 0 ? NULL : (command_t *)reg->ids[id];
+}
+
+
+/*
+ * Search the current snapshot of the registry.
+ */
+command_t *scp_find_command(const char *name)
+{
+    return find_command(atomic_load(&registry), name);
+}
+
+
+/*
+ * Search the dispatch cache, then the registry.
+ */
+command_t *scp_find_command_cached(dispatch_cache_t *cache, const char *name,
+        int *id)
+{
+    registry_t *reg = atomic_load(&registry);
+    cache_entry_t *entry;
+    command_t *command;
+    uint32_t hash = hash_name(name);
+
+    /* Commands cached from an older snapshot may have been freed. */
+    if (cache->generation != reg->generation)
+    {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->generation = reg->generation;
+    }
+
+    entry = &cache->entries[hash & (DISPATCH_CACHE_SIZE - 1)];
+    if (entry->command && entry->hash == hash &&
+            strcmp(entry->key, name) == 0)
+    {
+        cache->hits++;
+        *id = entry->id;
+        return (command_t *)entry->command;
+    }
+    cache->misses++;
+
+    if ((*id = find_hashed(reg, name, hash)) < 0)
+        return NULL;
+
+    command = (command_t *)reg->ids[*id];
+    entry->hash    = hash;
+    entry->id      = *id;
+    entry->command = command;
+    entry->key     = strcmp(name, CMD_NAME(command)) == 0 ?
+        CMD_NAME(command) : CMD_ABBR(command);
+    return command;
+}
+
+
+/*
+ * Counters of the dispatch cache of the parse loop.
+ */
+void scp_get_dispatch_stats(uint32_t *hits, uint32_t *misses)
+{
+    *hits   = parse_context.cache.hits;
+    *misses = parse_context.cache.misses;
+}
+
+
+/*
+ * The context of the parse loop.
+ */
+scp_ctx_t *scp_get_context(void)
+{
+    return &parse_context;
+}
+
+
+/*
+ * Looks up the ID of a command.
+ */
+int scp_lookup_id(const char *name)
+{
+    uint32_t hash;
+    int id;
+
+    assert(name);
+
+    hash = hash_name(name);
+    scp_epoch_enter();
+    id = find_hashed(atomic_load(&registry), name, hash);
+    scp_epoch_exit();
+
+    return id;
+}
+
+
+/*
+ * The command with an ID.
+ */
+const command_t *scp_command_by_id(int id)
+{
+    registry_t *reg = atomic_load(&registry);
+
+    return id >= 0 && id < reg->nids ? reg->ids[id] : NULL;
+}
+
+
+/**
+ * \brief Validates the arguments of a command, calls it and ends the
+ * response.
+ *
+ * \param   out     Output for the command.
+ * \param   command The command.
+ * \param   id      ID of the command, for the trace.
+ * \param   argc    Count of argv parameters.
+ * \param   argv    The arguments.
+ *
+ * \return  The result of the command, or 0 if the arguments are invalid.
+ */
+static int dispatch(scp_out_t *out, command_t *command, int id, int argc,
+        char *argv[])
+{
+    int result = 0;
+
+    if (argc < command->min_arg)
+    {
+        scp_out_end(out, STATUS_TOO_FEW, command->min_arg);
+    }
+    else if (argc > command->max_arg)
+    {
+        scp_out_end(out, STATUS_TOO_MANY, command->max_arg);
+    }
+    else {
+        scp_current_command = command;
+        scp_trace(SCP_TRACE_BEGIN, id, 0);
+        result = scp_call(out, command, id, argc, argv);
+        scp_trace(SCP_TRACE_END, id, 0);
+        scp_current_command = NULL;
+        scp_last_result = result;
+
+        scp_out_end(out, STATUS_OK, result);
+    }
+    return result;
+}
+
+
+/*
+ * Invokes a command by ID.
+ */
+int scp_invoke(scp_ctx_t *ctx, int id, int argc, char *argv[])
+{
+    char name[MAX_INT_STR + 1];
+    command_t *command = NULL;
+    scp_ctx_t *outer = scp_current_context;
+    int result = 0;
+
+    assert(ctx);
+    assert(argc == 0 || argv);
+
+    scp_current_context = ctx;
+    scp_epoch_enter();
+    command = (command_t *)scp_command_by_id(id);
+
+    if (command)
+    {
+        scp_out_begin(ctx->out, ++ctx->seq, CMD_NAME(command));
+        result = dispatch(ctx->out, command, id, argc, argv);
+    }
+    else
+    {
+        sprintf(name, "#%d", id);
+        scp_out_begin(ctx->out, ++ctx->seq, name);
+        scp_out_end(ctx->out, STATUS_UNKNOWN, 0);
+    }
+    scp_epoch_exit();
+    scp_current_context = outer;
+
+    scp_out_flush(ctx->out);
+    scp_epoch_reclaim();
+    return result;
+}
+
+
+/*
+ * Executes a line of input.
+ */
+int scp_parse_line(scp_ctx_t *ctx, char *line)
+{
+    char *argv[MAX_ARGC];
+    int argc = 0;
+    char *token;
+    char *save;
+    command_t *command;
+    scp_out_t *out = ctx->out;
+    scp_ctx_t *outer = scp_current_context;
+    int hooked;
+    int id;
+
+    /* A line of only delimiters is not a command. Lines can be executed by
+     * several threads, so the tokenizer keeps its place in save.
+     */
+    if ((token = strtok_r(line, TOKEN_DELIMITERS, &save)) == NULL)
+        return 0;
+    scp_out_begin(out, ctx->seq + 1, token);
+
+    /* The command cannot be freed until the section is exited, even if
+     * it is removed meanwhile.
+     */
+    scp_current_context = ctx;
+    scp_epoch_enter();
+    command = scp_find_command_cached(&ctx->cache, token, &id);
+    scp_trace(SCP_TRACE_LOOKUP, id, 0);
+    if (command != NULL)
+    {
+        /* Tokens past MAX_ARGC are counted but not stored, so the command
+         * is refused with too many arguments rather than run without them.
+         */
+        while ((token = strtok_r(NULL, TOKEN_DELIMITERS, &save)) != NULL)
+        {
+            if (argc < MAX_ARGC)
+                argv[argc] = token;
+            argc++;
+        }
+        scp_trace(SCP_TRACE_TOKENIZED, id, argc);
+
+        if (argc > MAX_ARGC)
+        {
+            scp_out_end(out, STATUS_TOO_MANY,
+                    command->max_arg < MAX_ARGC ? command->max_arg : MAX_ARGC);
+        }
+        /* Give an optional module the chance to consume the line, e.g.
+         * when a macro is being recorded.
+         */
+        else if (scp_line_hook &&
+                (hooked = (*scp_line_hook)(out, command, id, argc, argv)) !=
+                HOOK_PASS)
+        {
+            if (hooked == HOOK_CONSUMED)
+            {
+                scp_epoch_exit();
+                scp_current_context = outer;
+                return 0;
+            }
+            scp_out_end(out, STATUS_ERROR, 0);
+        }
+        else
+        {
+            dispatch(out, command, id, argc, argv);
+        }
+    }
+    else
+    {
+        scp_out_end(out, STATUS_UNKNOWN, 0);
+    }
+    scp_epoch_exit();
+    scp_current_context = outer;
+
+    /* Free the commands removed by this line. */
+    scp_epoch_reclaim();
+    ++ctx->seq;
+    return 1;
+}
+
+
+/**
+ * \brief Refuses a line too long for the input buffer, executing none of
+ * it.
+ *
+ * \param   ctx     The context.
+ * \param   line    The start of the line, which is tokenized in place for
+ *                  the name of the response.
+ */
+static void refuse_line(scp_ctx_t *ctx, char *line)
+{
+    char *token;
+    char *save;
+
+    token = strtok_r(line, TOKEN_DELIMITERS, &save);
+    scp_out_begin(ctx->out, ++ctx->seq, token ? token : "");
+    scp_out_end(ctx->out, STATUS_TOO_LONG, MAX_INPUT_BUFFER - 1);
+}
+
+
+/*
+ * Executes the lines of a script.
+ */
+int scp_parse_script(scp_ctx_t *ctx, const char *script)
+{
+    char line[MAX_INPUT_BUFFER];
+    int lines = 0;
+    int length;
+
+    assert(ctx);
+    assert(script);
+
+    end_parsing = 0;
+    while (*script && end_parsing == 0)
+    {
+        length = (int)strcspn(script, "\n");
+        memcpy(line, script, length < MAX_INPUT_BUFFER - 1 ?
+                length : MAX_INPUT_BUFFER - 1);
+
+        script += length;
+        if (*script == '\n')
+            script++;
+
+        if (length > MAX_INPUT_BUFFER - 1)
+        {
+            line[MAX_INPUT_BUFFER - 1] = '\0';
+            refuse_line(ctx, line);
+        }
+        else if (length)
+        {
+            line[length] = '\0';
+            lines += scp_parse_line(ctx, line);
+        }
+    }
+    scp_out_flush(ctx->out);
+    return lines;
+}
+
+
+/*
+ * Releases the state the modules keep for a context.
+ */
+void scp_release_context(scp_ctx_t *ctx)
+{
+    assert(ctx);
+
+    if (scp_release_hook)
+        (*scp_release_hook)(ctx);
+}
+
+
+/**
+ * scp_parse function.
+ */
+void scp_parse(void)
+{
+    char strbuff[MAX_INPUT_BUFFER];
+    int length;
+
+    scp_out_t *out = &scp_output;
+
+#if SCP_METRICS
+    atomic_fetch_add(&scp_counters.sessions, 1);
+#endif
+
+    /* Call the built-in 'help' command to display the commands already
+     * added to the parser, unless the input is not typed.
+     */
+    if (out->mode == SCP_MODE_TEXT && !pipe_mode)
+    {
+        scp_epoch_enter();
+        help_cmd_func(out, 0, NULL);
+        scp_epoch_exit();
+    }
+
+    /* While the 'end_parsing' flag is not set, keep parsing commands.
+     * This flag can be set be the 'end' command - if it is enabled - and
+     * is cleared so that the loop can be run again.
+     */
+    end_parsing = 0;
+    while (end_parsing == 0)
+    {
+        int text = out->mode == SCP_MODE_TEXT && !pipe_mode;
+
+        prompt_count = parse_context.seq + 1;
+        put_prompt(out);
+
+        /* Input is echoed directly, so the prompt must be output first. */
+        scp_out_flush(out);
+        length = input(strbuff, MAX_INPUT_BUFFER, text);
+        if (text)
+            scp_out_write(out, NL, sizeof(NL) - 1);
+
+        /* The end of the input ends the loop, as the 'end' command does. */
+        if (length == INPUT_END)
+            break;
+
+        /* None of a line too long is executed. */
+        if (length == INPUT_TOO_LONG)
+        {
+            refuse_line(&parse_context, strbuff);
+            continue;
+        }
+
+        /* If the input is empty (string size 0) then continue. */
+        if (length == 0)
+            continue;
+
+        scp_trace(SCP_TRACE_LINE, -1, length);
+
+        /* The line is tokenized in place, so is seen first as entered. */
+        if (scp_input_hook)
+            (*scp_input_hook)(strbuff, length);
+
+        scp_parse_line(&parse_context, strbuff);
+    }
+    scp_out_flush(out);
+
+#if SCP_METRICS
+    atomic_fetch_sub(&scp_counters.sessions, 1);
+#endif
+}
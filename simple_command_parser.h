@@ -3,28 +3,64 @@
  *
  * \brief Simple command line parser.
  *
- * Provides a very simple command line parser. Provides two built in 'commands'
+ * Provides a very simple command line parser. Provides four built in
+ * 'commands'
  * -# help - which lists all the commands supported.
  * -# end - which exits the parser loop.
+ * -# mode - which selects text, json or csv output.
+ * -# trace - which dumps or clears the trace of dispatch events, see
+ *    scp_trace.h. Not built in the SCP_TINY profile.
  */
 
 #ifndef SIMPLE_COMMAND_PARSER_H_
 #define SIMPLE_COMMAND_PARSER_H_
 
+#include <stdint.h>
+
+/*
+ * Build profiles.
+ *
+ * Define SCP_TINY to build the parser for the smallest footprint: commands
+ * are packed with 8 bit argument bounds, a single function pointer and no
+ * help strings, and the buffers are smaller. Every limit below,
+ * and those in scp_internal.h, can also be overridden individually at build
+ * time, e.g. with -DMAX_CMD_STR=12.
+ */
+
 /**
  * The maximum command string length including terminating 0.
  */
-#define MAX_CMD_STR 21
+#ifndef MAX_CMD_STR
+    #define MAX_CMD_STR 21
+#endif
 
 /**
  * The maximum command abbreviation string length including terminating 0.
  */
-#define MAX_ABBR_STR 9
+#ifndef MAX_ABBR_STR
+    #define MAX_ABBR_STR 9
+#endif
 
 /**
  * The maximum command help string length including terminating 0.
  */
-#define MAX_HELP_STR 41
+#ifndef MAX_HELP_STR
+    #define MAX_HELP_STR 41
+#endif
+
+/**
+ * The maximum number of event sources, see scp_add_event_source().
+ */
+#ifndef MAX_EVENT_SOURCES
+    #define MAX_EVENT_SOURCES 4
+#endif
+
+/*
+ * Output modes, see scp_set_output_mode().
+ */
+#define SCP_MODE_TEXT   0   /**< Interactive console with prompts. */
+#define SCP_MODE_JSON   1   /**< One JSON object per line per command. */
+#define SCP_MODE_CSV    2   /**< One CSV record per line per command. */
 
 /**
  * \typedef (*cmd_func_t)(int argc, char *argv[])
@@ -42,11 +78,184 @@
  */
 typedef int (*cmd_func_t)(int argc, char *argv[]);
 
+/**
+ * \typedef scp_out_t
+ *
+ * \brief Output writer passed to #cmd_ex_func_t command functions.
+ */
+typedef struct _scp_out_t scp_out_t;
+
+/**
+ * \typedef scp_ctx_t
+ *
+ * \brief A parser context: the output commands are framed on, their
+ * sequence numbers and a cache of the commands looked up.
+ */
+typedef struct _scp_ctx_t scp_ctx_t;
+
+/**
+ * \typedef (*cmd_ex_func_t)(scp_out_t *out, int argc, char *argv[])
+ *
+ * \brief Function pointer type for command functions that output values.
+ *
+ * As #cmd_func_t, but the function can also stream any number of values to
+ * out with scp_out_int(), scp_out_ints(), scp_out_bytes() and scp_out_str().
+ * Values are buffered and output after the 'Out[n]>' prompt for the command,
+ * separated by spaces. If no values are output, the return value is
+ * displayed instead.
+ */
+typedef int (*cmd_ex_func_t)(scp_out_t *out, int argc, char *argv[]);
+
+/**
+ * \typedef scp_command_t
+ *
+ * \brief Typedef of the _scp_command_t struct.
+ */
+typedef struct _scp_command_t scp_command_t;
+
+/**
+ * \struct _scp_command_t
+ *
+ * \brief Describes a command.
+ *
+ * Descriptors can be const, so a table of them stays in flash on a
+ * microcontroller, see scp_add_command_table(). Initialise them with
+ * #SCP_COMMAND_DEF or #SCP_COMMAND_DEF_EX, as the layout depends on the
+ * build profile.
+ */
+struct _scp_command_t {
+    /** Command name string. */
+    const char          *cmd_str;
+    /** Abbreviated command name string, "" or NULL if none. */
+    const char          *abbr_str;
+#ifdef SCP_TINY
+    /** Minimum number of arguments */
+    uint8_t             min_arg;
+    /** Maximum number of arguments */
+    uint8_t             max_arg;
+    /** Set if fn holds ex_func. */
+    uint8_t             is_ex;
+    /** Function called for the command. */
+    union {
+        cmd_func_t      func;
+        cmd_ex_func_t   ex_func;
+    }                   fn;
+#else
+    /** Command help description */
+    const char          *help_str;
+    /** Minimum number of arguments */
+    int                 min_arg;
+    /** Maximum number of arguments */
+    int                 max_arg;
+    /** Function called for the command, or NULL if ex_func is used. */
+    cmd_func_t          func;
+    /** Function called for the command with an output writer. */
+    cmd_ex_func_t       ex_func;
+#endif
+};
+
+#ifdef SCP_TINY
+    #define SCP_COMMAND_DEF(name, abbr, help, min, max, f) \
+        { name, abbr, min, max, 0, { .func = f } }
+    #define SCP_COMMAND_DEF_EX(name, abbr, help, min, max, f) \
+        { name, abbr, min, max, 1, { .ex_func = f } }
+#else
+    /** Initialiser of a #scp_command_t for a #cmd_func_t function. */
+    #define SCP_COMMAND_DEF(name, abbr, help, min, max, f) \
+        { name, abbr, help, min, max, f, NULL }
+    /** Initialiser of a #scp_command_t for a #cmd_ex_func_t function. */
+    #define SCP_COMMAND_DEF_EX(name, abbr, help, min, max, f) \
+        { name, abbr, help, min, max, NULL, f }
+#endif
+
+/*
+ * Commands defined with SCP_COMMAND() are collected by the linker into the
+ * scp_commands section and found by scp_init() from the section bounds, so
+ * modules can add commands without any registration call. This needs a GNU
+ * toolchain producing ELF. With a custom linker script, the section must be
+ * kept and bounded, e.g.
+ *
+ *      scp_commands : {
+ *          PROVIDE(__start_scp_commands = .);
+ *          KEEP(*(scp_commands))
+ *          PROVIDE(__stop_scp_commands = .);
+ *      }
+ */
+#if defined(__GNUC__) && defined(__ELF__)
+    #define SCP_HAVE_COMMAND_SECTION 1
+
+    /** Attributes of a descriptor placed in the scp_commands section. The
+     *  alignment stops the compiler padding descriptors apart. */
+    #define SCP_COMMAND_SECTION \
+        __attribute__((used, section("scp_commands"), \
+                       aligned(sizeof(void *))))
+
+    /**
+     * \brief Defines a #cmd_func_t command, registered automatically.
+     *
+     * Followed by the body of the function, with the parameters argc and
+     * argv, e.g.
+     *
+     * \code{c}
+     * SCP_COMMAND(neg, "n", "Negate <P1>", 1, 1)
+     * {
+     *     return -atoi(argv[0]);
+     * }
+     * \endcode
+     *
+     * The command name is the identifier name, as a string.
+     */
+    #define SCP_COMMAND(name, abbr, help, min, max) \
+        static int name##_scp_cmd_func(int argc, char *argv[]); \
+        static const scp_command_t name##_scp_command SCP_COMMAND_SECTION = \
+            SCP_COMMAND_DEF(#name, abbr, help, min, max, \
+                    name##_scp_cmd_func); \
+        static int name##_scp_cmd_func(int argc, char *argv[])
+
+    /**
+     * \brief Defines a #cmd_ex_func_t command, registered automatically.
+     *
+     * As SCP_COMMAND(), with the parameters out, argc and argv.
+     */
+    #define SCP_COMMAND_EX(name, abbr, help, min, max) \
+        static int name##_scp_cmd_func(scp_out_t *out, int argc, \
+                char *argv[]); \
+        static const scp_command_t name##_scp_command SCP_COMMAND_SECTION = \
+            SCP_COMMAND_DEF_EX(#name, abbr, help, min, max, \
+                    name##_scp_cmd_func); \
+        static int name##_scp_cmd_func(scp_out_t *out, int argc, \
+                char *argv[])
+#endif
+
+/**
+ * \typedef scp_command_state_t
+ *
+ * \brief Mutable state of a command in a const table, kept in RAM.
+ */
+typedef struct {
+    /** Number of times the command has been called. */
+    uint32_t            calls;
+} scp_command_state_t;
+
+/**
+ * \typedef (*scp_event_func_t)(scp_out_t *out, int fd, void *arg)
+ *
+ * \brief Function pointer type for event source handlers.
+ *
+ * Called by the parser when the file descriptor of an event source is
+ * readable. Values output to out are displayed as an unsolicited response,
+ * see scp_add_event_source(). The return value is the response's result.
+ */
+typedef int (*scp_event_func_t)(scp_out_t *out, int fd, void *arg);
+
 /**
  * \brief Initialise the Simple Command Parser.
  *
  * This must be called before any other of the simple command parser functions.
  *
+ * Adds the built-in commands, then the commands defined with SCP_COMMAND()
+ * anywhere in the program.
+ *
  * \param do_not_exit   Set to any value other than 0 to disable the 'end'
  *                      command and parse forever.
  */
@@ -67,6 +276,7 @@ void scp_init(int do_not_exit);
  * \param   help_str    String describing function usage - displayed for 'help'
  *                      built in parse command.
  *                      This cannot exceed #MAX_HELP_STR in length.
+ *                      Not stored in the SCP_TINY profile.
  * \param   min_arg     Minimum number of args expected - used for validation.
  * \param   max_arg     Maximum number of args expected.
  * \param   func        Function pointer using the #cmd_func_t type for the
@@ -82,11 +292,291 @@ void scp_init(int do_not_exit);
          );
 
 
+/**
+ * \brief Add a table of commands.
+ *
+ * The table is used in place rather than copied, so it can be const and
+ * stay in flash. Registering it publishes the registry once however many
+ * commands it holds, and the RAM used is one registry entry for the table
+ * plus the optional state array, and outside the SCP_TINY profile an entry
+ * of 8 bytes per name in the hash table the registry is searched with. The
+ * names themselves are not copied.
+ *
+ * \param   table   The commands, which must remain valid.
+ * \param   count   Number of commands in table.
+ * \param   state   Array of count states, updated as the commands are
+ *                  called, or NULL.
+ */
+void scp_add_command_table(
+        const scp_command_t *table,
+        int count,
+        scp_command_state_t *state
+        );
+
+
+/**
+ * \brief Get the counters of the dispatch cache of the parse loop.
+ *
+ * The parse loop looks commands up in a small cache keyed by a hash of the
+ * name before searching the registry, so the few commands that make up most
+ * of the input are found with one comparison. The cache is emptied when
+ * commands are added or removed.
+ *
+ * \param   hits    Where to store the number of lookups found in the cache.
+ * \param   misses  Where to store the number of lookups that searched the
+ *                  registry, including those of unknown commands.
+ */
+void scp_get_dispatch_stats(uint32_t *hits, uint32_t *misses);
+
+
+/**
+ * \brief Get the context of the parse loop.
+ *
+ * Its responses are numbered separately from the input lines.
+ *
+ * \return  The context, for scp_invoke().
+ */
+scp_ctx_t *scp_get_context(void);
+
+
+/**
+ * \brief Get the ID of a command, to call it with scp_invoke().
+ *
+ * IDs are small integers, given to commands as they are added and never
+ * reused, so the ID of a command stays the same until it is removed.
+ *
+ * \param   name    Name or abbreviation of the command.
+ *
+ * \return  The ID, or -1 if there is no such command.
+ */
+int scp_lookup_id(const char *name);
+
+
+/**
+ * \brief Call a command by ID, without formatting and parsing a line.
+ *
+ * The command is found by indexing an array rather than by name. As for a
+ * line of input, the number of arguments is checked against the command's
+ * limits, the call is counted and timed, and the response is framed and
+ * flushed in the output mode. An ID that is not, or no longer, a command
+ * gives an unknown command response.
+ *
+ * A context must only be used by one thread at a time, and the parse
+ * loop's context only by the parse loop's thread.
+ *
+ * \param   ctx     The context, see scp_get_context().
+ * \param   id      The ID, see scp_lookup_id().
+ * \param   argc    Count of argv parameters.
+ * \param   argv    The arguments.
+ *
+ * \return  The result of the command, or 0 if it was not called.
+ */
+int scp_invoke(scp_ctx_t *ctx, int id, int argc, char *argv[]);
+
+
+/**
+ * \brief Set the output mode.
+ *
+ * In #SCP_MODE_TEXT, the default, the parser displays prompts, echoes input
+ * and displays responses as 'Out[n]> result'.
+ *
+ * In #SCP_MODE_JSON and #SCP_MODE_CSV there are no prompts or echo, and the
+ * response to each command is one line, for example:
+ *
+ * \code{txt}
+{"seq":1,"cmd":"add","values":[],"status":"ok","result":8,"us":2}
+1,"add","",ok,8,2
+ * \endcode
+ *
+ * status is one of ok, too_few_args, too_many_args, unknown_command,
+ * line_too_long, for a line longer than the input buffer, or error, for a
+ * line refused with the error messages as values, e.g. while recording a
+ * macro. Neither of the last two is executed. us is the time taken in
+ * microseconds. values are output by #cmd_ex_func_t
+ * command functions and are space separated in CSV.
+ *
+ * The mode can also be changed with the built-in 'mode' command.
+ *
+ * \param   mode    One of the SCP_MODE_ values.
+ */
+void scp_set_output_mode(int mode);
+
+
+/**
+ * \brief Select the pipe mode, for input that is not typed.
+ *
+ * In the pipe mode the parse loop outputs only the responses, with no help
+ * table, prompts or echo, and stdout is fully buffered. On Linux the
+ * output is flushed whenever the loop would wait for input, so a program
+ * feeding it a line at a time gets each response. scp_init() selects it
+ * when stdin is not a terminal, on Linux; it can be selected or not after
+ * scp_init(), before there is any output.
+ *
+ * \param   pipe    Non-zero for the pipe mode.
+ */
+void scp_set_pipe_mode(int pipe);
+
+
+/**
+ * \brief Get the pipe mode, see scp_set_pipe_mode().
+ *
+ * \return  Non-zero in the pipe mode.
+ */
+int scp_get_pipe_mode(void);
+
+
+ /**
+ * \brief Add a new command that outputs values.
+ *
+ * As scp_add_command(), but for a #cmd_ex_func_t command function.
+ */
+ void scp_add_command_ex(
+         const char*    cmd_str,
+         const char*    abbr_str,
+         const char*    help_str,
+         int            min_arg,
+         int            max_arg,
+         cmd_ex_func_t  ex_func
+         );
+
+
+/**
+ * \brief Remove a command.
+ *
+ * Removes the command with the name or abbreviation name, which may be
+ * running at the time, in this or another thread. Commands are looked up
+ * in a snapshot of the registry without taking a lock, so adding and
+ * removing commands is safe while other threads dispatch them. Memory of a
+ * removed command is freed once no thread can still be using it.
+ *
+ * Removing one command of a table added with scp_add_command_table() leaves
+ * the rest of the table registered. Macros calling the command report an
+ * error instead.
+ *
+ * \param   name    Name or abbreviation of the command.
+ *
+ * \return  1 if the command was removed, 0 if there is no such command.
+ */
+int scp_remove_command(const char *name);
+
+
+/**
+ * \brief Remove the commands of a table added by scp_add_command_table().
+ *
+ * All the commands are removed at once. As for scp_remove_command(), they
+ * may be running, and are freed once no thread can still be using them.
+ * Anything retired afterwards with scp_epoch_retire(), see scp_epoch.h,
+ * e.g. the library holding the table, is freed after them.
+ *
+ * \param   table   The table.
+ * \param   count   Number of commands in table.
+ *
+ * \return  The number of commands removed.
+ */
+int scp_remove_command_table(const scp_command_t *table, int count);
+
+
+/**
+ * \brief Output an integer value from a #cmd_ex_func_t command function.
+ *
+ * \param   out     The output passed to the command function.
+ * \param   value   The value.
+ */
+void scp_out_int(scp_out_t *out, int value);
+
+/**
+ * \brief Output a 64 bit integer value, e.g. a timestamp.
+ *
+ * \param   out     The output passed to the command function.
+ * \param   value   The value.
+ */
+void scp_out_int64(scp_out_t *out, int64_t value);
+
+/**
+ * \brief Output an array of integer values.
+ *
+ * \param   out     The output passed to the command function.
+ * \param   values  The values.
+ * \param   count   Number of values.
+ */
+void scp_out_ints(scp_out_t *out, const int *values, int count);
+
+/**
+ * \brief Output bytes as a single value, displayed as hex digits.
+ *
+ * \param   out     The output passed to the command function.
+ * \param   bytes   The bytes.
+ * \param   count   Number of bytes.
+ */
+void scp_out_bytes(scp_out_t *out, const unsigned char *bytes, int count);
+
+/**
+ * \brief Output a string value.
+ *
+ * \param   out     The output passed to the command function.
+ * \param   str     The 0 terminated string.
+ */
+void scp_out_str(scp_out_t *out, const char *str);
+
+/**
+ * \brief Add an event source to the parser's input loop. Linux only.
+ *
+ * While the parser waits for input, it polls the file descriptors of the
+ * event sources together with stdin and calls func whenever fd is readable.
+ * The values func outputs are displayed as a response without a sequence
+ * number, as 'name> values' in the text mode, or with seq 0 and cmd name in
+ * the JSON and CSV modes. If func outputs no values, nothing is displayed.
+ *
+ * Up to #MAX_EVENT_SOURCES sources can be added. A source whose file
+ * descriptor reports an error or hang up is removed.
+ *
+ * \param   name    Name shown with the events.
+ * \param   fd      File descriptor to poll for input.
+ * \param   func    Function called when fd is readable.
+ * \param   arg     Passed to func.
+ *
+ * \return  1 on success, 0 if there are too many sources.
+ */
+int scp_add_event_source(const char *name, int fd, scp_event_func_t func,
+        void *arg);
+
+/**
+ * \brief Remove an event source added by scp_add_event_source().
+ *
+ * \param   fd      File descriptor of the source.
+ */
+void scp_remove_event_source(int fd);
+
+
+ /**
+ * \brief Add the macro and script commands to the parser.
+ *
+ * Adds commands for defining macros and writing small scripts:
+ * -# def \<name\> - records every following line as a step of the macro
+ *    instead of executing it, until 'enddef' is entered.
+ * -# enddef - finishes the macro and adds it as a new command \<name\>.
+ * -# alias \<name\> \<cmd\> [\<args\>...] - defines a single step macro.
+ * -# set \<name\> \<value\> - assigns a variable, read back as $name.
+ * -# repeat \<n\> { - runs the lines up to the matching } n times.
+ * -# if \<a\> [\<op\> \<b\>] { - runs the lines up to the matching } if
+ *    a is non-zero, or if a op b is true where op is == != < > <= or >=.
+ *
+ * Arguments $1 to $6 in a macro are replaced with the arguments the macro is
+ * called with, $_ with the result of the last command and $name with the
+ * value of a variable. Macros and blocks are compiled as they are entered,
+ * resolving commands and variables, so running them does not search for or
+ * tokenize commands. A block entered at the prompt runs when it is closed.
+ *
+ * Must be called after scp_init().
+ */
+void scp_add_macro_commands(void);
+
+
  /**
  * \brief Run the command line parser.
  *
  * This function will loop until the 'end' command is entered, unless the
- * 'end' command has been disabled - see scp_init().
+ * 'end' command has been disabled - see scp_init(), or the input ends.
  *
  */
 void scp_parse(void);
@@ -120,8 +610,10 @@ void scp_parse(void);
  * -# add - adds parameters together.
  * -# sub - subtracts the second parameter from the first parameter.
  *
- * The parser adds two commands by default:
+ * The parser adds four commands by default:
  * -# help - displays all defined commands.
+ * -# mode - selects the output mode, see scp_set_output_mode().
+ * -# trace - dumps or clears the trace of dispatch events.
  * -# end  - exits the parser (if enabled by flag in scp_init()).
  *
  * \code {c}
@@ -197,6 +689,8 @@ Simple Command Parser
 
 COMMAND      ABBR   DESCRIPTION
  help         h      Lists all commands available.
+ mode                Output mode <text|json|csv>
+ trace               Trace <dump [<name>]|clear>
  end          end    Exit the parser.
  add          a      Add <P1> to <P2> [... to <P5>]
  sub          s      Subtract <P2> from <P1>
@@ -209,6 +703,8 @@ In [3]> help
 
 COMMAND      ABBR   DESCRIPTION
  help         h      Lists all commands available.
+ mode                Output mode <text|json|csv>
+ trace               Trace <dump [<name>]|clear>
  end          end    Exit the parser.
  add          a      Add <P1> to <P2> [... to <P5>]
  sub          s      Subtract <P2> from <P1>
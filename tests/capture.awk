@@ -0,0 +1,44 @@
+# Checks the output of capture.scp: steady levels are captured as a single
+# run of every sample, and a 500 Hz square wave sampled at 10 kHz as
+# alternating runs of about 10 samples, with no overrun reported. Line 31
+# is output unsigned.
+
+function fail(msg)
+{
+    print "FAIL: " msg
+    failed = 1
+    exit 1
+}
+
+/^Out\[/ {
+    sub(/^Out\[[0-9]+\]> /, "")
+    out[++n] = $0
+}
+
+END {
+    if (failed)
+        exit 1
+    if (out[2] != "80 1000")
+        fail("steady capture: " out[2])
+    if (out[4] != "160 500")
+        fail("second steady capture: " out[4])
+
+    nf = split(out[6], v, " ")
+    if (nf % 2)
+        fail("wave capture, odd number of values: " out[6])
+    total = 0
+    for (i = 1; i < nf; i += 2) {
+        if (v[i] != "0" && v[i] != "1")
+            fail("wave capture, bad level " v[i])
+        if (i > 1 && v[i] == v[i - 2])
+            fail("wave capture, runs do not alternate")
+        total += v[i + 1]
+    }
+    if (total != 1000)
+        fail("wave capture, " total " samples")
+    if (nf / 2 < 20)
+        fail("wave capture, only " nf / 2 " runs")
+    if (out[9] != "2147483648 100")
+        fail("line 31 capture: " out[9])
+    print "ok"
+}
@@ -0,0 +1,45 @@
+# Checks the output of watch.scp: 41 edges are made on line 0 of a watched
+# chip, 40 of them while the input is read in a few chunks, so the edge queue
+# of the simulated chip overflows. Every edge must be either reported or
+# counted as lost from the gaps in the sequence numbers.
+
+function fail(msg)
+{
+    print "FAIL: " msg
+    failed = 1
+    exit 1
+}
+
+/^watch> / {
+    if ($2 != "0" || (NF - 2) % 3)
+        fail("bad event: " $0)
+    for (i = 3; i < NF; i += 3) {
+        if ($i != "0" || ($(i + 1) != "0" && $(i + 1) != "1"))
+            fail("bad edge in: " $0)
+        if ($(i + 2) < last_ns)
+            fail("edges out of order in: " $0)
+        last_ns = $(i + 2)
+        edges++
+    }
+}
+
+# The statistics of the 'watch' command, the only response of 4 values.
+/^Out\[/ {
+    sub(/^Out\[[0-9]+\]> /, "")
+    if (NF == 4)
+        stats = $0
+}
+
+END {
+    if (failed)
+        exit 1
+    if (split(stats, v, " ") != 4 || v[1] != "0" || v[2] != "1")
+        fail("watch statistics: " stats)
+    if (v[3] != edges)
+        fail(edges " edges output, " v[3] " counted")
+    if (v[4] == 0)
+        fail("no edge lost")
+    if (v[3] + v[4] != 41)
+        fail(v[3] " edges and " v[4] " lost, of 41")
+    print "ok"
+}